@@ -0,0 +1,657 @@
+/*
+ * bench_blx: end to end throughput of ma on a synthetic capture
+ *
+ *     bench_blx [options] <dir>       write a capture to <dir>/cap_a, then run ma -b, -g, -s, -t and -r in <dir>
+ *     bench_blx -n [options] <dir>    only write the capture
+ *     bench_blx -v [options] <dir>    check that ma -b writes the same meta files whatever the chunk size
+ *
+ *     -p <parts>      blx files in the capture(trace.blx, trace_part_1.blx, ...), default 4
+ *     -e <events>     heap trace items per part, default 200000
+ *     -f <percent>    deallocs out of the heap trace items, default 45. Allocs that could take the live
+ *                     bytes over BLX_LIVE_BUDGET(3/4 of DEFAULT_TOTAL_FREE_HEAP) are turned into deallocs
+ *     -x <percent>    trace items that are not heap allocs/deallocs(other messages, other heap hooks), default 6
+ *     -c <percent>    runs of corrupt bytes between trace items, default 4
+ *     -s <seed>       random seed, default 1
+ *     -a              adversarial capture: corrupt bytes made of header signature bytes, wrong trace item
+ *                     lengths, callers that look like trace headers
+ *     -m <ma>         ma binary to run, default ./ma
+ *
+ * Every part starts with BLX_STARTING_POINT bytes of preamble and ends with a truncated trace header.
+ * The first part starts with HEAP_INIT, allocs go through all the SIGNATURE_HEAP_* hooks, callers come from
+ * a small pool so they repeat like in real traces. The capture only depends on the options, so runs
+ * with the same options compare.
+ *
+ * Each stage runs in a child process, MB/s is blx bytes per second, events/s is heap trace items per second
+ * and the peak RSS comes from wait4().
+ *
+ * -v writes the capture and then the adversarial one, runs ma -b on each with one chunk per file and with
+ * BLX_CHUNK_SIZE_ENV set to a few small chunk sizes, and compares the meta files byte by byte. Small
+ * chunks cut trace items and corrupt runs everywhere, so every stitching path of the chunked decode is taken.
+ *
+ * How to build it?
+ *     make bench_blx
+ *     make bench        build ma and bench_blx, then run the whole suite in ./bench_tmp
+ */
+
+#define _GNU_SOURCE   /* nftw, wait4 */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#include "ma.h"
+
+#define BLX_CALLER_POOL  512
+#define BLX_NOISE_MAX    60     /* longest run of corrupt bytes */
+#define BLX_TIME_STEP    300    /* max ms between trace items */
+#define BLX_BLOCK_MAX    4096   /* largest heap block */
+#define BLX_LIVE_BUDGET  ((uint32)(DEFAULT_TOTAL_FREE_HEAP * 3 / 4))   /* live bytes never go over it */
+#define BLX_WHOLE_FILE   "1099511627776"   /* chunk size no capture gets to, one chunk per file */
+
+typedef struct BLX_GEN_OPTIONS {
+    uint32 parts;
+    uint32 events;
+    uint32 free_percent;
+    uint32 noise_percent;
+    uint32 corrupt_percent;
+    uint64 seed;
+    uint8  adversarial;
+} BLX_GEN_OPTIONS;
+
+typedef struct BLX_GEN_BLOCK {
+    uint32 addr;
+    uint32 size;
+} BLX_GEN_BLOCK;
+
+typedef struct BLX_GEN_STATE {
+    uint64   rng;
+    uint64   time;                   /* raw trace time, before decode_timestamp_ns */
+    uint32   callers[BLX_CALLER_POOL];
+    BLX_GEN_BLOCK * live;            /* the live blocks */
+    uint32   live_nums;
+    uint32   live_capacity;
+    uint32   live_bytes;
+    uint32   next_addr;
+    uint64   heap_items;             /* heap trace items ma picks up */
+    uint64   bytes;
+    uint8    adversarial;
+} BLX_GEN_STATE;
+
+typedef struct BLX_STAGE {
+    const char * name;
+    const char * args[3];
+} BLX_STAGE;
+
+static uint64 xorshift64(uint64 * state)
+{
+    uint64 x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+
+    return *state = x;
+}
+
+static uint32 gen_random(BLX_GEN_STATE * gen, uint32 range)
+{
+    return xorshift64(&gen->rng) % range;
+}
+
+static void put_be32(uint8 * out, uint32 value)
+{
+    out[0] = value >> 24;
+    out[1] = value >> 16;
+    out[2] = value >> 8;
+    out[3] = value;
+}
+
+static void put_be64(uint8 * out, uint64 value)
+{
+    put_be32(out,value >> 32);
+    put_be32(out + 4,(uint32)value);
+}
+
+static void gen_random_bytes(BLX_GEN_STATE * gen, FILE * fd, uint32 len)
+{
+    const uint8 signature[] = {MEDIA_TYPE_TCPIP, MEDIA_TYPE_USB, RECEIVER_DEVICE_PC, SEND_DEVICE_TRACEBOX, RESOURCE_TRACEBOX,
+                               SIGNATURE_MESSAGE_ID, SIGNATURE_MASTER, SIGNATURE_HEAP_TYPE, '3', '4'};
+
+    uint8  bytes[BLX_STARTING_POINT];
+    uint32 i;
+
+    for (i = 0; i < len; i++) {
+        bytes[i] = gen->adversarial ? signature[gen_random(gen,sizeof(signature))] : gen_random(gen,256);
+    }
+
+    gen->bytes += fwrite(bytes,1,len,fd);
+}
+
+/* one trace item, tail_len bytes of the body union are used */
+static void gen_trace_item(BLX_GEN_STATE * gen, FILE * fd, uint8 media, uint8 msg_id, uint8 trace_type, uint8 trace_id,
+                           uint32 ptr, const STANDARD_MTBF_TRACE_BODY * tail, uint32 tail_len)
+{
+    STANDARD_MTBF_TRACE_HEADER smth;
+    STANDARD_MTBF_TRACE_BODY   smtb;
+
+    uint32 length = offsetof(STANDARD_MTBF_TRACE_BODY,hat) + tail_len;
+    char   text[3];
+
+    gen->time += 1 + gen_random(gen,BLX_TIME_STEP) * 1000000ULL;
+
+    smth.media           = media;
+    smth.receiver_device = RECEIVER_DEVICE_PC;
+    smth.sender_device   = SEND_DEVICE_TRACEBOX;
+    smth.resource        = RESOURCE_TRACEBOX;
+
+    /* the length field is all the decoder goes by to find the next trace item */
+    sprintf(text,"%02u",(gen->adversarial && gen_random(gen,10) == 0) ? gen_random(gen,60) : length);
+    memcpy(smth.length,text,2);
+
+    memset(&smtb,0x0,sizeof(smtb));
+    if (tail != NULL) {
+        memcpy(&smtb.hat,&tail->hat,tail_len);
+    }
+
+    smtb.msg_id     = msg_id;
+    smtb.master     = SIGNATURE_MASTER;
+    smtb.trace_type = trace_type;
+    smtb.trace_id   = trace_id;
+    smtb.task[1]    = gen_random(gen,16);
+    put_be64(smtb.time,gen->time);
+    put_be32(smtb.ptr,ptr);
+
+    gen->bytes += fwrite(&smth,1,sizeof(smth),fd);
+    gen->bytes += fwrite(&smtb,1,length,fd);
+}
+
+static void gen_live_add(BLX_GEN_STATE * gen, uint32 addr, uint32 size)
+{
+    if (gen->live_nums == gen->live_capacity) {
+        gen->live_capacity = gen->live_capacity == 0 ? 1024 : gen->live_capacity * 2;
+        gen->live = realloc(gen->live,gen->live_capacity * sizeof(BLX_GEN_BLOCK));
+        if (gen->live == NULL) {
+            fprintf(stderr,"gen_live_add@Out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    gen->live[gen->live_nums].addr = addr;
+    gen->live[gen->live_nums].size = size;
+    gen->live_nums++;
+    gen->live_bytes += size;
+}
+
+static void gen_heap_alloc(BLX_GEN_STATE * gen, FILE * fd)
+{
+    static const uint8 hooks[] = {
+        SIGNATURE_HEAP_ALLOC,           SIGNATURE_HEAP_ALLOC_NO_WAIT, SIGNATURE_HEAP_COND_ALLOC,
+        SIGNATURE_ALIGNED_ALLOC_NO_WAIT, SIGNATURE_ALIGNED_ALLOC,     SIGNATURE_HEAP_ALLOC_NO_WAIT_FROM
+    };
+
+    STANDARD_MTBF_TRACE_BODY tail;
+
+    uint8  hook    = hooks[gen_random(gen,sizeof(hooks))];
+    uint32 size    = 1 + gen_random(gen,BLX_BLOCK_MAX);
+    uint32 caller1 = gen->callers[gen_random(gen,BLX_CALLER_POOL)];
+    uint32 caller2 = gen->callers[gen_random(gen,BLX_CALLER_POOL)];
+    uint32 addr    = gen->next_addr;
+
+    /* heap blocks are 8 bytes aligned and mostly packed */
+    gen->next_addr += (size + 15) & ~7;
+    gen_live_add(gen,addr,size);
+
+    switch (hook)
+    {
+        case SIGNATURE_HEAP_ALLOC_NO_WAIT_FROM:
+            put_be32(tail.hanwft.size,size);
+            tail.hanwft.heapid[0] = 0;
+            tail.hanwft.heapid[1] = 1;
+            put_be32(tail.hanwft.caller1,caller1);
+            put_be32(tail.hanwft.caller2,caller2);
+            gen_trace_item(gen,fd,MEDIA_TYPE_TCPIP,SIGNATURE_MESSAGE_ID,SIGNATURE_HEAP_TYPE,hook,addr,&tail,sizeof(tail.hanwft));
+            break;
+
+        case SIGNATURE_HEAP_COND_ALLOC:
+            put_be32(tail.hcat.size,size);
+            put_be32(tail.hcat.low_water_mark,4096);
+            put_be32(tail.hcat.caller1,caller1);
+            put_be32(tail.hcat.caller2,caller2);
+            gen_trace_item(gen,fd,MEDIA_TYPE_TCPIP,SIGNATURE_MESSAGE_ID,SIGNATURE_HEAP_TYPE,hook,addr,&tail,sizeof(tail.hcat));
+            break;
+
+        case SIGNATURE_ALIGNED_ALLOC_NO_WAIT:
+        case SIGNATURE_ALIGNED_ALLOC:
+            put_be32(tail.haat.size,size);
+            put_be32(tail.haat.block_alignment,8);
+            put_be32(tail.haat.caller1,caller1);
+            put_be32(tail.haat.caller2,caller2);
+            gen_trace_item(gen,fd,MEDIA_TYPE_TCPIP,SIGNATURE_MESSAGE_ID,SIGNATURE_HEAP_TYPE,hook,addr,&tail,sizeof(tail.haat));
+            break;
+
+        default:
+            put_be32(tail.hat.size,size);
+            put_be32(tail.hat.caller1,caller1);
+            put_be32(tail.hat.caller2,caller2);
+            gen_trace_item(gen,fd,MEDIA_TYPE_TCPIP,SIGNATURE_MESSAGE_ID,SIGNATURE_HEAP_TYPE,hook,addr,&tail,sizeof(tail.hat));
+            break;
+    }
+
+    gen->heap_items++;
+}
+
+static void gen_heap_dealloc(BLX_GEN_STATE * gen, FILE * fd)
+{
+    STANDARD_MTBF_TRACE_BODY tail;
+
+    uint32 slot = gen_random(gen,gen->live_nums);
+    uint32 addr = gen->live[slot].addr;
+
+    gen->live_bytes -= gen->live[slot].size;
+    gen->live[slot]  = gen->live[--gen->live_nums];
+
+    put_be32(tail.hdt.caller1,gen->callers[gen_random(gen,BLX_CALLER_POOL)]);
+    put_be32(tail.hdt.caller2,gen->callers[gen_random(gen,BLX_CALLER_POOL)]);
+    gen_trace_item(gen,fd,MEDIA_TYPE_TCPIP,SIGNATURE_MESSAGE_ID,SIGNATURE_HEAP_TYPE,SIGNATURE_HEAP_DEALLOC,addr,&tail,sizeof(tail.hdt));
+
+    gen->heap_items++;
+}
+
+/* trace items ma has to walk over: other messages, other trace types and heap hooks it does not replay */
+static void gen_noise_item(BLX_GEN_STATE * gen, FILE * fd)
+{
+    STANDARD_MTBF_TRACE_BODY tail;
+
+    memset(&tail,0x0,sizeof(tail));
+
+    switch (gen_random(gen,3))
+    {
+        case 0:
+            gen_trace_item(gen,fd,MEDIA_TYPE_USB,0x33,SIGNATURE_HEAP_TYPE,SIGNATURE_HEAP_ALLOC,0,&tail,sizeof(tail.hat));
+            break;
+        case 1:
+            gen_trace_item(gen,fd,MEDIA_TYPE_TCPIP,SIGNATURE_MESSAGE_ID,0x02,SIGNATURE_HEAP_ALLOC,0,&tail,sizeof(tail.hat));
+            break;
+        default:
+            gen_trace_item(gen,fd,MEDIA_TYPE_TCPIP,SIGNATURE_MESSAGE_ID,SIGNATURE_HEAP_TYPE,0x55,0,&tail,sizeof(tail.hdt));
+            break;
+    }
+}
+
+static uint8 gen_part(BLX_GEN_STATE * gen, const BLX_GEN_OPTIONS * options, const char * filepath, uint8 first)
+{
+    FILE * fd;
+    uint32 i,k;
+
+    if ((fd = fopen(filepath,"wb")) == NULL) {
+        fprintf(stderr,"gen_part@Open %s failed\n",filepath);
+        return FALSE;
+    }
+
+    gen_random_bytes(gen,fd,BLX_STARTING_POINT);
+
+    if (first) {
+        gen_trace_item(gen,fd,MEDIA_TYPE_USB,SIGNATURE_MESSAGE_ID,SIGNATURE_HEAP_TYPE,SIGNATURE_HEAP_INIT,0,NULL,sizeof(HEAP_DEALLOC_TAIL));
+        gen->heap_items++;
+    }
+
+    for (i = 0; i < options->events; )  {
+
+        k = gen_random(gen,100);
+
+        if (k < options->corrupt_percent) {
+            gen_random_bytes(gen,fd,1 + gen_random(gen,BLX_NOISE_MAX));
+        } else if (k < options->corrupt_percent + options->noise_percent) {
+            gen_noise_item(gen,fd);
+        } else if (gen->live_nums > 0 && (gen_random(gen,100) < options->free_percent ||
+                                          gen->live_bytes + BLX_BLOCK_MAX > BLX_LIVE_BUDGET)) {
+            /* an alloc that could go over the budget is a dealloc, the free heap of the replay stays positive */
+            gen_heap_dealloc(gen,fd);
+            i++;
+        } else {
+            gen_heap_alloc(gen,fd);
+            i++;
+        }
+    }
+
+    /* the capture was cut in the middle of a trace item */
+    gen->bytes += fwrite("\x1D\x10\x4C",1,3,fd);
+
+    fclose(fd);
+    return TRUE;
+}
+
+static uint8 gen_capture(const BLX_GEN_OPTIONS * options, const char * dir, BLX_GEN_STATE * gen)
+{
+    char   filepath[MAX_PATH_LEN];
+    uint32 i;
+
+    memset(gen,0x0,sizeof(BLX_GEN_STATE));
+    gen->rng       = options->seed * 0x9E3779B97F4A7C15ULL + 1;
+    gen->time      = (0x1ULL << 60) | 1000000000ULL * 3600 * 8;
+    gen->next_addr = 0x01000000;
+
+    gen->adversarial = options->adversarial;
+
+    for (i = 0; i < BLX_CALLER_POOL; i++) {
+        gen->callers[i] = 0x40000000 + (gen_random(gen,0x400000) & ~1);
+        if (gen->adversarial && i % 8 == 0) {
+            gen->callers[i] = (MEDIA_TYPE_TCPIP << 24 | RECEIVER_DEVICE_PC << 16 | SEND_DEVICE_TRACEBOX << 8 | RESOURCE_TRACEBOX) >> (i % 3 * 8);
+        }
+    }
+
+    snprintf(filepath,MAX_PATH_LEN,"%s/cap_a",dir);
+    mkdir(dir,0755);
+    mkdir(filepath,0755);
+
+    for (i = 0; i < options->parts; i++) {
+
+        if (i == 0) {
+            snprintf(filepath,MAX_PATH_LEN,"%s/cap_a/trace.blx",dir);
+        } else {
+            snprintf(filepath,MAX_PATH_LEN,"%s/cap_a/trace_part_%u.blx",dir,i);
+        }
+
+        if (!gen_part(gen,options,filepath,i == 0)) {
+            free(gen->live);
+            return FALSE;
+        }
+    }
+
+    free(gen->live);
+    gen->live = NULL;
+
+    return TRUE;
+}
+
+static int remove_entry(const char * path, const struct stat * stbuf, int flag, struct FTW * ftwbuf)
+{
+    return remove(path);
+}
+
+static double elapsed_seconds(struct timeval * startTime, struct timeval * endTime)
+{
+    return ((endTime->tv_sec * 1000000.0 + endTime->tv_usec) - (startTime->tv_sec * 1000000.0 + startTime->tv_usec)) / 1000000;
+}
+
+/* ma in dir with its output(stdout and stderr) thrown away, returns FALSE if it could not be run */
+static uint8 run_ma(const char * ma, const char * dir, const BLX_STAGE * stage, struct rusage * usage)
+{
+    const char * argv[5];
+    pid_t  pid;
+    int    status,devnull;
+
+    argv[0] = ma;
+    argv[1] = stage->args[0];
+    argv[2] = stage->args[1];
+    argv[3] = stage->args[2];
+    argv[4] = NULL;
+
+    fflush(stdout);
+
+    if ((pid = fork()) == 0) {
+        devnull = open("/dev/null",O_WRONLY);
+        if (chdir(dir) != 0 || devnull == -1) {
+            _exit(127);
+        }
+        dup2(devnull,STDOUT_FILENO);
+        dup2(devnull,STDERR_FILENO);
+        execv(ma,(char * const *)argv);
+        _exit(127);
+    }
+
+    if (pid == -1 || wait4(pid,&status,0,usage) != pid) {
+        fprintf(stderr,"run_ma@Could not run %s %s\n",ma,stage->name);
+        return FALSE;
+    }
+
+    /* ma exits with 1 whatever happened, only a failed exec or a crash is told apart */
+    if ((WIFEXITED(status) && WEXITSTATUS(status) == 127) || WIFSIGNALED(status)) {
+        fprintf(stderr,"run_ma@%s %s failed\n",ma,stage->name);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static uint8 run_stage(const char * ma, const char * dir, const BLX_STAGE * stage, const BLX_GEN_STATE * gen)
+{
+    struct timeval startTime;
+    struct timeval endTime;
+    struct rusage  usage;
+
+    double seconds;
+
+    gettimeofday(&startTime, NULL);
+
+    if (!run_ma(ma,dir,stage,&usage)) {
+        return FALSE;
+    }
+
+    gettimeofday(&endTime, NULL);
+
+    seconds = elapsed_seconds(&startTime,&endTime);
+    fprintf(stdout,"%-10s %9.3f %10.2f %14.0f %10ld\n",
+            stage->name,seconds,gen->bytes / seconds / (1024 * 1024),gen->heap_items / seconds,usage.ru_maxrss);
+
+    return TRUE;
+}
+
+static void remove_tree(const char * dir, const char * sub)
+{
+    char path[MAX_PATH_LEN];
+
+    snprintf(path,MAX_PATH_LEN,"%s/%s",dir,sub);
+    nftw(path,remove_entry,16,FTW_DEPTH | FTW_PHYS);
+}
+
+/* the meta files of the last -b in dir, in meta_file_list order, one after another */
+static uint8 * read_meta_output(const char * dir, uint64 * len)
+{
+    FILE  * fd_list;
+    FILE  * fd_meta;
+    uint8 * out = NULL;
+    uint64  capacity = 0;
+    size_t  nread;
+    char    line[MAX_PATH_LEN];
+    char    path[2 * MAX_PATH_LEN];
+
+    *len = 0;
+
+    snprintf(path,sizeof(path),"%s/%s",dir,META_FILE_LIST);
+    if ((fd_list = fopen(path,"r")) == NULL) {
+        fprintf(stderr,"read_meta_output@Open %s failed\n",path);
+        return NULL;
+    }
+
+    while (fgets(line,MAX_PATH_LEN,fd_list) != NULL) {
+
+        line[strcspn(line,"\r\n")] = '\0';
+        snprintf(path,sizeof(path),"%s/%s",dir,line);
+
+        if ((fd_meta = fopen(path,"rb")) == NULL) {
+            fprintf(stderr,"read_meta_output@Open %s failed\n",path);
+            free(out);
+            fclose(fd_list);
+            return NULL;
+        }
+
+        do {
+            if (*len + 65536 > capacity) {
+                capacity = capacity * 2 + 65536;
+                out = realloc(out,capacity);
+                if (out == NULL) {
+                    fprintf(stderr,"read_meta_output@Out of memory\n");
+                    exit(EXIT_FAILURE);
+                }
+            }
+            nread = fread(out + *len,1,65536,fd_meta);
+            *len += nread;
+        } while (nread > 0);
+
+        fclose(fd_meta);
+    }
+
+    fclose(fd_list);
+    return out == NULL ? malloc(1) : out;
+}
+
+/* ma -b with one chunk per blx file, then with small chunks, the meta files must not change */
+static uint8 verify_chunks(const char * ma, const char * dir, const char * name)
+{
+    const char * chunk_sizes[] = {BLX_WHOLE_FILE, "256", "997", "4096", "65536"};
+    const BLX_STAGE build = {"-b", {"-b",NULL,NULL}};
+
+    struct rusage usage;
+
+    uint8 * whole = NULL;
+    uint8 * chunked;
+    uint64  whole_len = 0,chunked_len;
+    uint8   same = TRUE;
+    uint32  i;
+
+    for (i = 0; i < sizeof(chunk_sizes)/sizeof(chunk_sizes[0]) && same; i++) {
+
+        /* from scratch, otherwise the decode cache would reuse the meta files */
+        remove_tree(dir,"meta_tmp");
+        setenv(BLX_CHUNK_SIZE_ENV,chunk_sizes[i],1);
+
+        if (!run_ma(ma,dir,&build,&usage) || (chunked = read_meta_output(dir,&chunked_len)) == NULL) {
+            same = FALSE;
+            break;
+        }
+
+        if (i == 0) {
+            whole     = chunked;
+            whole_len = chunked_len;
+            continue;
+        }
+
+        same = (chunked_len == whole_len && memcmp(chunked,whole,whole_len) == 0);
+        fprintf(stdout,"%-12s chunks of %8s bytes: %s\n",name,chunk_sizes[i],same ? "ok" : "DIFFERENT META FILES");
+        free(chunked);
+    }
+
+    unsetenv(BLX_CHUNK_SIZE_ENV);
+    free(whole);
+
+    return same;
+}
+
+static void show_usage(void)
+{
+    fprintf(stdout,"usage: bench_blx [-n|-v] [-a] [-p parts] [-e events] [-f free%%] [-x noise%%] [-c corrupt%%] [-s seed] [-m ma] <dir>\n");
+}
+
+int main(int argc, char * argv[])
+{
+    const BLX_STAGE stages[] = {
+        {"-b",       {"-b",NULL,NULL}},
+        {"-g",       {"-g",NULL,NULL}},
+        {"-s 100",   {"-s","100",NULL}},
+        {"-t 1",     {"-t","1",NULL}},
+        {"-r",       {"-r",NULL,NULL}},
+    };
+
+    BLX_GEN_OPTIONS options = {4, 200000, 45, 6, 4, 1, FALSE};
+    BLX_GEN_STATE   gen;
+
+    const char * ma  = "./ma";
+    const char * dir = NULL;
+    char   ma_path[MAX_PATH_LEN];
+    uint8  gen_only = FALSE;
+    uint8  verify   = FALSE;
+    uint32 i;
+
+    for (i = 1; i < (uint32)argc; i++) {
+
+        if (strcmp(argv[i],"-n") == 0) {
+            gen_only = TRUE;
+        } else if (strcmp(argv[i],"-v") == 0) {
+            verify = TRUE;
+        } else if (strcmp(argv[i],"-a") == 0) {
+            options.adversarial = TRUE;
+        } else if (argv[i][0] == '-' && argv[i][1] != '\0' && argv[i][2] == '\0' && i + 1 < (uint32)argc) {
+            switch (argv[i][1])
+            {
+                case 'p': options.parts           = strtoul(argv[++i],NULL,10); break;
+                case 'e': options.events          = strtoul(argv[++i],NULL,10); break;
+                case 'f': options.free_percent    = strtoul(argv[++i],NULL,10); break;
+                case 'x': options.noise_percent   = strtoul(argv[++i],NULL,10); break;
+                case 'c': options.corrupt_percent = strtoul(argv[++i],NULL,10); break;
+                case 's': options.seed            = strtoull(argv[++i],NULL,10); break;
+                case 'm': ma                      = argv[++i]; break;
+                default:
+                    show_usage();
+                    return EXIT_FAILURE;
+            }
+        } else if (dir == NULL && argv[i][0] != '-') {
+            dir = argv[i];
+        } else {
+            show_usage();
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (dir == NULL || options.parts == 0 || options.free_percent > 100 ||
+        options.noise_percent + options.corrupt_percent >= 100) {
+        show_usage();
+        return EXIT_FAILURE;
+    }
+
+    /* ma runs from dir, -n alone does not run it */
+    if ((!gen_only || verify) && realpath(ma,ma_path) == NULL) {
+        fprintf(stderr,"Could not find %s\n",ma);
+        return EXIT_FAILURE;
+    }
+
+    remove_tree(dir,"cap_a");
+
+    if (verify) {
+        options.adversarial = FALSE;
+        if (!gen_capture(&options,dir,&gen) || !verify_chunks(ma_path,dir,"synthetic")) {
+            return EXIT_FAILURE;
+        }
+
+        remove_tree(dir,"cap_a");
+
+        options.adversarial = TRUE;
+        if (!gen_capture(&options,dir,&gen) || !verify_chunks(ma_path,dir,"adversarial")) {
+            return EXIT_FAILURE;
+        }
+
+        return EXIT_SUCCESS;
+    }
+
+    if (!gen_capture(&options,dir,&gen)) {
+        return EXIT_FAILURE;
+    }
+
+    fprintf(stdout,"capture: %u parts, %.2f MB, %llu heap trace items\n",
+            options.parts,gen.bytes / (1024.0 * 1024),gen.heap_items);
+
+    if (gen_only) {
+        return EXIT_SUCCESS;
+    }
+
+    /* -b starts from scratch, otherwise the decode cache would skip all the work */
+    remove_tree(dir,"meta_tmp");
+
+    fprintf(stdout,"%-10s %9s %10s %14s %10s\n","stage","seconds","MB/s","events/s","peak KB");
+
+    for (i = 0; i < sizeof(stages)/sizeof(stages[0]); i++) {
+        if (!run_stage(ma_path,dir,&stages[i],&gen)) {
+            return EXIT_FAILURE;
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
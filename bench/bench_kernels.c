@@ -0,0 +1,313 @@
+/*
+ * bench_kernels: the ma_lib functions that run once per trace item or record, one at a time
+ *
+ *     bench_kernels                       every kernel, 5 warmup and 51 timed repetitions
+ *     bench_kernels [-w n] [-r n] [name]  n warmup/timed repetitions, only the kernels whose name starts with name
+ *
+ * Every kernel walks the same fixed inputs(seeded, BENCH_INPUTS of them) BENCH_PASSES times per repetition.
+ * A repetition gives one ns/op figure, the repetitions are sorted and min/p50/p90/p99/max of them are printed,
+ * so one slow repetition(page faults, another process) shows up in the tail instead of moving the median.
+ *
+ * How to build it?
+ *     make bench_kernels
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ma.h"
+
+/* ma_lib.c refers to these, main.c owns them in ma */
+TRACE_DATE           g_trace_date;
+HEAP_LIVE_TABLE      g_heap_table;
+
+#define BENCH_INPUTS       4096
+#define BENCH_PASSES       256
+#define BENCH_LIVE_BLOCKS  100000
+#define BENCH_WARMUP       5
+#define BENCH_REPETITIONS  51
+
+typedef struct BENCH_INPUT {
+    uint8  stream[BENCH_INPUTS * 8 + 3];    /* trace bytes, loads start at unaligned offsets */
+    char   hex[BENCH_INPUTS][9];            /* "4037f872" like addresses in -d output */
+    char   length[BENCH_INPUTS][3];         /* "38" like trace item lengths */
+    char   paths[BENCH_INPUTS][64];         /* blx file paths */
+    uint32 live[BENCH_LIVE_BLOCKS];         /* addresses of the live blocks */
+    uint32 next_addr;
+    uint32 seed;
+} BENCH_INPUT;
+
+typedef struct BENCH_KERNEL {
+    const char * name;
+    uint64     (*run)(BENCH_INPUT * input);   /* one pass over the inputs, returns a checksum */
+} BENCH_KERNEL;
+
+static uint32 xorshift32(uint32 * state)
+{
+    uint32 x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+
+    return *state = x;
+}
+
+static uint64 kernel_decode_timestamp(BENCH_INPUT * input)
+{
+    uint64 checksum = 0;
+    uint32 i;
+
+    for (i = 0; i < BENCH_INPUTS; i++) {
+        checksum += decode_timestamp_ns(&input->stream[i * 8 + 1]);
+    }
+
+    return checksum;
+}
+
+/* the text a csv line gets, decode and format in one like decode_timestamp does */
+static uint64 kernel_format_timestamp(BENCH_INPUT * input)
+{
+    char   timestring[32];
+    uint64 checksum = 0;
+    uint32 i;
+
+    for (i = 0; i < BENCH_INPUTS; i++) {
+        checksum += decode_timestamp(&input->stream[i * 8 + 1],timestring);
+        checksum += timestring[10];
+    }
+
+    return checksum;
+}
+
+static uint64 kernel_char_2_hex(BENCH_INPUT * input)
+{
+    uint64 checksum = 0;
+    uint32 i,k,addr;
+
+    for (i = 0; i < BENCH_INPUTS; i++) {
+        addr = 0;
+        for (k = 0; k < 8; k++) {
+            addr = addr << 4 | char_2_hex(input->hex[i][k]);
+        }
+        checksum += addr;
+    }
+
+    return checksum;
+}
+
+static uint64 kernel_strtouint32(BENCH_INPUT * input)
+{
+    uint64 checksum = 0;
+    uint32 i;
+
+    for (i = 0; i < BENCH_INPUTS; i++) {
+        checksum += strtouint32(input->length[i]);
+    }
+
+    return checksum;
+}
+
+static uint64 kernel_get_size(BENCH_INPUT * input)
+{
+    uint64 checksum = 0;
+    uint8 * p;
+    uint32 i;
+
+    for (i = 0; i < BENCH_INPUTS; i++) {
+        p = &input->stream[i * 8 + 3];
+        checksum += (uint32)GET_SIZE(p) ^ (uint32)GET_PTR((p + 4));
+    }
+
+    return checksum;
+}
+
+/* a dealloc of a random live block and an alloc at a new address, so the working set stays the same */
+static uint64 kernel_live_table(BENCH_INPUT * input)
+{
+    uint64 checksum = 0;
+    uint32 i,slot,size;
+
+    for (i = 0; i < BENCH_INPUTS; i++) {
+        slot = xorshift32(&input->seed) % BENCH_LIVE_BLOCKS;
+
+        if (halloc_info_table_remove(&g_heap_table,input->live[slot],&size)) {
+            checksum += size;
+        }
+
+        input->live[slot] = input->next_addr;
+        input->next_addr += 8 + (xorshift32(&input->seed) & 0x78);
+        halloc_info_table_add(&g_heap_table,input->live[slot],i & 0xFFF);
+    }
+
+    return checksum;
+}
+
+static uint64 kernel_file_index(BENCH_INPUT * input)
+{
+    uint64 checksum = 0;
+    uint32 i;
+
+    for (i = 0; i < BENCH_INPUTS; i++) {
+        checksum += get_file_index_from_path(input->paths[i]);
+    }
+
+    return checksum;
+}
+
+static uint64 kernel_file_pattern(BENCH_INPUT * input)
+{
+    char   pattern[MAX_PATH_LEN];
+    uint64 checksum = 0;
+    uint32 i;
+
+    for (i = 0; i < BENCH_INPUTS; i++) {
+        checksum += get_file_pattern(input->paths[i],pattern);
+        checksum += pattern[0];
+    }
+
+    return checksum;
+}
+
+static void bench_input_init(BENCH_INPUT * input)
+{
+    uint32 seed = 0x12345678;
+    uint32 i,k;
+    uint64 time = 0x1000000000000000ULL;
+
+    /* trace timestamps a few ms apart, some with the overrun bits of old captures */
+    for (i = 0; i < BENCH_INPUTS; i++) {
+        time += xorshift32(&seed) % 300000000;
+        for (k = 0; k < 8; k++) {
+            input->stream[i * 8 + 1 + k] = (time | (i % 7 == 0 ? 0x2000000000000000ULL : 0)) >> (56 - k * 8);
+        }
+    }
+
+    for (i = 0; i < BENCH_INPUTS; i++) {
+        sprintf(input->hex[i],"%08x",0x40000000 + (xorshift32(&seed) & 0x3FFFFE));
+        sprintf(input->length[i],"%02u",22 + (xorshift32(&seed) % 5) * 4);
+
+        if (i % 16 == 0) {
+            sprintf(input->paths[i],"./traces/cap_%c/trace.blx",'a' + i % 26);
+        } else {
+            sprintf(input->paths[i],"./traces/cap_%c/trace_part_%u.blx",'a' + i % 26,i);
+        }
+    }
+
+    input->seed      = 0x9E3779B9;
+    input->next_addr = 0x01000000;
+
+    for (i = 0; i < BENCH_LIVE_BLOCKS; i++) {
+        input->live[i] = input->next_addr;
+        input->next_addr += 8 + (xorshift32(&seed) & 0x78);
+        halloc_info_table_add(&g_heap_table,input->live[i],xorshift32(&seed) & 0xFFF);
+    }
+}
+
+static int compare_double(const void * a, const void * b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+static double repetition(const BENCH_KERNEL * kernel, BENCH_INPUT * input, uint64 * checksum)
+{
+    struct timespec startTime;
+    struct timespec endTime;
+    uint32 pass;
+
+    clock_gettime(CLOCK_MONOTONIC,&startTime);
+
+    for (pass = 0; pass < BENCH_PASSES; pass++) {
+        *checksum += kernel->run(input);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC,&endTime);
+
+    return ((endTime.tv_sec - startTime.tv_sec) * 1e9 + (endTime.tv_nsec - startTime.tv_nsec)) / ((double)BENCH_PASSES * BENCH_INPUTS);
+}
+
+static void bench(const BENCH_KERNEL * kernel, BENCH_INPUT * input, uint32 warmup, uint32 repetitions, double * ns)
+{
+    uint64 checksum = 0;
+    uint32 i;
+
+    for (i = 0; i < warmup; i++) {
+        repetition(kernel,input,&checksum);
+    }
+
+    for (i = 0; i < repetitions; i++) {
+        ns[i] = repetition(kernel,input,&checksum);
+    }
+
+    qsort(ns,repetitions,sizeof(double),compare_double);
+
+    fprintf(stdout,"%-18s %8.2f %8.2f %8.2f %8.2f %8.2f   %016llx\n",kernel->name,ns[0],
+            ns[repetitions / 2],ns[(repetitions - 1) * 90 / 100],ns[(repetitions - 1) * 99 / 100],ns[repetitions - 1],checksum);
+}
+
+int main(int argc, char * argv[])
+{
+    const BENCH_KERNEL kernels[] = {
+        {"decode_timestamp", kernel_decode_timestamp},
+        {"format_timestamp", kernel_format_timestamp},
+        {"char_2_hex",       kernel_char_2_hex},
+        {"strtouint32",      kernel_strtouint32},
+        {"get_size",         kernel_get_size},
+        {"live_table",       kernel_live_table},
+        {"file_index",       kernel_file_index},
+        {"file_pattern",     kernel_file_pattern},
+    };
+
+    BENCH_INPUT * input;
+    double      * ns;
+    const char  * only = NULL;
+    uint32 warmup      = BENCH_WARMUP;
+    uint32 repetitions = BENCH_REPETITIONS;
+    uint32 i;
+
+    for (i = 1; i < (uint32)argc; i++) {
+        if (strcmp(argv[i],"-w") == 0 && i + 1 < (uint32)argc) {
+            warmup = strtoul(argv[++i],NULL,10);
+        } else if (strcmp(argv[i],"-r") == 0 && i + 1 < (uint32)argc) {
+            repetitions = strtoul(argv[++i],NULL,10);
+        } else if (argv[i][0] != '-' && only == NULL) {
+            only = argv[i];
+        } else {
+            repetitions = 0;
+            break;
+        }
+    }
+
+    if (repetitions == 0) {
+        fprintf(stdout,"usage: bench_kernels [-w warmup] [-r repetitions] [kernel]\n");
+        return EXIT_FAILURE;
+    }
+
+    input = malloc(sizeof(BENCH_INPUT));
+    ns    = malloc((repetitions + 1) * sizeof(double));
+    if (input == NULL || ns == NULL) {
+        fprintf(stderr,"Out of memory\n");
+        return EXIT_FAILURE;
+    }
+
+    bench_input_init(input);
+
+    fprintf(stdout,"%-18s %8s %8s %8s %8s %8s   (ns/op over %u repetitions)\n","kernel","min","p50","p90","p99","max",repetitions);
+
+    for (i = 0; i < sizeof(kernels)/sizeof(kernels[0]); i++) {
+        if (only == NULL || strncmp(kernels[i].name,only,strlen(only)) == 0) {
+            bench(&kernels[i],input,warmup,repetitions,ns);
+        }
+    }
+
+    halloc_info_table_free(&g_heap_table);
+    free(input);
+    free(ns);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,89 @@
+/*
+ * bench_live_table: replay throughput of the heap allocation info table(see HEAP_LIVE_TABLE)
+ *
+ * For each working set size the table is filled with that many live blocks, and then a
+ * steady stream of dealloc/alloc pairs is replayed so the number of live blocks stays the same.
+ *
+ * How to build it?
+ *     make bench_live_table
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#include "ma.h"
+
+/* ma_lib.c refers to these, main.c owns them in ma */
+TRACE_DATE           g_trace_date;
+HEAP_LIVE_TABLE      g_heap_table;
+
+#define REPLAY_EVENTS 10000000
+
+static uint32 xorshift32(uint32 * state)
+{
+    uint32 x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+
+    return *state = x;
+}
+
+static double replay(uint32 live_blocks)
+{
+    struct timeval startTime;
+    struct timeval endTime;
+
+    uint32 * live = malloc(live_blocks * sizeof(uint32));
+    uint32 seed = 0x12345678;
+    uint32 next_addr = 0x01000000;
+    uint32 i,slot;
+    uint64 checksum = 0;
+
+    /* heap blocks are 8 bytes aligned and mostly packed in a few regions */
+    for (i = 0; i < live_blocks; i++) {
+        live[i] = next_addr;
+        next_addr += 8 + (xorshift32(&seed) & 0x78);
+        halloc_info_table_add(&g_heap_table,live[i],xorshift32(&seed) & 0xFFF);
+    }
+
+    gettimeofday(&startTime, NULL);
+
+    for (i = 0; i < REPLAY_EVENTS; i += 2) {
+        slot = xorshift32(&seed) % live_blocks;
+        checksum += halloc_info_table_get_size(&g_heap_table,live[slot]);
+
+        live[slot] = next_addr;
+        next_addr += 8 + (xorshift32(&seed) & 0x78);
+        halloc_info_table_add(&g_heap_table,live[slot],xorshift32(&seed) & 0xFFF);
+    }
+
+    gettimeofday(&endTime, NULL);
+
+    if (g_heap_table.live_blocks != live_blocks || checksum == 0) {
+        fprintf(stderr,"bench_live_table@table is out of sync\n");
+    }
+
+    halloc_info_table_free(&g_heap_table);
+    free(live);
+
+    return ((endTime.tv_sec*1000000.0 + endTime.tv_usec) - (startTime.tv_sec*1000000.0 + startTime.tv_usec)) / 1000000;
+}
+
+int main(void)
+{
+    const uint32 sizes[] = {10000, 100000, 1000000};
+    double seconds;
+    uint32 i;
+
+    fprintf(stdout,"%12s %14s\n","live blocks","events/sec");
+
+    for (i = 0; i < sizeof(sizes)/sizeof(sizes[0]); i++) {
+        seconds = replay(sizes[i]);
+        fprintf(stdout,"%12u %14.0f\n",sizes[i],REPLAY_EVENTS / seconds);
+    }
+
+    return 0;
+}
@@ -0,0 +1,233 @@
+/*
+ * bench_scan: scan_trace_header flavours(scalar, SSE2, AVX2) against each other
+ *
+ *     bench_scan       time every flavour this cpu runs on the same random bytes
+ *     bench_scan -v    randomized check of every flavour against a plain byte loop
+ *
+ * -v builds buffers that end right at an unreadable page, so a flavour reading past size crashes instead
+ * of passing. The bytes are mostly header signature bytes, with whole headers planted at random offsets
+ * and at the last offset a header fits at, partial ones in the tail. Every buffer is scanned from all the
+ * start offsets up to 70 bytes in(unaligned starts, starts past the last header offset) and
+ * walked hit by hit to the end.
+ *
+ * How to build it?
+ *     make bench_scan
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+
+#include "ma.h"
+
+/* ma_lib.c refers to these, main.c owns them in ma */
+TRACE_DATE           g_trace_date;
+HEAP_LIVE_TABLE      g_heap_table;
+
+#define BENCH_SCAN_BYTES   (64*1024*1024)
+#define BENCH_SCAN_ROUNDS  8
+#define VERIFY_TRIALS      20000
+#define VERIFY_MAX_SIZE    4096
+#define VERIFY_STARTS      70
+
+static const char * g_flavour_names[SCAN_FLAVOUR_NUMS] = {"scalar","sse2","avx2"};
+
+static uint32 xorshift32(uint32 * state)
+{
+    uint32 x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+
+    return *state = x;
+}
+
+/* scan_trace_header as a plain byte loop */
+static uint64 reference_scan(const uint8 * buf, uint64 pos, uint64 size)
+{
+    for (; pos + sizeof(STANDARD_MTBF_TRACE_HEADER) <= size; pos++) {
+        if ((buf[pos] == MEDIA_TYPE_TCPIP || buf[pos] == MEDIA_TYPE_USB) && buf[pos + 1] == RECEIVER_DEVICE_PC &&
+            buf[pos + 2] == SEND_DEVICE_TRACEBOX && buf[pos + 3] == RESOURCE_TRACEBOX) {
+            return pos;
+        }
+    }
+
+    return size;
+}
+
+static void plant_header(uint8 * p, uint32 len, uint32 * seed)
+{
+    const uint8 header[4] = {0, RECEIVER_DEVICE_PC, SEND_DEVICE_TRACEBOX, RESOURCE_TRACEBOX};
+
+    memcpy(p,header,len);
+    p[0] = (xorshift32(seed) & 1) ? MEDIA_TYPE_TCPIP : MEDIA_TYPE_USB;
+}
+
+static uint8 verify_buffer(const uint8 * buf, uint64 size, uint32 flavour, uint64 * checks)
+{
+    uint64 pos,got,want;
+
+    for (pos = 0; pos <= size + 2 && pos < VERIFY_STARTS; pos++) {
+
+        got  = scan_trace_header(buf,pos,size);
+        want = reference_scan(buf,pos,size);
+        (*checks)++;
+
+        if (got != want) {
+            printf("%s: size %llu, start %llu: found %llu, expected %llu\n",g_flavour_names[flavour],size,pos,got,want);
+            return FALSE;
+        }
+    }
+
+    /* hit by hit, like the decoder resyncing */
+    for (pos = 0; pos < size; pos = want + 1) {
+
+        got  = scan_trace_header(buf,pos,size);
+        want = reference_scan(buf,pos,size);
+        (*checks)++;
+
+        if (got != want) {
+            printf("%s: size %llu, start %llu: found %llu, expected %llu\n",g_flavour_names[flavour],size,pos,got,want);
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+static int verify(void)
+{
+    const uint8 alphabet[] = {MEDIA_TYPE_TCPIP, MEDIA_TYPE_USB, RECEIVER_DEVICE_PC, SEND_DEVICE_TRACEBOX, RESOURCE_TRACEBOX};
+
+    uint32 page = sysconf(_SC_PAGESIZE);
+    uint32 area = (VERIFY_MAX_SIZE + page - 1) / page * page;
+    uint32 seed = 0x2545F491;
+    uint32 trial,flavour,i,plants;
+    uint64 size,checks = 0;
+    uint8  failed = FALSE;
+    uint8 * mapped;
+    uint8 * buf;
+
+    /* the buffer ends where the guard page starts */
+    mapped = mmap(NULL,area + page,PROT_READ | PROT_WRITE,MAP_PRIVATE | MAP_ANONYMOUS,-1,0);
+    if (mapped == MAP_FAILED || mprotect(mapped + area,page,PROT_NONE) != 0) {
+        fprintf(stderr,"verify@mmap failed\n");
+        return EXIT_FAILURE;
+    }
+
+    for (flavour = 0; flavour < SCAN_FLAVOUR_NUMS; flavour++) {
+
+        if (!scan_trace_header_force(flavour)) {
+            printf("%-8s not supported by this cpu, skipped\n",g_flavour_names[flavour]);
+            continue;
+        }
+
+        checks = 0;
+
+        for (trial = 0; trial < VERIFY_TRIALS && !failed; trial++) {
+
+            size = (trial % 4 == 0) ? xorshift32(&seed) % (VERIFY_MAX_SIZE + 1) : xorshift32(&seed) % 300;
+            buf  = mapped + area - size;
+
+            for (i = 0; i < size; i++) {
+                buf[i] = (xorshift32(&seed) % 4 != 0) ? alphabet[xorshift32(&seed) % sizeof(alphabet)] : xorshift32(&seed);
+            }
+
+            plants = size >= 4 ? xorshift32(&seed) % 4 : 0;
+            for (i = 0; i < plants; i++) {
+                plant_header(buf + xorshift32(&seed) % (size - 3),4,&seed);
+            }
+
+            /* a header at the last offset it fits at, or one cut by the end of the buffer */
+            switch (size >= 4 ? xorshift32(&seed) % 3 : 2)
+            {
+                case 0:
+                    plant_header(buf + size - 4,4,&seed);
+                    break;
+                case 1:
+                    i = 1 + xorshift32(&seed) % 3;
+                    plant_header(buf + size - i,i,&seed);
+                    break;
+                default:
+                    break;
+            }
+
+            failed = !verify_buffer(buf,size,flavour,&checks);
+        }
+
+        printf("%-8s %llu scans %s\n",g_flavour_names[flavour],checks,failed ? "FAILED" : "ok");
+
+        if (failed) {
+            break;
+        }
+    }
+
+    munmap(mapped,area + page);
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+static void bench(const uint8 * buf, uint32 flavour)
+{
+    struct timeval startTime;
+    struct timeval endTime;
+
+    uint64 pos,hits = 0;
+    uint32 round;
+    double seconds;
+
+    if (!scan_trace_header_force(flavour)) {
+        printf("%-8s not supported by this cpu\n",g_flavour_names[flavour]);
+        return;
+    }
+
+    gettimeofday(&startTime, NULL);
+
+    for (round = 0; round < BENCH_SCAN_ROUNDS; round++) {
+        for (pos = scan_trace_header(buf,0,BENCH_SCAN_BYTES); pos < BENCH_SCAN_BYTES; pos = scan_trace_header(buf,pos + 1,BENCH_SCAN_BYTES)) {
+            hits++;
+        }
+    }
+
+    gettimeofday(&endTime, NULL);
+
+    seconds = ((endTime.tv_sec * 1000000.0 + endTime.tv_usec) - (startTime.tv_sec * 1000000.0 + startTime.tv_usec)) / 1000000;
+    printf("%-8s %10.1f MB/s (%llu headers)\n",g_flavour_names[flavour],
+           (double)BENCH_SCAN_BYTES * BENCH_SCAN_ROUNDS / seconds / (1024 * 1024),hits / BENCH_SCAN_ROUNDS);
+}
+
+int main(int argc, char * argv[])
+{
+    uint8 * buf;
+    uint32  seed = 0x12345678;
+    uint32  i,flavour;
+
+    if (argc > 1 && strcmp(argv[1],"-v") == 0) {
+        return verify();
+    }
+
+    buf = malloc(BENCH_SCAN_BYTES);
+    if (buf == NULL) {
+        fprintf(stderr,"Out of memory\n");
+        return EXIT_FAILURE;
+    }
+
+    /* corrupt stretches of a capture: random bytes, a header every 64KB or so */
+    for (i = 0; i < BENCH_SCAN_BYTES; i++) {
+        buf[i] = xorshift32(&seed);
+    }
+    for (i = 0; i + 4 <= BENCH_SCAN_BYTES; i += 32768 + xorshift32(&seed) % 65536) {
+        plant_header(buf + i,4,&seed);
+    }
+
+    for (flavour = 0; flavour < SCAN_FLAVOUR_NUMS; flavour++) {
+        bench(buf,flavour);
+    }
+
+    free(buf);
+
+    return EXIT_SUCCESS;
+}
@@ -14,6 +14,7 @@
 #include <libgen.h>
 
 #include "types.h"
+#include "thread_pool.h"
 
 /************************************************************************** 
    for decode blx...use to identify MTBF blx format
@@ -38,18 +39,37 @@
 #define DEFAULT_TOTAL_FREE_HEAP (6.9*1024*1024)   /* default is 6M free heap */
 #define BLX_STARTING_POINT 0xbb4                  /* this offset is based on my observation */
 
-#define TEMPLATE_FILE_LIST         "./meta_tmp/tmp_blx_file_list"
 #define META_FILE_LIST             "./meta_tmp/meta_file_list"
 #define TRACE_START_DATE           "./meta_tmp/file_date"
 #define DEFAULT_META_FILE          "./meta_tmp/meta.csv"
+#define DEFAULT_META_INDEX_FILE    "./meta_tmp/meta.csv.idx"
+#define DEFAULT_CHECKPOINT_FILE    "./meta_tmp/meta.csv.ckpt"
+#define TEMP_CHECKPOINT_FILE       "./meta_tmp/meta.csv.ckpt.tmp"
 #define REMOVE_DEFAULT_META_FILE   "rm -rf ./meta_tmp/meta.csv"
 #define REMOVE_DEFAULT_META_FOLDER "rm -rf ./meta_tmp"
 #define CREATE_DEFAULT_META_FOLDER "mkdir ./meta_tmp"
 #define DEFAULT_CSV_FILE_PREFIX    "csv_samplerate_"
 #define DEFAULT_META_FILE_SUFFRIX  ".meta"
 #define DEFAULT_META_FOLDER_PREFIX "./meta_tmp/"
+#define DEFAULT_DECODE_CACHE_FILE  "./meta_tmp/decode_cache"
+#define DECODE_CACHE_MAGIC         0x48434444  /* "DDCH" */
+#define DECODE_CACHE_VERSION       1
+#define DECODE_CACHE_TAIL_BYTES    4096        /* the tail of a blx file is hashed, a rewritten one shows up there */
+#define DECODE_CACHE_REUSE_SUFFIX  ".reuse"    /* a meta file being moved to the name of its new file index */
 
 /** meta file format
+    .meta files are binary: one META_FILE_HEADER followed by blocks of up to META_RECORDS_PER_READ records.
+    A block is a META_BLOCK_HEADER, its caller pairs(caller1,caller2 as two uint32) and the encoded records.
+    A record is:
+        tag             type(0 init,1 allocation,2 deallocation,3 the raw type byte follows)
+                        | allocation type << 2(63 means the raw allocation type byte follows)
+        timestamp       zigzag varint, change from the record before, the first one from min_time
+        address         zigzag varint, change from the record before, the first one from 0
+        size            varint
+        caller pair     varint, which pair of the block
+    Varints are LEB128, 7 bits a byte with the low bits first.
+    'ma -d <meta file>' dumps the records in the text layout:
+
     -----------------------------------------------------------------------------------
     Timestamp | Operation Type | Address | Size | Allocation Type | Caller1 | Caller2 |
     -----------------------------------------------------------------------------------
@@ -63,6 +83,24 @@
  */
 #define META_DATA_FORMAT "%-19.19s %c %8x%8d%2d %8x %8x\n"  /* use for sprintf */
 
+#define META_FILE_MAGIC          0x4154454D  /* "META" */
+#define META_FILE_VERSION        2
+#define META_RECORDS_PER_READ    4096        /* also the records of a meta file block */
+#define META_RECORD_MAX_BYTES    25          /* an encoded record: tag,type,allocation type,10+5+5+2 varint bytes */
+#define OUTPUT_BUFFER_SIZE      (4*1024*1024)  /* per thread, flushed with one write() */
+
+#define META_INDEX_MAGIC         0x5844494D  /* "MIDX" */
+#define META_INDEX_VERSION       2
+#define REPLAY_CHECKPOINT_MAGIC  0x54504B43  /* "CKPT" */
+#define REPLAY_CHECKPOINT_VERSION 2           /* also the HEAP_LIVE_TABLE_HEADER layout */
+#define META_INDEX_INTERVAL      1024        /* csv lines per index entry at most */
+
+#define HEAP_REPORT_INTERVAL_MINUTES 60      /* -r counts allocations and deallocations by the hour */
+
+#define DEFAULT_SIZE_CLASS_FILE  "./meta_tmp/size_class.csv"
+#define SIZE_CLASS_NUMS          32          /* class k holds the sizes from 2^k to 2^(k+1)-1, 0 is in class 0 */
+#define SIZE_CLASS(size)         (31 - __builtin_clz((size) | 1))
+
 #define TRUE   1
 #define FALSE  0
 
@@ -79,6 +117,7 @@
 
 #define SECONDS_FOR_ONE_DAY (60 * 60 * 24)
 #define TIME_UNIT 1000000000LL
+#define TIMESTAMP_TEXT_LEN 18   /* HH:MM:SS.000000000 */
 #define INVALID_HOUR 0xFF
 #define IS_A_NUMBER(x) ((x)>='0' && (x)<='9')
 
@@ -92,11 +131,29 @@
 #define MAX_THEORY_HEAP_SIZE     0xFFFFFFFF
 
 #define MAX_NUM_THREADS          7  /* must lower than MAXT_IN_POOL */
+#define FOLLOW_POLL_SECONDS      1           /* -f: how often the part being followed is checked for new bytes */
+#define FOLLOW_RESCAN_POLLS      5           /* -f: idle polls before the directories are walked for a new part */
+#define REPLAY_WINDOW            (MAX_NUM_THREADS * 2)  /* meta files kept in memory by the csv replay */
+
+#define REPLAY_STAGE_QUEUED     0
+#define REPLAY_STAGE_LOADED     1  /* records are replayed against the file's own blocks */
+#define REPLAY_STAGE_FORMATTED  2  /* csv lines are ready to be written              */
+
+#ifndef BLX_CHUNK_SIZE
+# define BLX_CHUNK_SIZE          (32*1024*1024)  /* blx files over two chunks are decoded in parallel chunks */
+#endif
+#define BLX_CHUNK_SIZE_ENV      "MA_BLX_CHUNK_SIZE"  /* environment variable overriding BLX_CHUNK_SIZE at runtime */
+#define BLX_CHUNK_SIZE_MIN      256                  /* smaller chunks only multiply the per chunk bookkeeping */
+
+/* scan_trace_header flavours, see scan_trace_header_force */
+#define SCAN_FLAVOUR_SCALAR      0
+#define SCAN_FLAVOUR_SSE2        1
+#define SCAN_FLAVOUR_AVX2        2
+#define SCAN_FLAVOUR_NUMS        3
 
 #define ENABLE_TRACE_GENERAL     FALSE
 #define ENABLE_TRACE_INFO        FALSE
 #define ENABLE_DEBUG_INFO        FALSE
-#define ENABLE_LINKED_LIST_TRACE FALSE
 #define ENABLE_HEAP_TRACE        FALSE
 
 #define TRACE_TYPE_DEFAULT 0
@@ -242,34 +299,449 @@ typedef struct  STANDARD_MTBF_TRACE_HEADER {
     
 }STANDARD_MTBF_TRACE_HEADER;
 
-typedef struct HEAP_LINK_NODE {
+/* live allocation table: open addressing(linear probing) keyed by block address.
+   A block allocated again at an address that is still live(lost dealloc trace) shadows
+   the older one, the older sizes are kept in a pool and come back in LIFO order on dealloc.
+ */
+#define HEAP_TABLE_INIT_BITS 16
+#define HEAP_TABLE_MAX_LOAD(cap) ((cap) / 10 * 7)   /* grow at 70% load */
+
+typedef struct HEAP_LIVE_NODE {
     uint32 addr;
     uint32 size;
+    uint32 shadow;       /* index+1 of the older allocation at the same address in shadow pool, 0 means none */
+    uint32 used   : 1;
+    uint32 caller : 31;  /* see HEAP_CALLER_TABLE, 0 if nobody asked for it */
+} HEAP_LIVE_NODE;
 
-    struct HEAP_LINK_NODE * next;
-} HEAP_LINK_NODE;
-
-/* below data struct are for sort file list
+typedef struct HEAP_SHADOW_NODE {
+    uint32 size;
+    uint32 next;     /* index+1 in shadow pool, 0 means none */
+    uint32 caller;
+} HEAP_SHADOW_NODE;
+
+typedef struct HEAP_LIVE_TABLE {
+    HEAP_LIVE_NODE   * slots;
+    uint32             bits;
+    uint32             used_slots;   /* distinct live addresses     */
+    uint32             live_blocks;  /* live blocks include shadows */
+
+    HEAP_SHADOW_NODE * shadows;
+    uint32             shadow_cap;
+    uint32             shadow_top;   /* never used pool entries start here */
+    uint32             shadow_free;  /* index+1 of first recycled pool entry, 0 means none */
+} HEAP_LIVE_TABLE;
+
+/* halloc_info_table_write: a HEAP_LIVE_TABLE on disk is this header, then the 1 << bits slots unless the table
+   is empty, then the shadow_top entries of the shadow pool
  */
-typedef struct BLX_FILE_IN_ONE_FOLDER {
-    uint16 index;
-    uint8  filepath[MAX_PATH_LEN];
-
-    struct BLX_FILE_IN_ONE_FOLDER * next;
-} BLX_FILE_IN_ONE_FOLDER;
-
-typedef struct BLX_FILE_LIST_NODE {
-    uint8  pathpattern[MAX_PATH_LEN]; /* for identify if two blx files are in same foler */
-    struct BLX_FILE_IN_ONE_FOLDER * first_node;
-    struct BLX_FILE_LIST_NODE     * next_list;
-} BLX_FILE_LIST_NODE;
+typedef struct HEAP_LIVE_TABLE_HEADER {
+    uint32 bits;
+    uint32 used_slots;
+    uint32 live_blocks;
+    uint32 shadow_top;
+    uint32 shadow_free;
+    uint8  empty;        /* no slots allocated yet */
+} HEAP_LIVE_TABLE_HEADER;
+
+/* live bytes and blocks of a caller pair */
+typedef struct HEAP_CALLER {
+    uint32 caller1;
+    uint32 caller2;
+    uint64 live_bytes;
+    uint32 live_blocks;
+    uint32 epoch;        /* the low water the values were last saved for */
+} HEAP_CALLER;
+
+/* a caller's values at the low water, before it changed */
+typedef struct HEAP_CALLER_SAVED {
+    uint32 caller;
+    uint32 live_blocks;
+    uint64 live_bytes;
+} HEAP_CALLER_SAVED;
+
+/* live blocks by caller pair, updated with every allocation and deallocation of the replay.
+   A caller is an index into callers starting from 1, the live table keeps it with the block.
+
+   At a new low water the epoch moves on, the first change of a caller after that saves its values first.
+   The callers at the low water are the callers now with the saved values put back
+ */
+typedef struct HEAP_CALLER_TABLE {
+    HEAP_CALLER       * callers;    /* callers[0] is not used */
+    uint32              nums;
+    uint32              capacity;
+    uint32            * slots;      /* open addressing by caller pair, 0 means empty */
+    uint32              bits;
+    uint32              epoch;
+    HEAP_CALLER_SAVED * saved;
+    uint32              saved_nums;
+    uint32              saved_capacity;
+} HEAP_CALLER_TABLE;
+
+/* -c: the callers of the replay, see opt_handler_c_consume */
+typedef struct HEAP_CALLER_REPLAY {
+    HEAP_CALLER_TABLE table;
+    HEAP_LIVE_TABLE   live;         /* the live blocks with their callers, g_heap_table is the replay's */
+    HEAP_CALLER     * at_callers;   /* snapshot at [minutes], NULL until then */
+    uint32            at_nums;
+    sint32            minutes;      /* -1 for none */
+    uint32            low_water;
+    uint64            low_time;
+    uint64            at_time;
+    uint64            first_time;
+    uint64            time;         /* of the last record */
+    uint8             reported;     /* the heap init is passed */
+} HEAP_CALLER_REPLAY;
+
+/* a blx file found by the directory walk */
+typedef struct BLX_FILE_INFO {
+    char * filepath;
+    uint64 size;
+    time_t mtime;
+} BLX_FILE_INFO;
+
+/* all blx files under the working directory, see metadata_find_blx_files */
+typedef struct BLX_FILE_LIST {
+    BLX_FILE_INFO * files;
+    uint32          nums;
+    uint32          capacity;
+    pthread_mutex_t lock;      /* directories are walked in parallel */
+} BLX_FILE_LIST;
+
+/* -b: which meta files the last run decoded from which blx files. The file is a DECODE_CACHE_HEADER
+   followed by the entries. A blx file with the same path, size, modification time, tail and trace type
+   is not decoded again, its meta file is moved to the name of its new file index
+ */
+typedef struct DECODE_CACHE_HEADER {
+    uint32 magic;        /* DECODE_CACHE_MAGIC            */
+    uint32 version;      /* DECODE_CACHE_VERSION          */
+    uint32 entry_size;   /* sizeof(DECODE_CACHE_ENTRY)    */
+    uint32 entries;
+} DECODE_CACHE_HEADER;
+
+typedef struct DECODE_CACHE_ENTRY {
+    char   filepath[MAX_PATH_LEN];
+    uint64 size;
+    sint64 mtime;
+    uint64 tail_hash;    /* of the last DECODE_CACHE_TAIL_BYTES bytes */
+    uint32 tracetype;
+    uint32 fileindex;    /* the meta file is <basename>.<fileindex>.meta */
+} DECODE_CACHE_ENTRY;
+
+typedef struct DECODE_CACHE {
+    DECODE_CACHE_ENTRY * entries;
+    uint32               nums;
+    uint32               capacity;
+} DECODE_CACHE;
+
+/* sort_filelist: where a file goes */
+typedef struct BLX_FILE_SORT_KEY {
+    uint32 capture;   /* which capture(pattern) in the order they show up */
+    uint32 index;     /* part number in the capture */
+    uint32 order;     /* position in the path sorted list */
+} BLX_FILE_SORT_KEY;
+
+/* a directory of the parallel walk */
+typedef struct BLX_WALK_DIR {
+    BLX_FILE_LIST * list;
+    threadpool      tpool;
+    char            path[MAX_PATH_LEN];
+} BLX_WALK_DIR;
+
+/* what getdents64 returns, glibc does not export it */
+typedef struct LINUX_DIRENT64 {
+    uint64         d_ino;
+    uint64         d_off;
+    unsigned short d_reclen;
+    unsigned char  d_type;
+    char           d_name[];
+} LINUX_DIRENT64;
+
+/* header of a binary .meta file, the blocks follow(see meta file format), all in host byte order.
+   The records are varints, their size is not fixed and META_RECORD is only the decoded form
+ */
+typedef struct META_FILE_HEADER {
+    uint32 magic;        /* META_FILE_MAGIC           */
+    uint32 version;      /* META_FILE_VERSION         */
+    uint32 reserved[2];
+} META_FILE_HEADER;
+
+/* a block of a .meta file, min_time and max_time let a reader skip blocks without decoding them */
+typedef struct META_BLOCK_HEADER {
+    uint32 records;
+    uint32 callers;      /* caller pairs after the header   */
+    uint32 bytes;        /* encoded records after the pairs */
+    uint32 reserved;
+    uint64 min_time;     /* of the records, nanoseconds     */
+    uint64 max_time;
+} META_BLOCK_HEADER;
+
+/* scratch space to decode the blocks of a .meta file */
+typedef struct META_READER {
+    uint8  * payload;
+    uint32   payload_capacity;
+    uint32 * callers;
+    uint32   callers_capacity;
+} META_READER;
+
+typedef struct __attribute__((packed)) META_RECORD {
+    uint64 timestamp;        /* nanoseconds, see decode_timestamp_ns  */
+    uint32 address;
+    uint32 size;             /* for deallocation it is zero           */
+    uint32 caller1;
+    uint32 caller2;
+    uint8  type;             /* TYPE_INIT/TYPE_ALLOCATE/TYPE_DEALLOCATE */
+    uint8  allocation_type;  /* see ALLOCATION_TYPE                   */
+} META_RECORD;
+
+/* sparse index of meta.csv, written next to it as DEFAULT_META_INDEX_FILE by -g/-ng/-bg.
+   The file is a META_INDEX_HEADER followed by the entries, each entry covers up to META_INDEX_INTERVAL
+   lines and never crosses into another meta file. Times are csv times, see csv_time
+ */
+typedef struct META_INDEX_HEADER {
+    uint32 magic;        /* META_INDEX_MAGIC                                    */
+    uint32 version;      /* META_INDEX_VERSION                                  */
+    uint32 entry_size;   /* sizeof(META_INDEX_ENTRY)                            */
+    uint32 interval;     /* META_INDEX_INTERVAL                                 */
+    uint64 csv_size;     /* size of the csv it indexes, a stale index is ignored */
+    uint64 lines;
+    uint64 entries;
+} META_INDEX_HEADER;
+
+typedef struct META_INDEX_ENTRY {
+    uint64 time;           /* csv time of the first line                                  */
+    uint64 min_time;       /* earliest csv time of the lines of the entry                 */
+    uint64 max_time;       /* latest csv time of the lines of the entry, a csv of several captures
+                              goes back in time                                           */
+    uint64 latest_time;    /* latest csv time from the first line of the csv to the last line of
+                              the entry, it never decreases so the entries can be binary searched */
+    uint64 offset;         /* where the first line starts in the csv   */
+    uint64 line;           /* line number of the first line, from 0    */
+    uint32 free_heap;      /* free heap on the first line              */
+    uint32 min_free_heap;  /* lowest free heap of the lines of the entry */
+} META_INDEX_ENTRY;
+
+typedef struct META_INDEX {
+    META_INDEX_ENTRY * entries;
+    uint32             nums;
+    uint32             capacity;
+    uint32             block_lines;  /* lines in the last entry so far */
+    uint64             csv_size;
+    uint64             lines;
+} META_INDEX;
+
+/* a big buffer in front of a file descriptor, each thread has its own(see output_writer_thread) */
+typedef struct OUTPUT_WRITER {
+    int     fd;
+    uint8 * buffer;
+    uint32  size;
+    uint32  used;
+} OUTPUT_WRITER;
+
+/* decoded records of one blx file, either encoded into its .meta file writer a block at a time or kept in memory */
+typedef struct META_RECORD_BUFFER {
+    META_RECORD   * records;
+    uint32          nums;
+    uint32          capacity;
+    OUTPUT_WRITER * writer;   /* NULL means keep all records in memory */
+} META_RECORD_BUFFER;
+
+/* hands the records of one blx file from a decoding thread to the replay(-bg option) */
+typedef struct META_STREAM {
+    META_RECORD_BUFFER buffer;
+    uint8              done;
+    pthread_mutex_t    lock;
+    pthread_cond_t     cond_done;
+} META_STREAM;
+
+/* a trace item header found by a chunk walk */
+typedef struct BLX_TRACE_ITEM {
+    uint64 offset;        /* where the header is                     */
+    uint64 next;          /* where the walk probes next              */
+    uint32 first_record;  /* records the chunk decoded before this one */
+} BLX_TRACE_ITEM;
+
+/* -f: the blx part being followed. Bytes from the next trace item probe on are kept in buffer
+   until the rest of the item is written, so an item cut by a write is decoded once it is complete
+ */
+typedef struct BLX_FOLLOW {
+    char    filepath[MAX_PATH_LEN];
+    int     fd;
+    uint64  base;       /* file offset of buffer[0]                 */
+    uint64  pos;        /* file offset of the next trace item probe */
+    uint8 * buffer;
+    uint64  len;
+    uint64  capacity;
+} BLX_FOLLOW;
+
+/* a byte range of a large blx file, decoded on its own */
+typedef struct BLX_CHUNK {
+    struct THREAD_PARAMETER * parent;
+    uint64                    begin;
+    uint64                    end;
+    uint64                    final;      /* where the walk stopped, at or after end */
+    META_RECORD_BUFFER        records;
+    BLX_TRACE_ITEM          * items;
+    uint32                    item_nums;
+    uint32                    item_capacity;
+} BLX_CHUNK;
 
 typedef struct THREAD_PARAMETER {
-    uint32    tracetype;               /* TODO:the trace get from difference source need to be decoded with difference way */
-    uint32    fileindex;               /* use to make all blx files name unique     */   
-    char      filepath[MAX_PATH_LEN];  /* which blx file the thread needs to decode */ 
+    uint32          tracetype;               /* TODO:the trace get from difference source need to be decoded with difference way */
+    uint32          fileindex;               /* use to make all blx files name unique     */   
+    char            filepath[MAX_PATH_LEN];  /* which blx file the thread needs to decode */ 
+    META_STREAM   * stream;                  /* NULL means write a .meta file             */
+
+    threadpool      tpool;                   /* where the chunks of the file are dispatched to */
+    uint64          blx_size;
+    BLX_CHUNK     * chunks;                  /* NULL means the file is decoded in one go  */
+    uint32          chunk_nums;
+    uint32          chunks_left;             /* the last chunk to finish stitches them    */
+    pthread_mutex_t chunk_lock;
 }THREAD_PARAMETER;
 
+/* where the csv replay is between two records */
+typedef struct REPLAY_STATE {
+    uint32 free_heap;
+    uint32 last_hours;
+    uint16 day;
+    uint8  find_begin_point;   /* a heap init record has been replayed */
+} REPLAY_STATE;
+
+/* wakes up build_csv when a replay job moves to the next stage */
+typedef struct REPLAY_CONTEXT {
+    pthread_mutex_t lock;
+    pthread_cond_t  cond_stage;
+} REPLAY_CONTEXT;
+
+/* one meta file of the parallel csv replay, see build_csv */
+typedef struct REPLAY_JOB {
+    char            filepath[MAX_PATH_LEN];
+    uint8           failed;            /* the meta file can not be read            */
+    uint8           stage;             /* REPLAY_STAGE_XXX                         */
+
+    META_RECORD   * records;
+    uint32          nums;
+    uint32        * deltas;            /* free heap change since the file started, unresolved frees not counted */
+    uint32        * unresolved;        /* deallocations of blocks allocated by earlier files */
+    uint32        * resolved_sizes;    /* sizes the unresolved deallocations got from g_heap_table */
+    uint8         * resolved_found;    /* the unresolved deallocation found its block in g_heap_table */
+    uint32          unresolved_nums;
+    HEAP_LIVE_TABLE survivors;         /* blocks the file allocated and did not free */
+
+    REPLAY_STATE    start;             /* replay state when the file starts        */
+    uint32          start_live_blocks; /* blocks in g_heap_table when the file starts */
+    uint8           bCheckHeapInit;
+    char          * csv;
+    uint64          csv_len;
+    META_INDEX      index;             /* of the csv lines, offsets from the start of csv */
+    struct HEAP_REPORT * report;       /* -r: stage 3 reports on the records instead of formatting csv lines */
+    uint64          size_class_width;  /* -gs: bucket width in nanoseconds, 0 means no size classes */
+    struct SIZE_CLASS_SERIES * size_classes;
+
+    REPLAY_CONTEXT * context;
+} REPLAY_JOB;
+
+/* gets the replay jobs in file order once stage 3 is done with them */
+typedef void (*replay_consume_fn)(REPLAY_JOB * job, void * arg);
+
+/* build_csv: the replay state after the first files meta files, g_heap_table holds their live blocks then */
+typedef void (*replay_checkpoint_fn)(REPLAY_JOB * jobs, uint32 files, const REPLAY_STATE * rs, uint8 hasHeapInit, void * arg);
+
+/* where replay_run_jobs starts and where it leaves a checkpoint */
+typedef struct REPLAY_RESUME {
+    uint32               first;          /* meta files replayed by an earlier run, 0 for all */
+    REPLAY_STATE         state;          /* after them, g_heap_table is loaded with their live blocks */
+    uint8                hasHeapInit;
+    replay_checkpoint_fn checkpoint;     /* called before the last meta file is linked */
+} REPLAY_RESUME;
+
+/* the checkpoint of build_csv is a REPLAY_CHECKPOINT_HEADER, the REPLAY_CHECKPOINT_FILE of each meta file
+   it covers, then g_heap_table as halloc_info_table_write wrote it(see HEAP_LIVE_TABLE_HEADER).
+   It is taken before the last meta file, which is the one still growing while a capture runs
+ */
+typedef struct REPLAY_CHECKPOINT_HEADER {
+    uint32       magic;            /* REPLAY_CHECKPOINT_MAGIC                       */
+    uint32       version;          /* REPLAY_CHECKPOINT_VERSION                     */
+    uint32       init_free_heap;
+    uint8        bCheckHeapInit;
+    uint8        hasHeapInit;
+    TRACE_DATE   date;             /* the trace date the csv lines were written with */
+    REPLAY_STATE state;
+    uint32       files;
+    uint64       csv_size;         /* of the csv lines of the meta files covered    */
+    uint64       lines;
+} REPLAY_CHECKPOINT_HEADER;
+
+typedef struct REPLAY_CHECKPOINT_FILE {
+    char   filepath[MAX_PATH_LEN];
+    uint64 size;
+    sint64 mtime;
+} REPLAY_CHECKPOINT_FILE;
+
+/* -gs: allocations and live bytes by size class in a time bucket */
+typedef struct SIZE_CLASS_ROW {
+    uint64 bucket;                        /* csv time / bucket width */
+    uint64 allocations[SIZE_CLASS_NUMS];
+    sint64 live_bytes[SIZE_CLASS_NUMS];   /* of a meta file: the change, of the csv: at the end of the bucket */
+} SIZE_CLASS_ROW;
+
+/* -gs: the rows of a meta file are in replay order, a new one starts when the bucket changes.
+   The rows of the csv are in bucket order
+ */
+typedef struct SIZE_CLASS_SERIES {
+    SIZE_CLASS_ROW * rows;
+    uint32           nums;
+    uint32           capacity;
+    sint64           lead_bytes[SIZE_CLASS_NUMS];  /* of a meta file: the change before its first csv line */
+    sint64           running[SIZE_CLASS_NUMS];     /* of the csv: live bytes after the meta files merged so far */
+} SIZE_CLASS_SERIES;
+
+/* build_csv: where the csv lines of the replay jobs go */
+typedef struct REPLAY_CSV_OUTPUT {
+    FILE            * fd_csv;
+    META_INDEX        index;
+    SIZE_CLASS_SERIES size_classes;
+    uint32            consumed;           /* meta files written so far, including the resumed ones */
+    uint32            checkpoint_files;   /* meta files the checkpoint covers, 0 for none        */
+    uint64            checkpoint_csv_size;
+    uint64            checkpoint_lines;
+} REPLAY_CSV_OUTPUT;
+
+/* -r: allocations and deallocations of one interval */
+typedef struct HEAP_REPORT_INTERVAL {
+    uint64 allocations;
+    uint64 deallocations;
+} HEAP_REPORT_INTERVAL;
+
+/* -r: what the replay saw on the records that make csv lines, all times are csv times(see csv_time).
+   Each meta file gets its own and they are merged in file order, the earliest one wins a tie
+ */
+typedef struct HEAP_REPORT {
+    uint32 meta_files;
+    uint64 allocations;
+    uint64 deallocations;
+    uint64 first_time;
+    uint64 last_time;
+
+    uint32 min_free_heap;
+    uint64 min_free_heap_time;
+    uint32 max_free_heap;
+    uint64 max_free_heap_time;
+    uint32 peak_live_blocks;
+    uint64 peak_live_blocks_time;
+
+    META_RECORD largest;               /* largest allocation, size 0 if there is none */
+    uint64      largest_time;
+
+    uint64 type_allocations[AT_NUMS];  /* by ALLOCATION_TYPE, 0 is for an unknown type */
+    uint64 type_bytes[AT_NUMS];
+
+    HEAP_REPORT_INTERVAL * intervals;  /* of HEAP_REPORT_INTERVAL_MINUTES, from first_interval */
+    uint64                 first_interval;
+    uint32                 interval_nums;
+} HEAP_REPORT;
+
 typedef struct THREAD_UNIT {    
     pthread_t pt;        /* thread pointer                                            */  
     uint16    busy;      /* TRUE - the thread is working on decoing, FALSE- it's free */
@@ -326,18 +798,36 @@ typedef struct CSV_FORMAT_UNIT {
 	char freesize[8]; 
 } CSV_FORMAT_UNIT;
 
-typedef struct  TRACE_TIME{
-    uint16 minute;
-    uint16 hour;
-    uint16 day;    
-}TRACE_TIME;
+/* -t: the lines of one time bucket */
+typedef struct CSV_BUCKET {
+    uint64 index;        /* (csv time - csv time of the first line) / bucket width */
+    uint64 lines;
+    uint64 sum;
+    uint32 min;
+    uint32 max;
+    uint32 last;
+    char   first[MAX_SINGLE_METADATA_LEN];  /* the first line, its time is the time of the bucket */
+} CSV_BUCKET;
+
+/* -t lttb: a csv line kept until the bucket after its own is complete */
+typedef struct CSV_POINT {
+    uint64 time;
+    uint32 free_heap;
+    char   line[MAX_SINGLE_METADATA_LEN];
+} CSV_POINT;
+
+typedef struct CSV_POINT_BUCKET {
+    uint64      index;
+    CSV_POINT * points;
+    uint32      nums;
+    uint32      capacity;
+} CSV_POINT_BUCKET;
 
 /************************************************************************** 
    global variables
  **************************************************************************/
 extern TRACE_DATE           g_trace_date;
-extern BLX_FILE_LIST_NODE * g_bfln_header;
-extern HEAP_LINK_NODE     * g_heap_link;
+extern HEAP_LIVE_TABLE      g_heap_table;
 
 /************************************************************************** 
    functions...
@@ -346,21 +836,95 @@ uint32 char_2_hex(char c);
 
 uint32 strtouint32(char * in);
 
-char * get_file_pattern(char * file_path);
-uint32 get_file_index_from_path(char * file_path);
+uint32 get_file_pattern(const char * file_path,char * pattern);
+uint32 get_file_index_from_path(const char * file_path);
 uint32 get_file_lines(char * file_path);
 
-void slinkedlst_free(void);
-void slinkedlst_dump(const void * mapped_fptr);
-void slinkedlst_insert(char * file_path);
-
-void halloc_info_linkedlst_free(void);
-void halloc_info_linkedlst_add(uint32 addr,uint32 size);
-uint32 halloc_info_linkedlst_get_size(uint32 addr);
-
-void sort_filelist(char * path);
 
+void halloc_info_table_free(HEAP_LIVE_TABLE * table);
+void halloc_info_table_add(HEAP_LIVE_TABLE * table,uint32 addr,uint32 size);
+uint8 halloc_info_table_remove(HEAP_LIVE_TABLE * table,uint32 addr,uint32 * size);
+uint32 halloc_info_table_get_size(HEAP_LIVE_TABLE * table,uint32 addr);
+void halloc_info_table_merge(HEAP_LIVE_TABLE * dst,const HEAP_LIVE_TABLE * src);
+uint8 halloc_info_table_write(const HEAP_LIVE_TABLE * table,FILE * fd_out);
+uint8 halloc_info_table_read(HEAP_LIVE_TABLE * table,FILE * fd_in);
+void halloc_info_table_add_caller(HEAP_LIVE_TABLE * table,uint32 addr,uint32 size,uint32 caller);
+uint8 halloc_info_table_remove_caller(HEAP_LIVE_TABLE * table,uint32 addr,uint32 * size,uint32 * caller);
+
+void   heap_caller_table_free(HEAP_CALLER_TABLE * table);
+uint32 heap_caller_table_id(HEAP_CALLER_TABLE * table,uint32 caller1,uint32 caller2);
+void   heap_caller_table_update(HEAP_CALLER_TABLE * table,uint32 caller,sint64 bytes,sint32 blocks);
+void   heap_caller_table_mark(HEAP_CALLER_TABLE * table);
+uint32 heap_caller_table_snapshot(const HEAP_CALLER_TABLE * table,uint8 bLowWater,HEAP_CALLER ** callers);
+
+void sort_filelist(BLX_FILE_LIST * list);
+void blx_file_list_add(BLX_FILE_LIST * list,const char * filepath,uint64 size,time_t mtime);
+void blx_file_list_free(BLX_FILE_LIST * list);
+
+void decode_cache_init(DECODE_CACHE * cache);
+void decode_cache_free(DECODE_CACHE * cache);
+void decode_cache_add(DECODE_CACHE * cache,const BLX_FILE_INFO * file,uint64 tail_hash,uint32 tracetype,uint32 fileindex);
+uint8 decode_cache_save(const DECODE_CACHE * cache,const char * cache_path);
+uint8 decode_cache_load(DECODE_CACHE * cache,const char * cache_path);
+const DECODE_CACHE_ENTRY * decode_cache_find(const DECODE_CACHE * cache,const char * filepath);
+uint64 blx_file_tail_hash(const char * filepath,uint64 size);
+
+uint64 decode_timestamp_ns(uint8 * bytestream);
+uint16 format_timestamp(uint64 value,char * timestring);
 uint16 decode_timestamp(uint8 * bytestream,char * timestring);
+uint64 csv_time(uint16 day,uint64 timestamp);
+uint16 format_csv_time(uint64 time,char * text);
+uint8  csv_line_time(const char * line,uint64 * time);
+
+uint8  meta_file_write_header(OUTPUT_WRITER * writer);
+uint8  meta_file_check_header(FILE * fd_meta);
+uint16 meta_record_to_text(const META_RECORD * record,char * line);
+
+OUTPUT_WRITER * output_writer_thread(void);
+void  output_writer_open(OUTPUT_WRITER * writer,int fd);
+void  output_writer_put(OUTPUT_WRITER * writer,const void * data,uint32 len);
+uint8 output_writer_flush(OUTPUT_WRITER * writer);
+uint8 output_writer_close(OUTPUT_WRITER * writer);
+void  output_writer_stats(uint64 * bytes,uint64 * flushes);
+
+void meta_buffer_init(META_RECORD_BUFFER * mrb,OUTPUT_WRITER * writer);
+void meta_buffer_append(META_RECORD_BUFFER * mrb,const META_RECORD * record);
+void meta_buffer_append_records(META_RECORD_BUFFER * mrb,const META_RECORD * records,uint32 nums);
+void meta_buffer_flush(META_RECORD_BUFFER * mrb);
+void meta_block_write(OUTPUT_WRITER * writer,const META_RECORD * records,uint32 nums);
+void meta_reader_init(META_READER * reader);
+void meta_reader_free(META_READER * reader);
+uint32 meta_file_read_records(FILE * fd_meta,META_READER * reader,META_RECORD * records);
+void meta_buffer_free(META_RECORD_BUFFER * mrb);
+
+void   meta_index_init(META_INDEX * index);
+void   meta_index_free(META_INDEX * index);
+void   meta_index_add_line(META_INDEX * index,uint64 time,uint32 free_heap,uint32 len);
+void   meta_index_next_file(META_INDEX * index);
+void   meta_index_append(META_INDEX * dst,const META_INDEX * src);
+void   meta_index_truncate(META_INDEX * index,uint64 lines,uint64 csv_size);
+uint8  meta_index_save(const META_INDEX * index,const char * index_path);
+uint8  meta_index_load(META_INDEX * index,const char * index_path,const char * csv_path);
+uint32 meta_index_find(const META_INDEX * index,uint64 time);
+uint64 meta_index_entry_lines(const META_INDEX * index,uint32 i);
+
+void size_class_series_init(SIZE_CLASS_SERIES * series);
+void size_class_series_free(SIZE_CLASS_SERIES * series);
+SIZE_CLASS_ROW * size_class_series_append(SIZE_CLASS_SERIES * series,uint64 bucket);
+void size_class_series_merge(SIZE_CLASS_SERIES * dst,const SIZE_CLASS_SERIES * src);
+uint8 size_class_series_save(const SIZE_CLASS_SERIES * series,uint64 width,const char * path);
+
+void heap_report_init(HEAP_REPORT * report);
+void heap_report_free(HEAP_REPORT * report);
+void heap_report_add(HEAP_REPORT * report,uint64 time,const META_RECORD * record,uint32 free_heap,uint32 live_blocks);
+void heap_report_merge(HEAP_REPORT * dst,const HEAP_REPORT * src);
+
+void   blx_chunk_add_item(BLX_CHUNK * chunk,uint64 offset,uint64 next,uint32 first_record);
+uint32 blx_chunk_find_item(const BLX_CHUNK * chunk,uint64 offset);
+uint8  blx_chunk_probed(const BLX_CHUNK * chunk,uint64 offset);
+
+uint64 scan_trace_header(const uint8 * buf,uint64 pos,uint64 size);
+uint8  scan_trace_header_force(uint32 flavour);
 
 #endif
 
@@ -8,6 +8,9 @@
 /* maximum number of threads allowed in a pool   */
 #define MAXT_IN_POOL 200
 
+/* jobs dispatched from outside the pool that can wait at once, must be power of 2 */
+#define TP_INJECT_SIZE 1024
+
 #define handle_error_en(en, msg) do { errno = en; perror(msg); exit(EXIT_FAILURE); } while (0)
 #define handle_error(msg)        do { perror(msg); exit(EXIT_FAILURE); } while (0)
 
@@ -25,30 +28,31 @@ typedef void * threadpool;
 typedef void (*dispatch_fn)(void *);
 
 /**
- * init a fixed-sized thread pool.  If the function succeeds, it returns a (non-NULL)
+ * init a fixed-sized thread pool and start its threads.  If the function succeeds, it returns a (non-NULL)
  * "threadpool", else it returns NULL.
  */
 threadpool tp_init_threadpool(uint8 num_threads_in_pool);
 
 
 /**
- * dispatch sends a thread off to do some work.  If all threads in the pool are busy, dispatch will
- * block until a thread becomes free and is dispatched.
+ * dispatch queues a job for the pool and returns immediately. A job dispatched from outside the pool
+ * waits for room while TP_INJECT_SIZE jobs from outside are queued already.
  * 
- * Once a thread is dispatched, this function returns immediately.
+ * A job may dispatch more jobs to its own pool, they are queued on the deque of the thread running
+ * it and idle threads steal them from there.
  * 
- * The dispatched thread calls into the function "dispatch_to_here" with argument "arg".
+ * The thread that runs the job calls into the function "dispatch_to_here" with argument "arg".
  */
 void tp_dispatch(threadpool tpool, dispatch_fn dispatch_to_here,void *arg);
 
 /**
- * destroy_threadpool kills the threadpool, causing all threads in it to commit suicide, and then
- * frees all the memory associated with the threadpool.
+ * destroy_threadpool waits for all jobs to finish, including the ones dispatched by jobs, then kills
+ * the threadpool, causing all threads in it to commit suicide, and frees all the memory associated with it.
  */
 void tp_destroy_threadpool(threadpool destroyme);
 
 /**
- * create threads
+ * threads are created by tp_init_threadpool, kept for old callers
  */
 void tp_start_threadpool(threadpool tpool);
 
@@ -9,6 +9,7 @@ typedef short              uint16;
 typedef unsigned int       uint32;
 typedef unsigned long long uint64;
 typedef signed int         sint32;
+typedef signed long long   sint64;
 
 #endif
 
@@ -15,6 +15,11 @@
 #include <sys/stat.h>
 #include <sys/mman.h>
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAS_X86_SIMD TRUE
+#endif
+
 #include "ma.h"
 
 uint32 char_2_hex(char c)
@@ -45,68 +50,60 @@ uint32 strtouint32(char * in)
     return ret;
 }
 
-char * get_file_pattern(char * file_path)
+/* the part of a blx file path all parts of a capture share: up to the last '_' when a number follows it,
+   otherwise up to the extension. e.g. /cap/trace_part_12.blx -> /cap/trace_part, /cap/trace.blx -> /cap/trace
+
+   pattern needs MAX_PATH_LEN bytes, returns the length of the pattern
+ */
+uint32 get_file_pattern(const char * file_path, char * pattern)
 {
-    char * ptr;
-    char * pret;
+    const char * ptr;
+    const char * end;
 
-    if (file_path == NULL) {
-        return NULL;
+    if (file_path == NULL || pattern == NULL) {
+        return 0;
     }
 
-    pret = malloc(MAX_PATH_LEN);
-    strncpy(pret,file_path,MAX_PATH_LEN);
-
-    ptr = strrchr(pret,'_');
+    ptr = strrchr(file_path,'_');
 
-    ptr++;
-    if (ptr != '\0') {
+    /* TODO:Is it enough that only check the first char following the last '_'? */
+    if (ptr != NULL && IS_A_NUMBER(ptr[1])) {
+        end = ptr;
+    } else if ((end = strrchr(file_path,'.')) == NULL) {
+        end = file_path + strlen(file_path);
+    }
 
-        /* TODO:Is it enough that only check the first char following the last '_'? */
-        if (IS_A_NUMBER(*ptr) ) {
-            ptr = strrchr(pret,'_');
-            *ptr = '\0';
-        } else {
-            ptr = strrchr(pret,'.');
-            *ptr = '\0';
-        }
+    if (end - file_path >= MAX_PATH_LEN) {
+        end = file_path + MAX_PATH_LEN - 1;
     }
 
+    memcpy(pattern,file_path,end - file_path);
+    pattern[end - file_path] = '\0';
+
 #if ENABLE_DEBUG_INFO == TRUE
-    printf("get_file_pattern@pattern is %s\n",pret);
+    printf("get_file_pattern@pattern is %s\n",pattern);
 #endif
 
-    return pret;
+    return end - file_path;
 }
 
-uint32 get_file_index_from_path(char * file_path)
+/* the number after the last '_' of a blx file path, 0 if there is none */
+uint32 get_file_index_from_path(const char * file_path)
 {
-    uint16 index = 0;
+    const char * ptr;
     uint32 ret = 0;
 
-    char * ptr;
-    char indexstr[MAX_INDEX_LEN] = {0};
-
-    if (file_path == NULL) {
+    if (file_path == NULL || (ptr = strrchr(file_path,'_')) == NULL) {
         return 0;
     }
 
-    ptr = strrchr(file_path,'_');
-    ptr++;
-
-    while (ptr != NULL && *ptr != '\0' && *ptr != '.')  {
+    for (ptr++; *ptr != '\0' && *ptr != '.'; ptr++)  {
 
-        if (IS_A_NUMBER(*ptr) ) {
-            indexstr[index++] = *ptr++;
-            ret = 1;
-        } else {
-            ret = 0;
-            break;
+        if (!IS_A_NUMBER(*ptr)) {
+            return 0;
         }
-    }
 
-    if (ret == 1) {
-        ret = (uint32)atoi(indexstr);
+        ret = ret * 10 + (*ptr - '0');
     }
 
 #if ENABLE_DEBUG_INFO == TRUE
@@ -143,267 +140,321 @@ uint32 get_file_lines(char * file_path)
     return filenums;
 }
 
-/* sort linked list:  */
-void slinkedlst_free(void)
+static int blx_file_path_compare(const void * a, const void * b)
 {
-   BLX_FILE_IN_ONE_FOLDER * bfiof_cursor = NULL;
-   BLX_FILE_LIST_NODE     * bfln_cursor  = NULL;
-
-   BLX_FILE_IN_ONE_FOLDER * bfiof_tmp = NULL;
-   BLX_FILE_LIST_NODE     * bfln_tmp  = NULL;
-
-   bfln_cursor = g_bfln_header;
-
-   while (bfln_cursor != NULL)  {
-       bfiof_cursor = bfln_cursor->first_node;
-
-       while (bfiof_cursor != NULL)  {
-
-           bfiof_tmp    = bfiof_cursor;
-           bfiof_cursor = bfiof_cursor->next;
+    return strcmp(((const BLX_FILE_INFO *)a)->filepath,((const BLX_FILE_INFO *)b)->filepath);
+}
 
-           free(bfiof_tmp);
-       }
+static int blx_file_key_compare(const void * a, const void * b)
+{
+    const BLX_FILE_SORT_KEY * ka = (const BLX_FILE_SORT_KEY *)a;
+    const BLX_FILE_SORT_KEY * kb = (const BLX_FILE_SORT_KEY *)b;
 
-       bfln_tmp    = bfln_cursor;
-       bfln_cursor = bfln_cursor->next_list;
+    if (ka->capture != kb->capture) {
+        return ka->capture < kb->capture ? -1 : 1;
+    }
 
-       free(bfln_tmp);
-   }
+    if (ka->index != kb->index) {
+        return ka->index < kb->index ? -1 : 1;
+    }
 
-   return;
+    /* same index twice(e.g. t_4 and t_04), the later path goes first */
+    return ka->order < kb->order ? 1 : (ka->order > kb->order ? -1 : 0);
 }
 
-/* sort linked list:  */
-void slinkedlst_dump(const void * mapped_fptr)
+static uint32 blx_pattern_hash(const char * pattern)
 {
-   char * fptr = (char *)mapped_fptr;
-
-   uint32 index;
+    uint32 hash = 2166136261U;   /* FNV-1a */
 
-   BLX_FILE_IN_ONE_FOLDER * bfiof_cursor = NULL;
-   BLX_FILE_LIST_NODE     * bfln_cursor  = NULL;
+    while (*pattern != '\0') {
+        hash = (hash ^ (uint8)*pattern++) * 16777619U;
+    }
 
-   bfln_cursor = g_bfln_header;
+    return hash;
+}
 
-   while (bfln_cursor != NULL)  {
-       bfiof_cursor = bfln_cursor->first_node;
+/* parts of a capture are put in index order, captures in the order they first show up in path order.
+   A file without index is the first part, trace.blx goes before trace_part_1.blx
+ */
+void sort_filelist(BLX_FILE_LIST * list)
+{
+    BLX_FILE_SORT_KEY * keys;
+    BLX_FILE_INFO     * sorted;
 
-       while (bfiof_cursor != NULL)  {
+    char    pattern[MAX_PATH_LEN + sizeof("_part")];
+    char ** patterns;         /* one per capture */
+    uint32 * slots;           /* capture+1 by pattern hash, 0 means empty */
+    uint32   slot_mask,slot;
+    uint32   captures = 0;
+    uint32   i;
 
-#if ENABLE_DEBUG_INFO == TRUE
-           printf("slinkedlst_dump@listdump:%s\n", bfiof_cursor->filepath);
-#endif
+    /* the order 'ls --sort=extension' gave, all files end with .blx */
+    qsort(list->files,list->nums,sizeof(BLX_FILE_INFO),blx_file_path_compare);
 
-           index = 0;
-           while ( bfiof_cursor->filepath[index] != '\0' ) {
-               *fptr++ = bfiof_cursor->filepath[index++];
-           }
+    if (list->nums < 2) {
+        return;
+    }
 
-           *fptr++ = '\n';
+    for (slot_mask = 1; slot_mask < list->nums * 2; slot_mask <<= 1);
+    slot_mask--;
 
-           bfiof_cursor = bfiof_cursor->next;
-       }
+    keys     = malloc(list->nums * sizeof(BLX_FILE_SORT_KEY));
+    sorted   = malloc(list->nums * sizeof(BLX_FILE_INFO));
+    patterns = malloc(list->nums * sizeof(char *));
+    slots    = calloc(slot_mask + 1,sizeof(uint32));
+    if (keys == NULL || sorted == NULL || patterns == NULL || slots == NULL) {
+        fprintf(stderr,"sort_filelist@Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
 
-       bfln_cursor = bfln_cursor->next_list;
-   }
+    for (i = 0; i < list->nums; i++) {
 
-   return;
-}
+        keys[i].index = get_file_index_from_path(list->files[i].filepath);
+        keys[i].order = i;
 
-/* sort linked list: insert a filepath as a node into the linked list sorted */
-void slinkedlst_insert(char * file_path)
-{
-    char * filepattern;
+        get_file_pattern(list->files[i].filepath,pattern);
+        if (keys[i].index == 0) {  /* add '_part' for the first file without index */
+            strcat(pattern,"_part");
+        }
 
-    BLX_FILE_IN_ONE_FOLDER * bfiof_newnode;
-    BLX_FILE_LIST_NODE     * bfln_newnode;
+        /* the capture number is the pattern's first show up */
+        slot = blx_pattern_hash(pattern) & slot_mask;
+        while (slots[slot] != 0 && strcmp(patterns[slots[slot] - 1],pattern) != 0) {
+            slot = (slot + 1) & slot_mask;
+        }
 
-    BLX_FILE_LIST_NODE     * bfln_cursor;
-    BLX_FILE_LIST_NODE     * bfln_prv  = NULL;
-    BLX_FILE_IN_ONE_FOLDER * bfiof_prv = NULL;
-    BLX_FILE_IN_ONE_FOLDER * bfiof_cursor;
+        if (slots[slot] == 0) {
+            patterns[captures] = strdup(pattern);
+            slots[slot]        = ++captures;
+        }
 
-    bfiof_newnode = malloc(sizeof(BLX_FILE_IN_ONE_FOLDER));
+        keys[i].capture = slots[slot] - 1;
+    }
 
-    strncpy((char *)bfiof_newnode->filepath,file_path,MAX_PATH_LEN);
-    bfiof_newnode->index = get_file_index_from_path(file_path);
-    bfiof_newnode->next  = NULL;
+    qsort(keys,list->nums,sizeof(BLX_FILE_SORT_KEY),blx_file_key_compare);
 
-    filepattern = get_file_pattern(file_path);
+    for (i = 0; i < list->nums; i++) {
+        sorted[i] = list->files[keys[i].order];
+    }
 
-    if( bfiof_newnode->index == 0 ) {  /* add '_part' for the first file without index */
-        sprintf(filepattern,"%s_part",filepattern);
+    for (i = 0; i < captures; i++) {
+        free(patterns[i]);
     }
 
-#if ENABLE_LINKED_LIST_TRACE == TRUE
-    printf("insert %s\n--patter is %s\n",file_path,filepattern);
-#endif
+    free(list->files);
+    free(keys);
+    free(patterns);
+    free(slots);
+
+    list->files    = sorted;
+    list->capacity = list->nums;
 
-    if ( g_bfln_header == NULL )  {
+    return;
+}
 
-        g_bfln_header = malloc(sizeof(BLX_FILE_LIST_NODE));
+void blx_file_list_add(BLX_FILE_LIST * list,const char * filepath,uint64 size,time_t mtime)
+{
+    BLX_FILE_INFO * info;
 
-        strncpy((char *)g_bfln_header->pathpattern,filepattern,MAX_PATH_LEN);
-        g_bfln_header->first_node = NULL;
-        g_bfln_header->next_list  = NULL;
-        g_bfln_header->first_node = bfiof_newnode;
+    pthread_mutex_lock(&list->lock);
 
-#if ENABLE_LINKED_LIST_TRACE == TRUE
-        printf("create header for pattern %s\n",g_bfln_header->pathpattern);
-#endif
-        return;
+    if (list->nums == list->capacity) {
+        list->capacity = (list->capacity == 0 ? 256 : list->capacity * 2);
+        list->files    = realloc(list->files,list->capacity * sizeof(BLX_FILE_INFO));
+        if (list->files == NULL) {
+            fprintf(stderr,"blx_file_list_add@Out of memory\n");
+            exit(EXIT_FAILURE);
+        }
     }
 
-    bfln_cursor  = g_bfln_header;
+    info = &list->files[list->nums++];
+    info->filepath = strdup(filepath);
+    info->size     = size;
+    info->mtime    = mtime;
 
-    /* go through Y link first */
-    while (bfln_cursor != NULL)  {
+    pthread_mutex_unlock(&list->lock);
+}
 
-        if (strcmp((char *)bfln_cursor->pathpattern,filepattern) == 0) {
-            break;
-        }
+void blx_file_list_free(BLX_FILE_LIST * list)
+{
+    uint32 i;
 
-        bfln_prv    = bfln_cursor;
-        bfln_cursor = bfln_cursor->next_list;
+    for (i = 0; i < list->nums; i++) {
+        free(list->files[i].filepath);
     }
 
-    if (bfln_cursor == NULL) {
+    free(list->files);
+    pthread_mutex_destroy(&list->lock);
 
-        bfln_newnode = malloc(sizeof(BLX_FILE_LIST_NODE));
+    list->files    = NULL;
+    list->nums     = 0;
+    list->capacity = 0;
+}
 
-        strncpy((char *)bfln_newnode->pathpattern,filepattern,MAX_PATH_LEN);
-        bfln_newnode->first_node = bfiof_newnode;
-        bfln_newnode->next_list  = NULL;
+void decode_cache_init(DECODE_CACHE * cache)
+{
+    memset(cache,0x0,sizeof(DECODE_CACHE));
+}
 
-        bfln_prv->next_list  = bfln_newnode;
-        free(filepattern);
+void decode_cache_free(DECODE_CACHE * cache)
+{
+    free(cache->entries);
+    decode_cache_init(cache);
+}
 
-#if ENABLE_LINKED_LIST_TRACE == TRUE
-        printf("Add new Y node,new node is %s\n",bfiof_newnode->filepath);
-#endif
-        return;
+void decode_cache_add(DECODE_CACHE * cache,const BLX_FILE_INFO * file,uint64 tail_hash,uint32 tracetype,uint32 fileindex)
+{
+    DECODE_CACHE_ENTRY * entry;
+
+    if (cache->nums == cache->capacity) {
+        cache->capacity = (cache->capacity == 0 ? 256 : cache->capacity * 2);
+        cache->entries  = realloc(cache->entries,cache->capacity * sizeof(DECODE_CACHE_ENTRY));
+        if (cache->entries == NULL) {
+            fprintf(stderr,"decode_cache_add@Out of memory\n");
+            exit(EXIT_FAILURE);
+        }
     }
 
-    bfiof_cursor = bfln_cursor->first_node;
+    entry = &cache->entries[cache->nums++];
+    memset(entry,0x0,sizeof(DECODE_CACHE_ENTRY));
 
-#if ENABLE_LINKED_LIST_TRACE == TRUE
-    printf("and then go through X link.\n");
-#endif
+    strncpy(entry->filepath,file->filepath,MAX_PATH_LEN - 1);
+    entry->size      = file->size;
+    entry->mtime     = file->mtime;
+    entry->tail_hash = tail_hash;
+    entry->tracetype = tracetype;
+    entry->fileindex = fileindex;
+}
 
-    /* and then go through X link */
-    while (bfiof_cursor != NULL &&
-           bfiof_newnode->index > bfiof_cursor->index)
-    {
+uint8 decode_cache_save(const DECODE_CACHE * cache,const char * cache_path)
+{
+    DECODE_CACHE_HEADER dch;
+    FILE * fd_cache;
+    uint8  bret;
 
-        bfiof_prv      = bfiof_cursor;
-        bfiof_cursor   = bfiof_cursor->next;
+    if ((fd_cache = fopen(cache_path,"wb")) == 0) {
+        fprintf(stderr,"decode_cache_save@Create %s failed\n",cache_path);
+        return FALSE;
     }
 
-    if (bfiof_cursor == NULL )  {
+    dch.magic      = DECODE_CACHE_MAGIC;
+    dch.version    = DECODE_CACHE_VERSION;
+    dch.entry_size = sizeof(DECODE_CACHE_ENTRY);
+    dch.entries    = cache->nums;
 
-#if ENABLE_LINKED_LIST_TRACE == TRUE
-         printf("...insert at the end of X link\n");
-#endif
-         bfiof_prv->next = bfiof_newnode;
-    } else {
+    bret = fwrite(&dch,sizeof(DECODE_CACHE_HEADER),1,fd_cache) == 1 &&
+           fwrite(cache->entries,sizeof(DECODE_CACHE_ENTRY),cache->nums,fd_cache) == cache->nums;
 
-#if ENABLE_LINKED_LIST_TRACE == TRUE
-         printf("...insert at the middle of X link\n");
-#endif
-         //TODO: a reset is here due to bfiof is NULL when sorting some file list....
-         bfiof_prv->next     = bfiof_newnode;
-         bfiof_newnode->next = bfiof_cursor;
+    if (fclose(fd_cache) != 0 || !bret) {
+        fprintf(stderr,"decode_cache_save@Write %s failed\n",cache_path);
+        unlink(cache_path);
+        return FALSE;
     }
 
-    free(filepattern);
+    return TRUE;
 }
 
-void sort_filelist(char * path)
+static int decode_cache_compare(const void * a, const void * b)
 {
-    int    fd;
-    uint32 len = 0;
-    uint32 map_file_size;
-    void * mapped_fptr;
-    char * fptr;
-    char   single_file_path[MAX_PATH_LEN+1] = {0};
+    return strcmp(((const DECODE_CACHE_ENTRY *)a)->filepath,((const DECODE_CACHE_ENTRY *)b)->filepath);
+}
 
-    fd  = open(path,O_RDWR);
-    map_file_size = lseek(fd, 1L, SEEK_END) + MAX_PATH_LEN;
+/* FALSE if there is no cache from an earlier run, every blx file is decoded then */
+uint8 decode_cache_load(DECODE_CACHE * cache,const char * cache_path)
+{
+    DECODE_CACHE_HEADER dch;
+    FILE * fd_cache;
 
-    mapped_fptr = (void *)mmap(NULL,map_file_size,PROT_READ|PROT_WRITE,MAP_SHARED,fd,0);
+    decode_cache_init(cache);
 
-#if ENABLE_DEBUG_INFO == TRUE
-    printf("sort_filelist@create map file done:\n%s\nsize:%d",(char *)mapped_fptr,map_file_size);
-#endif
+    if ((fd_cache = fopen(cache_path,"rb")) == 0) {
+        return FALSE;
+    }
 
-    fptr = (char *)mapped_fptr;
+    if (fread(&dch,sizeof(DECODE_CACHE_HEADER),1,fd_cache) != 1 || dch.magic != DECODE_CACHE_MAGIC ||
+        dch.version != DECODE_CACHE_VERSION || dch.entry_size != sizeof(DECODE_CACHE_ENTRY)) {
+        fclose(fd_cache);
+        return FALSE;
+    }
 
-    /* go through the list file that contains all blx files' full path line by line */
-    while ( fptr != NULL && *fptr != '\0' ) {
+    cache->entries = malloc(dch.entries * sizeof(DECODE_CACHE_ENTRY) + 1);
+    if (cache->entries == NULL) {
+        fprintf(stderr,"decode_cache_load@Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
 
-        if ( *fptr == 0x0A ) {
-            len = 0;
+    if (fread(cache->entries,sizeof(DECODE_CACHE_ENTRY),dch.entries,fd_cache) != dch.entries) {
+        fclose(fd_cache);
+        decode_cache_free(cache);
+        return FALSE;
+    }
 
-#if ENABLE_DEBUG_INFO == TRUE
-            printf("sort_filelist@get one file path from mapped file:%s\n",single_file_path);
-#endif
-            slinkedlst_insert(single_file_path);
+    fclose(fd_cache);
 
-            memset(single_file_path,0x0,MAX_PATH_LEN);
-            fptr++;
-            continue;
+    cache->nums     = dch.entries;
+    cache->capacity = dch.entries;
 
-        } else {
-            single_file_path[len] = *fptr;
-        }
+    /* for decode_cache_find */
+    qsort(cache->entries,cache->nums,sizeof(DECODE_CACHE_ENTRY),decode_cache_compare);
 
-        fptr++;
-        len++;
-    }
+    return TRUE;
+}
 
-    /* write sorted list back to the file */
-    slinkedlst_dump(mapped_fptr);
+/* the entry of a blx file in a loaded cache, NULL if the last run did not decode it */
+const DECODE_CACHE_ENTRY * decode_cache_find(const DECODE_CACHE * cache,const char * filepath)
+{
+    DECODE_CACHE_ENTRY key;
 
-    msync(mapped_fptr, map_file_size, MS_ASYNC);
-    munmap(mapped_fptr, map_file_size);
+    if (cache->nums == 0 || strlen(filepath) >= MAX_PATH_LEN) {
+        return NULL;
+    }
 
-    slinkedlst_free();
-    close(fd);
+    strcpy(key.filepath,filepath);
 
-    return;
+    return bsearch(&key,cache->entries,cache->nums,sizeof(DECODE_CACHE_ENTRY),decode_cache_compare);
 }
 
-uint16 decode_timestamp(uint8 * bytestream,  /* input,a 8 bytes stream */
-                       char * timestring)    /* output */
+/* FNV-1a of the last DECODE_CACHE_TAIL_BYTES bytes of a blx file, 0 if it can not be read */
+uint64 blx_file_tail_hash(const char * filepath,uint64 size)
 {
-    uint64 value = 0;
-    uint64 totalSeconds;
+    uint8  tail[DECODE_CACHE_TAIL_BYTES];
+    uint64 hash = 0xCBF29CE484222325ULL;
+    uint64 len  = (size < DECODE_CACHE_TAIL_BYTES ? size : DECODE_CACHE_TAIL_BYTES);
+    uint64 i;
+    int    blx_fd;
+
+    if ((blx_fd = open(filepath, O_RDONLY)) == -1) {
+        return 0;
+    }
 
-    uint32 seconds = 0;
-    uint32 minutes = 0;
-    uint32 hours   = 0;
+    if (pread(blx_fd,tail,len,size - len) != (ssize_t)len) {
+        close(blx_fd);
+        return 0;
+    }
 
-    uint16 timestring_len = 0;
- 
-    const uint32 digits_after_point = 9; /* e.g. when the number is 3, time format like 12:49:29.537
-                                                 when the number is 6, time format like 12:49:29.537030 */
+    close(blx_fd);
 
-    double fraction;
-    uint32 digits;
+    for (i = 0; i < len; i++) {
+        hash = (hash ^ tail[i]) * 0x100000001B3ULL;
+    }
 
-    if (bytestream == NULL || timestring == NULL) {
+    return hash;
+}
+
+/* raw 8 bytes trace timestamp to nanoseconds */
+uint64 decode_timestamp_ns(uint8 * bytestream)  /* input,a 8 bytes stream */
+{
+    uint64 value = 0;
+    uint32 i;
+
+    if (bytestream == NULL) {
         return 0;
     }
 
-    value  = (uint64)bytestream[0] << 56        |
-             (uint64)bytestream[1] << 56 >>8    |
-             (uint64)bytestream[2] << 56 >>16   |
-             (uint64)bytestream[3] << 56 >> 24  |
-             (uint64)bytestream[4] << 56 >> 32  |
-             (uint64)bytestream[5] << 56 >> 40  |
-             (uint64)bytestream[6] << 56 >> 48  |
-             (uint64)bytestream[7];
+    /* big endian */
+    for (i = 0; i < 8; i++) {
+        value = value << 8 | bytestream[i];
+    }
 
     if ((value & 0xF000000000000000LL) != 0)  {
         value = value & 0x0FFFFFFFFFFFFFFFLL;
@@ -416,106 +467,1775 @@ uint16 decode_timestamp(uint8 * bytestream,  /* input,a 8 bytes stream */
         }
     }
 
+    return value;
+}
+
+/* "00" to "99", two digits are written at once */
+static const char g_digit_pairs[200] = {
+    '0','0','0','1','0','2','0','3','0','4','0','5','0','6','0','7','0','8','0','9',
+    '1','0','1','1','1','2','1','3','1','4','1','5','1','6','1','7','1','8','1','9',
+    '2','0','2','1','2','2','2','3','2','4','2','5','2','6','2','7','2','8','2','9',
+    '3','0','3','1','3','2','3','3','3','4','3','5','3','6','3','7','3','8','3','9',
+    '4','0','4','1','4','2','4','3','4','4','4','5','4','6','4','7','4','8','4','9',
+    '5','0','5','1','5','2','5','3','5','4','5','5','5','6','5','7','5','8','5','9',
+    '6','0','6','1','6','2','6','3','6','4','6','5','6','6','6','7','6','8','6','9',
+    '7','0','7','1','7','2','7','3','7','4','7','5','7','6','7','7','7','8','7','9',
+    '8','0','8','1','8','2','8','3','8','4','8','5','8','6','8','7','8','8','8','9',
+    '9','0','9','1','9','2','9','3','9','4','9','5','9','6','9','7','9','8','9','9'
+};
+
+#define PUT_DIGIT_PAIR(p,n)  do { memcpy((p),&g_digit_pairs[(n) * 2],2); (p) += 2; } while (0)
+
+/* nanoseconds to HH:MM:SS.000000000, always TIMESTAMP_TEXT_LEN characters.
+
+   The fraction used to go through a double, (ns / 1e9) * 1e9 truncated, which printed about 1.7% of the
+   fractions 1 ns too small(e.g. .000000015 as .000000014). It is exact now.
+ */
+uint16 format_timestamp(uint64 value,     /* input,see decode_timestamp_ns */
+                        char * timestring) /* output */
+{
+    uint64 totalSeconds;
+
+    uint32 seconds;
+    uint32 fraction;
+    char * p = timestring;
+
+    if (timestring == NULL) {
+        return 0;
+    }
+
     totalSeconds = value / TIME_UNIT;
+    fraction     = (uint32)(value - totalSeconds * TIME_UNIT);
+    seconds      = totalSeconds % SECONDS_FOR_ONE_DAY;
+
+    PUT_DIGIT_PAIR(p,seconds / 3600);
+    *p++ = ':';
+    PUT_DIGIT_PAIR(p,seconds / 60 % 60);
+    *p++ = ':';
+    PUT_DIGIT_PAIR(p,seconds % 60);
+    *p++ = '.';
+
+    PUT_DIGIT_PAIR(p,fraction / 10000000);
+    fraction %= 10000000;
+    PUT_DIGIT_PAIR(p,fraction / 100000);
+    fraction %= 100000;
+    PUT_DIGIT_PAIR(p,fraction / 1000);
+    fraction %= 1000;
+    PUT_DIGIT_PAIR(p,fraction / 10);
+    *p++ = '0' + fraction % 10;
+    *p   = '\0';
+
+    return TIMESTAMP_TEXT_LEN;
+}
+
+uint16 decode_timestamp(uint8 * bytestream,  /* input,a 8 bytes stream */
+                       char * timestring)    /* output */
+{
+    if (bytestream == NULL || timestring == NULL) {
+        return 0;
+    }
 
-    fraction = (value % TIME_UNIT) / (double)TIME_UNIT;
-    digits   = fraction * pow(10.0,(int)digits_after_point);
+    return format_timestamp(decode_timestamp_ns(bytestream),timestring);
+}
+
+/* the time of a csv line as one number: the replay's day and the time of the day of the record.
+   The month is left out, the replay only counts days up
+ */
+uint64 csv_time(uint16 day,uint64 timestamp)
+{
+    return day * (SECONDS_FOR_ONE_DAY * TIME_UNIT) + timestamp % (SECONDS_FOR_ONE_DAY * TIME_UNIT);
+}
 
-    seconds = totalSeconds % SECONDS_FOR_ONE_DAY;
-    minutes = seconds / 60;
-    hours   = minutes / 60;
+/* a csv time as the date and time of a csv line, DD/MM/YYYY HH:MM:SS.000000000 */
+uint16 format_csv_time(uint64 time,char * text)
+{
+    char time_stamp[32] = {0};
 
-    sprintf(timestring, "%02d:%02d:%02d.%0*d", hours, minutes % 60, seconds % 60, (int)digits_after_point, digits);
-    timestring_len = strlen(timestring);
+    format_timestamp(time,time_stamp);
 
-    return timestring_len;
+    return sprintf(text,"%02d/%02d/%04d %s",(uint32)(time / (SECONDS_FOR_ONE_DAY * TIME_UNIT)),
+                   g_trace_date.month,g_trace_date.year,time_stamp);
 }
 
-void halloc_info_linkedlst_free(void)
+static uint8 csv_line_digits(const char * text,uint32 n,uint64 * value)
 {
-    HEAP_LINK_NODE * hln = g_heap_link;
+    uint32 i;
 
-    while(hln != NULL) {
-        hln = hln->next;
-        free(g_heap_link);
-        g_heap_link = hln;    
+    *value = 0;
+    for (i = 0; i < n; i++) {
+        if (!IS_A_NUMBER(text[i])) {
+            return FALSE;
+        }
+        *value = *value * 10 + (text[i] - '0');
     }
- 
-    return;
+
+    return TRUE;
 }
 
-/* TODO: performance bottleneck!!!
-   heap allocation infor linked list: */
-uint32 halloc_info_linkedlst_get_size(uint32 addr)
+/* csv time of a "DD/MM/YYYY HH:MM:SS.000000000, 00000000" line, FALSE if the line is not one */
+uint8 csv_line_time(const char * line,uint64 * time)
 {
-    HEAP_LINK_NODE * hln_cursor = g_heap_link;
-    HEAP_LINK_NODE * hln_prv    = g_heap_link;
-    uint32 size = 0;
+    const META_DATE * md = (const META_DATE *)line;
+    uint64 day,hour,minute,second,ns;
+
+    if (!csv_line_digits(md->day,2,&day) || !csv_line_digits(md->hour,2,&hour) ||
+        !csv_line_digits(md->minute,2,&minute) || !csv_line_digits(md->second,2,&second) ||
+        !csv_line_digits(md->ms,9,&ns)) {
+        return FALSE;
+    }
 
-    while (hln_cursor != NULL) {
+    *time = csv_time(day,((hour * 60 + minute) * 60 + second) * TIME_UNIT + ns);
 
-        if (hln_cursor->addr == addr) {
-            
-            /* find it! remove the node from link and return size */
-            size = hln_cursor->size;
- 
-            if (hln_cursor == g_heap_link) {
+    return TRUE;
+}
 
-                /* remove the first node... */
-                g_heap_link  = g_heap_link->next;
-           
-                free(hln_prv);
+uint8 meta_file_write_header(OUTPUT_WRITER * writer)
+{
+    META_FILE_HEADER mfh;
 
-                hln_cursor = g_heap_link;             
-                hln_prv    = g_heap_link;
+    memset(&mfh,0x0,sizeof(META_FILE_HEADER));
+    mfh.magic   = META_FILE_MAGIC;
+    mfh.version = META_FILE_VERSION;
 
-            } else {
+    output_writer_put(writer,&mfh,sizeof(META_FILE_HEADER));
 
-                hln_prv->next = hln_cursor->next;
-                free(hln_cursor);
-            }            
+    return TRUE;
+}
 
-            break;    
-        } else {
+/* read the header of a .meta file, the file is left at the first record */
+uint8 meta_file_check_header(FILE * fd_meta)
+{
+    META_FILE_HEADER mfh;
+
+    if (fread(&mfh,sizeof(META_FILE_HEADER),1,fd_meta) != 1) {
+        return FALSE;
+    }
+
+    if (mfh.magic != META_FILE_MAGIC || mfh.version != META_FILE_VERSION) {
+        fprintf(stderr,"Unsupported meta file(magic 0x%X,version %u), please rebuild it with -b\n",mfh.magic,mfh.version);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/* one META_RECORD in the META_DATA_FORMAT text layout */
+uint16 meta_record_to_text(const META_RECORD * record,char * line)
+{
+    char time_stamp[32] = {0};
+
+    format_timestamp(record->timestamp,time_stamp);
+
+    return sprintf(line,META_DATA_FORMAT,time_stamp,record->type,record->address,record->size,
+                   record->allocation_type,record->caller1,record->caller2);
+}
+
+static pthread_key_t  g_output_writer_key;
+static pthread_once_t g_output_writer_once = PTHREAD_ONCE_INIT;
+
+static uint64 g_output_bytes;    /* written by all writers so far */
+static uint64 g_output_flushes;
+
+static void output_writer_destroy(void * arg)
+{
+    OUTPUT_WRITER * writer = (OUTPUT_WRITER *)arg;
+
+    free(writer->buffer);
+    free(writer);
+}
+
+static void output_writer_key_init(void)
+{
+    pthread_key_create(&g_output_writer_key,output_writer_destroy);
+}
+
+/* the writer of the calling thread, its buffer is reused for every file the thread writes */
+OUTPUT_WRITER * output_writer_thread(void)
+{
+    OUTPUT_WRITER * writer;
+
+    pthread_once(&g_output_writer_once,output_writer_key_init);
+
+    writer = pthread_getspecific(g_output_writer_key);
+    if (writer != NULL) {
+        return writer;
+    }
+
+    writer = malloc(sizeof(OUTPUT_WRITER));
+    if (writer == NULL || (writer->buffer = malloc(OUTPUT_BUFFER_SIZE)) == NULL) {
+        fprintf(stderr,"output_writer_thread@Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    writer->fd   = -1;
+    writer->size = OUTPUT_BUFFER_SIZE;
+    writer->used = 0;
+
+    pthread_setspecific(g_output_writer_key,writer);
+
+    return writer;
+}
+
+void output_writer_open(OUTPUT_WRITER * writer,int fd)
+{
+    writer->fd   = fd;
+    writer->used = 0;
+}
+
+void output_writer_put(OUTPUT_WRITER * writer,const void * data,uint32 len)
+{
+    const uint8 * bytes = (const uint8 *)data;
+    uint32 room;
 
-            hln_prv    = hln_cursor;
-            hln_cursor = hln_cursor->next;
+    while (len != 0) {
+
+        if (writer->used == writer->size) {
+            output_writer_flush(writer);
         }
+
+        room = writer->size - writer->used;
+        room = (len < room ? len : room);
+
+        memcpy(writer->buffer + writer->used,bytes,room);
+        writer->used += room;
+        bytes        += room;
+        len          -= room;
     }
+}
 
-#if ENABLE_TRACE_INFO == TRUE
-    if (size == 0) {
-        printf("Warning:No allocation found for 0x%X\n",addr);
+uint8 output_writer_flush(OUTPUT_WRITER * writer)
+{
+    uint32  done = 0;
+    ssize_t ret;
+
+    while (done < writer->used) {
+        ret = write(writer->fd,writer->buffer + done,writer->used - done);
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (ret <= 0) {
+            fprintf(stderr,"output_writer_flush@Write failed:%s\n",strerror(errno));
+            writer->used = 0;
+            return FALSE;
+        }
+
+        done += ret;
+    }
+
+    if (done != 0) {
+        __atomic_fetch_add(&g_output_bytes,done,__ATOMIC_RELAXED);
+        __atomic_fetch_add(&g_output_flushes,1,__ATOMIC_RELAXED);
     }
-#endif
 
-    return size;   
+    writer->used = 0;
+
+    return TRUE;
 }
 
-/* heap allocation infor linked list
-   when alloca heap, add address and size into the linked list. when dealloc, caller needs to know
-   the heap size of the deallocation request
-   
-   see HEAP_LINK_NODE
- */
-void halloc_info_linkedlst_add(uint32 addr,uint32 size)
+uint8 output_writer_close(OUTPUT_WRITER * writer)
 {
-    HEAP_LINK_NODE * hln_newnode;
+    uint8 bret = output_writer_flush(writer);
 
-    hln_newnode       = malloc(sizeof(HEAP_LINK_NODE));
-    hln_newnode->addr = addr;
-    hln_newnode->size = size;
-    hln_newnode->next = NULL;
+    close(writer->fd);
+    writer->fd = -1;
 
-    if (g_heap_link == NULL) {
-       g_heap_link = hln_newnode;
-    } else {
+    return bret;
+}
+
+void output_writer_stats(uint64 * bytes,uint64 * flushes)
+{
+    *bytes   = __atomic_load_n(&g_output_bytes,__ATOMIC_RELAXED);
+    *flushes = __atomic_load_n(&g_output_flushes,__ATOMIC_RELAXED);
+}
 
-       /* just add at the beginnin of the linked list */
-       hln_newnode->next = g_heap_link;
-       g_heap_link       = hln_newnode;    
+/* record buffer: with a writer the records are encoded into it a block at a time, without one they are kept and it grows */
+void meta_buffer_init(META_RECORD_BUFFER * mrb,OUTPUT_WRITER * writer)
+{
+    mrb->nums     = 0;
+    mrb->writer   = writer;
+    mrb->capacity = META_RECORDS_PER_READ;
+    mrb->records  = malloc(mrb->capacity * sizeof(META_RECORD));
+
+    if (mrb->records == NULL) {
+        fprintf(stderr,"meta_buffer_init@Out of memory\n");
+        exit(EXIT_FAILURE);
     }
+}
 
-    return;
+void meta_buffer_append(META_RECORD_BUFFER * mrb,const META_RECORD * record)
+{
+    if (mrb->writer != NULL && mrb->nums == mrb->capacity) {
+        meta_block_write(mrb->writer,mrb->records,mrb->nums);
+        mrb->nums = 0;
+    }
+
+    if (mrb->nums == mrb->capacity) {
+        mrb->capacity *= 2;
+        mrb->records   = realloc(mrb->records,mrb->capacity * sizeof(META_RECORD));
+        if (mrb->records == NULL) {
+            fprintf(stderr,"meta_buffer_append@Out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    mrb->records[mrb->nums++] = *record;
+}
+
+void meta_buffer_append_records(META_RECORD_BUFFER * mrb,const META_RECORD * records,uint32 nums)
+{
+    uint32 i;
+
+    for (i = 0; i < nums; i++) {
+        meta_buffer_append(mrb,&records[i]);
+    }
+}
+
+void meta_buffer_flush(META_RECORD_BUFFER * mrb)
+{
+    if (mrb->writer != NULL) {
+        if (mrb->nums != 0) {
+            meta_block_write(mrb->writer,mrb->records,mrb->nums);
+            mrb->nums = 0;
+        }
+        output_writer_flush(mrb->writer);
+    }
+}
+
+static inline uint32 varint_put(uint8 * p,uint64 value)
+{
+    uint32 len = 0;
+
+    while (value >= 0x80) {
+        p[len++] = (uint8)value | 0x80;
+        value >>= 7;
+    }
+    p[len++] = (uint8)value;
+
+    return len;
+}
+
+/* FALSE if the varint runs past end or over 10 bytes */
+static inline uint8 varint_get(const uint8 ** p,const uint8 * end,uint64 * value)
+{
+    uint32 shift = 0;
+    uint8  byte;
+
+    *value = 0;
+
+    do {
+        if (*p == end || shift > 63) {
+            return FALSE;
+        }
+        byte    = *(*p)++;
+        *value |= (uint64)(byte & 0x7F) << shift;
+        shift  += 7;
+    } while (byte & 0x80);
+
+    return TRUE;
+}
+
+#define ZIGZAG_ENCODE(v) (((uint64)(v) << 1) ^ (uint64)((sint64)(v) >> 63))
+#define ZIGZAG_DECODE(v) ((sint64)((v) >> 1) ^ -(sint64)((v) & 1))
+
+static inline uint8 meta_type_code(uint8 type)
+{
+    return type == TYPE_INIT ? 0 : (type == TYPE_ALLOCATE ? 1 : (type == TYPE_DEALLOCATE ? 2 : 3));
 }
 
+/* encode the records as one block, see 'meta file format' in ma.h */
+void meta_block_write(OUTPUT_WRITER * writer,const META_RECORD * records,uint32 nums)
+{
+    META_BLOCK_HEADER mbh;
+    const META_RECORD * record;
+
+    const uint32 bits = 13;        /* slots for META_RECORDS_PER_READ pairs, half empty at most */
+    uint32 slots[1 << 13];
+    uint32 * callers;
+    uint8  * payload;
+    uint8  * p;
+    uint64 last_time;
+    uint32 last_address = 0;
+    uint32 i,slot,caller;
+    uint8  code,at;
+
+    if (nums == 0) {
+        return;
+    }
+
+    callers = malloc(nums * 2 * sizeof(uint32));
+    payload = malloc(nums * META_RECORD_MAX_BYTES);
+    if (callers == NULL || payload == NULL) {
+        fprintf(stderr,"meta_block_write@Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    memset(&mbh,0x0,sizeof(META_BLOCK_HEADER));
+    memset(slots,0x0,sizeof(slots));
+
+    mbh.records  = nums;
+    mbh.min_time = records[0].timestamp;
+    mbh.max_time = records[0].timestamp;
+    for (i = 1; i < nums; i++) {
+        mbh.min_time = MIN(mbh.min_time,records[i].timestamp);
+        mbh.max_time = MAX(mbh.max_time,records[i].timestamp);
+    }
+
+    last_time = mbh.min_time;
+    p         = payload;
+
+    for (i = 0; i < nums; i++) {
+
+        record = &records[i];
+
+        /* the caller pair dictionary, fibonacci hashing with linear probing */
+        slot = (uint32)((((uint64)record->caller1 << 32 | record->caller2) * 0x9E3779B97F4A7C15ULL) >> (64 - bits));
+        while (slots[slot] != 0 && (callers[2*(slots[slot]-1)] != record->caller1 || callers[2*(slots[slot]-1)+1] != record->caller2)) {
+            slot = (slot + 1) & ((1U << bits) - 1);
+        }
+        if (slots[slot] == 0) {
+            callers[2*mbh.callers]   = record->caller1;
+            callers[2*mbh.callers+1] = record->caller2;
+            slots[slot] = ++mbh.callers;
+        }
+        caller = slots[slot] - 1;
+
+        code = meta_type_code(record->type);
+        at   = (record->allocation_type < 63 ? record->allocation_type : 63);
+
+        *p++ = code | at << 2;
+        if (code == 3) {
+            *p++ = record->type;
+        }
+        if (at == 63) {
+            *p++ = record->allocation_type;
+        }
+
+        p += varint_put(p,ZIGZAG_ENCODE((sint64)(record->timestamp - last_time)));
+        p += varint_put(p,ZIGZAG_ENCODE((sint32)(record->address - last_address)));
+        p += varint_put(p,record->size);
+        p += varint_put(p,caller);
+
+        last_time    = record->timestamp;
+        last_address = record->address;
+    }
+
+    mbh.bytes = p - payload;
+
+    output_writer_put(writer,&mbh,sizeof(META_BLOCK_HEADER));
+    output_writer_put(writer,callers,mbh.callers * 2 * sizeof(uint32));
+    output_writer_put(writer,payload,mbh.bytes);
+
+    free(callers);
+    free(payload);
+}
+
+void meta_reader_init(META_READER * reader)
+{
+    memset(reader,0x0,sizeof(META_READER));
+}
+
+void meta_reader_free(META_READER * reader)
+{
+    free(reader->payload);
+    free(reader->callers);
+    meta_reader_init(reader);
+}
+
+/* decode the next block of a .meta file into records, which holds META_RECORDS_PER_READ records.
+   Returns how many, 0 at the end of the file or at a broken block
+ */
+uint32 meta_file_read_records(FILE * fd_meta,META_READER * reader,META_RECORD * records)
+{
+    META_BLOCK_HEADER mbh;
+    META_RECORD * record;
+
+    const uint8 * p;
+    const uint8 * end;
+    uint64 last_time,value,caller;
+    uint32 last_address = 0;
+    uint32 i;
+    uint8  tag;
+
+    if (fread(&mbh,sizeof(META_BLOCK_HEADER),1,fd_meta) != 1) {
+        return 0;
+    }
+
+    if (mbh.records == 0 || mbh.records > META_RECORDS_PER_READ || mbh.callers > mbh.records ||
+        mbh.bytes > mbh.records * META_RECORD_MAX_BYTES) {
+        fprintf(stderr,"meta_file_read_records@Broken block\n");
+        return 0;
+    }
+
+    if (reader->callers_capacity < mbh.callers * 2 + 1) {
+        reader->callers_capacity = META_RECORDS_PER_READ * 2;
+        reader->callers          = realloc(reader->callers,reader->callers_capacity * sizeof(uint32));
+    }
+    if (reader->payload_capacity < mbh.bytes + 1) {
+        reader->payload_capacity = META_RECORDS_PER_READ * META_RECORD_MAX_BYTES;
+        reader->payload          = realloc(reader->payload,reader->payload_capacity);
+    }
+    if (reader->callers == NULL || reader->payload == NULL) {
+        fprintf(stderr,"meta_file_read_records@Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (fread(reader->callers,sizeof(uint32),mbh.callers * 2,fd_meta) != mbh.callers * 2 ||
+        fread(reader->payload,1,mbh.bytes,fd_meta) != mbh.bytes) {
+        fprintf(stderr,"meta_file_read_records@Broken block\n");
+        return 0;
+    }
+
+    p         = reader->payload;
+    end       = reader->payload + mbh.bytes;
+    last_time = mbh.min_time;
+
+    for (i = 0; i < mbh.records; i++) {
+
+        record = &records[i];
+
+        if (p == end) {
+            break;
+        }
+
+        tag = *p++;
+        record->type            = (tag & 3) == 0 ? TYPE_INIT : ((tag & 3) == 1 ? TYPE_ALLOCATE : TYPE_DEALLOCATE);
+        record->allocation_type = tag >> 2;
+
+        if ((tag & 3) == 3) {
+            if (p == end) {
+                break;
+            }
+            record->type = *p++;
+        }
+        if (record->allocation_type == 63) {
+            if (p == end) {
+                break;
+            }
+            record->allocation_type = *p++;
+        }
+
+        if (!varint_get(&p,end,&value)) {
+            break;
+        }
+        record->timestamp = last_time + ZIGZAG_DECODE(value);
+
+        if (!varint_get(&p,end,&value)) {
+            break;
+        }
+        record->address = last_address + (uint32)ZIGZAG_DECODE(value);
+
+        if (!varint_get(&p,end,&value)) {
+            break;
+        }
+        record->size = (uint32)value;
+
+        if (!varint_get(&p,end,&caller) || caller >= mbh.callers) {
+            break;
+        }
+        record->caller1 = reader->callers[2*caller];
+        record->caller2 = reader->callers[2*caller+1];
+
+        last_time    = record->timestamp;
+        last_address = record->address;
+    }
+
+    if (i != mbh.records || p != end) {
+        fprintf(stderr,"meta_file_read_records@Broken block\n");
+        return 0;
+    }
+
+    return mbh.records;
+}
+
+void meta_buffer_free(META_RECORD_BUFFER * mrb)
+{
+    free(mrb->records);
+
+    mrb->records  = NULL;
+    mrb->nums     = 0;
+    mrb->capacity = 0;
+}
+
+void meta_index_init(META_INDEX * index)
+{
+    memset(index,0x0,sizeof(META_INDEX));
+}
+
+void meta_index_free(META_INDEX * index)
+{
+    free(index->entries);
+    meta_index_init(index);
+}
+
+static void meta_index_reserve(META_INDEX * index,uint32 nums)
+{
+    if (index->nums + nums <= index->capacity) {
+        return;
+    }
+
+    index->capacity = MAX(index->capacity * 2,index->nums + nums);
+    index->entries  = realloc(index->entries,index->capacity * sizeof(META_INDEX_ENTRY));
+    if (index->entries == NULL) {
+        fprintf(stderr,"meta_index_reserve@Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* a csv line of len bytes was written at the end of the csv */
+void meta_index_add_line(META_INDEX * index,uint64 time,uint32 free_heap,uint32 len)
+{
+    META_INDEX_ENTRY * entry;
+
+    if (index->nums == 0 || index->block_lines == META_INDEX_INTERVAL) {
+
+        meta_index_reserve(index,1);
+
+        entry = &index->entries[index->nums];
+        entry->time          = time;
+        entry->min_time      = time;
+        entry->max_time      = time;
+        entry->latest_time   = index->nums == 0 ? time : MAX(time,index->entries[index->nums-1].latest_time);
+        entry->offset        = index->csv_size;
+        entry->line          = index->lines;
+        entry->free_heap     = free_heap;
+        entry->min_free_heap = free_heap;
+
+        index->nums++;
+        index->block_lines = 0;
+
+    } else {
+
+        entry = &index->entries[index->nums-1];
+        entry->min_time      = MIN(time,entry->min_time);
+        entry->max_time      = MAX(time,entry->max_time);
+        entry->latest_time   = MAX(time,entry->latest_time);
+        entry->min_free_heap = MIN(free_heap,entry->min_free_heap);
+    }
+
+    index->block_lines++;
+    index->lines++;
+    index->csv_size += len;
+}
+
+/* the lines of the next meta file start a new entry, even if the last entry is not full */
+void meta_index_next_file(META_INDEX * index)
+{
+    index->block_lines = META_INDEX_INTERVAL;
+}
+
+/* the lines of src were written after the lines of dst, src starts a new entry */
+void meta_index_append(META_INDEX * dst,const META_INDEX * src)
+{
+    META_INDEX_ENTRY * entry;
+    uint64 latest_time;
+    uint32 i;
+
+    meta_index_reserve(dst,src->nums);
+
+    latest_time = dst->nums == 0 ? 0 : dst->entries[dst->nums-1].latest_time;
+
+    for (i = 0; i < src->nums; i++) {
+        entry  = &dst->entries[dst->nums++];
+        *entry = src->entries[i];
+
+        entry->offset     += dst->csv_size;
+        entry->line       += dst->lines;
+        entry->latest_time = MAX(entry->latest_time,latest_time);
+    }
+
+    if (src->nums > 0) {
+        dst->block_lines = src->block_lines;
+    }
+
+    dst->csv_size += src->csv_size;
+    dst->lines    += src->lines;
+}
+
+/* drop the lines from line number lines on, entries never cross meta files so nothing is cut in half
+   as long as lines is where a meta file started
+ */
+void meta_index_truncate(META_INDEX * index,uint64 lines,uint64 csv_size)
+{
+    while (index->nums > 0 && index->entries[index->nums-1].line >= lines) {
+        index->nums--;
+    }
+
+    index->block_lines = 0;
+    index->lines       = lines;
+    index->csv_size    = csv_size;
+}
+
+uint8 meta_index_save(const META_INDEX * index,const char * index_path)
+{
+    META_INDEX_HEADER mih;
+    FILE * fd_index;
+    uint8  bret;
+
+    if ((fd_index = fopen(index_path,"wb")) == 0) {
+        fprintf(stderr,"meta_index_save@Create %s failed\n",index_path);
+        return FALSE;
+    }
+
+    memset(&mih,0x0,sizeof(META_INDEX_HEADER));
+    mih.magic      = META_INDEX_MAGIC;
+    mih.version    = META_INDEX_VERSION;
+    mih.entry_size = sizeof(META_INDEX_ENTRY);
+    mih.interval   = META_INDEX_INTERVAL;
+    mih.csv_size   = index->csv_size;
+    mih.lines      = index->lines;
+    mih.entries    = index->nums;
+
+    bret = fwrite(&mih,sizeof(META_INDEX_HEADER),1,fd_index) == 1 &&
+           fwrite(index->entries,sizeof(META_INDEX_ENTRY),index->nums,fd_index) == index->nums;
+
+    if (fclose(fd_index) != 0 || !bret) {
+        fprintf(stderr,"meta_index_save@Write %s failed\n",index_path);
+        unlink(index_path);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/* FALSE if there is no index for the csv as it is now, the caller falls back to reading the whole csv */
+uint8 meta_index_load(META_INDEX * index,const char * index_path,const char * csv_path)
+{
+    META_INDEX_HEADER mih;
+    struct stat stbuf;
+    FILE * fd_index;
+
+    meta_index_init(index);
+
+    if (stat(csv_path,&stbuf) != 0 || (fd_index = fopen(index_path,"rb")) == 0) {
+        return FALSE;
+    }
+
+    if (fread(&mih,sizeof(META_INDEX_HEADER),1,fd_index) != 1 ||
+        mih.magic != META_INDEX_MAGIC || mih.version != META_INDEX_VERSION ||
+        mih.entry_size != sizeof(META_INDEX_ENTRY) || mih.csv_size != (uint64)stbuf.st_size ||
+        mih.entries > mih.lines) {
+        fclose(fd_index);
+        return FALSE;
+    }
+
+    meta_index_reserve(index,mih.entries);
+
+    if (fread(index->entries,sizeof(META_INDEX_ENTRY),mih.entries,fd_index) != mih.entries) {
+        fclose(fd_index);
+        meta_index_free(index);
+        return FALSE;
+    }
+
+    fclose(fd_index);
+
+    index->nums     = mih.entries;
+    index->csv_size = mih.csv_size;
+    index->lines    = mih.lines;
+
+    return TRUE;
+}
+
+/* the first entry that can hold a line at or after time, index->nums if there is none.
+   All lines before it are earlier than time
+ */
+uint32 meta_index_find(const META_INDEX * index,uint64 time)
+{
+    uint32 low  = 0;
+    uint32 high = index->nums;
+    uint32 mid;
+
+    while (low < high) {
+        mid = low + (high - low) / 2;
+        if (index->entries[mid].latest_time < time) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    return low;
+}
+
+uint64 meta_index_entry_lines(const META_INDEX * index,uint32 i)
+{
+    return (i + 1 < index->nums ? index->entries[i+1].line : index->lines) - index->entries[i].line;
+}
+
+void size_class_series_init(SIZE_CLASS_SERIES * series)
+{
+    memset(series,0x0,sizeof(SIZE_CLASS_SERIES));
+}
+
+void size_class_series_free(SIZE_CLASS_SERIES * series)
+{
+    free(series->rows);
+    size_class_series_init(series);
+}
+
+static SIZE_CLASS_ROW * size_class_series_insert(SIZE_CLASS_SERIES * series,uint32 pos,uint64 bucket)
+{
+    if (series->nums == series->capacity) {
+        series->capacity = (series->capacity == 0 ? 64 : series->capacity * 2);
+        series->rows     = realloc(series->rows,series->capacity * sizeof(SIZE_CLASS_ROW));
+        if (series->rows == NULL) {
+            fprintf(stderr,"size_class_series_insert@Out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    memmove(&series->rows[pos+1],&series->rows[pos],(series->nums - pos) * sizeof(SIZE_CLASS_ROW));
+    memset(&series->rows[pos],0x0,sizeof(SIZE_CLASS_ROW));
+
+    series->rows[pos].bucket = bucket;
+    series->nums++;
+
+    return &series->rows[pos];
+}
+
+/* a new row at the end */
+SIZE_CLASS_ROW * size_class_series_append(SIZE_CLASS_SERIES * series,uint64 bucket)
+{
+    return size_class_series_insert(series,series->nums,bucket);
+}
+
+/* the rows of a meta file come after the meta files merged so far */
+void size_class_series_merge(SIZE_CLASS_SERIES * dst,const SIZE_CLASS_SERIES * src)
+{
+    const SIZE_CLASS_ROW * row;
+    SIZE_CLASS_ROW * to;
+    uint32 i,c,low,high,mid;
+
+    for (c = 0; c < SIZE_CLASS_NUMS; c++) {
+        dst->running[c] += src->lead_bytes[c];
+    }
+
+    for (i = 0; i < src->nums; i++) {
+
+        row = &src->rows[i];
+
+        if (dst->nums == 0 || dst->rows[dst->nums-1].bucket < row->bucket) {
+            to = size_class_series_append(dst,row->bucket);
+        } else {
+            /* the csv went back in time to another capture */
+            low  = 0;
+            high = dst->nums;
+            while (low < high) {
+                mid = low + (high - low) / 2;
+                if (dst->rows[mid].bucket < row->bucket) {
+                    low = mid + 1;
+                } else {
+                    high = mid;
+                }
+            }
+
+            to = (low < dst->nums && dst->rows[low].bucket == row->bucket) ? &dst->rows[low] : size_class_series_insert(dst,low,row->bucket);
+        }
+
+        for (c = 0; c < SIZE_CLASS_NUMS; c++) {
+            dst->running[c]     += row->live_bytes[c];
+            to->allocations[c]  += row->allocations[c];
+            to->live_bytes[c]    = dst->running[c];
+        }
+    }
+}
+
+/* a matrix for heatmaps: a row for each bucket with csv lines, the time of the bucket,
+   then the allocations and the live bytes of each size class up to the largest one used
+ */
+uint8 size_class_series_save(const SIZE_CLASS_SERIES * series,uint64 width,const char * path)
+{
+    FILE * fd_out;
+    char   time_text[64];
+    uint32 i,c,classes = 1;
+
+    if ((fd_out = fopen(path,"w")) == 0) {
+        fprintf(stderr,"size_class_series_save@Create %s failed\n",path);
+        return FALSE;
+    }
+
+    for (i = 0; i < series->nums; i++) {
+        for (c = classes; c < SIZE_CLASS_NUMS; c++) {
+            if (series->rows[i].allocations[c] != 0 || series->rows[i].live_bytes[c] != 0) {
+                classes = c + 1;
+            }
+        }
+    }
+
+    fprintf(fd_out,"time");
+    for (c = 0; c < classes; c++) {
+        fprintf(fd_out,",allocations_%u",c == 0 ? 0 : 1U << c);
+    }
+    for (c = 0; c < classes; c++) {
+        fprintf(fd_out,",live_bytes_%u",c == 0 ? 0 : 1U << c);
+    }
+    fprintf(fd_out,"\n");
+
+    for (i = 0; i < series->nums; i++) {
+
+        format_csv_time(series->rows[i].bucket * width,time_text);
+        fprintf(fd_out,"%s",time_text);
+
+        for (c = 0; c < classes; c++) {
+            fprintf(fd_out,",%llu",series->rows[i].allocations[c]);
+        }
+        for (c = 0; c < classes; c++) {
+            fprintf(fd_out,",%lld",series->rows[i].live_bytes[c]);
+        }
+        fprintf(fd_out,"\n");
+    }
+
+    if (fclose(fd_out) != 0) {
+        fprintf(stderr,"size_class_series_save@Write %s failed\n",path);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+void heap_report_init(HEAP_REPORT * report)
+{
+    memset(report,0x0,sizeof(HEAP_REPORT));
+    report->min_free_heap = MAX_THEORY_HEAP_SIZE;
+}
+
+void heap_report_free(HEAP_REPORT * report)
+{
+    free(report->intervals);
+    heap_report_init(report);
+}
+
+/* the interval of a csv time, the intervals grow both ways because a csv of several captures goes back in time */
+static HEAP_REPORT_INTERVAL * heap_report_interval(HEAP_REPORT * report,uint64 time)
+{
+    uint64 interval = time / (HEAP_REPORT_INTERVAL_MINUTES * 60 * TIME_UNIT);
+    uint64 first,last;
+    HEAP_REPORT_INTERVAL * intervals;
+
+    if (report->interval_nums > 0 && interval >= report->first_interval &&
+        interval < report->first_interval + report->interval_nums) {
+        return &report->intervals[interval - report->first_interval];
+    }
+
+    first = report->interval_nums == 0 ? interval : MIN(interval,report->first_interval);
+    last  = report->interval_nums == 0 ? interval : MAX(interval,report->first_interval + report->interval_nums - 1);
+
+    intervals = calloc(last - first + 1,sizeof(HEAP_REPORT_INTERVAL));
+    if (intervals == NULL) {
+        fprintf(stderr,"heap_report_interval@Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (report->interval_nums > 0) {
+        memcpy(&intervals[report->first_interval - first],report->intervals,report->interval_nums * sizeof(HEAP_REPORT_INTERVAL));
+    }
+
+    free(report->intervals);
+    report->intervals      = intervals;
+    report->first_interval = first;
+    report->interval_nums  = last - first + 1;
+
+    return &report->intervals[interval - first];
+}
+
+/* an allocation or deallocation that made a csv line */
+void heap_report_add(HEAP_REPORT * report,uint64 time,const META_RECORD * record,uint32 free_heap,uint32 live_blocks)
+{
+    uint32 type;
+
+    if (report->allocations + report->deallocations == 0) {
+        report->first_time    = time;
+        report->max_free_heap = free_heap;
+        report->max_free_heap_time = time;
+    }
+    report->last_time = time;
+
+    if (free_heap < report->min_free_heap) {
+        report->min_free_heap      = free_heap;
+        report->min_free_heap_time = time;
+    }
+
+    if (free_heap > report->max_free_heap) {
+        report->max_free_heap      = free_heap;
+        report->max_free_heap_time = time;
+    }
+
+    if (live_blocks > report->peak_live_blocks) {
+        report->peak_live_blocks      = live_blocks;
+        report->peak_live_blocks_time = time;
+    }
+
+    if (record->type == TYPE_DEALLOCATE) {
+        report->deallocations++;
+        heap_report_interval(report,time)->deallocations++;
+        return;
+    }
+
+    report->allocations++;
+    heap_report_interval(report,time)->allocations++;
+
+    type = record->allocation_type < AT_NUMS ? record->allocation_type : 0;
+    report->type_allocations[type]++;
+    report->type_bytes[type] += record->size;
+
+    if (record->size > report->largest.size) {
+        report->largest      = *record;
+        report->largest_time = time;
+    }
+}
+
+/* src comes after dst in the replay */
+void heap_report_merge(HEAP_REPORT * dst,const HEAP_REPORT * src)
+{
+    HEAP_REPORT_INTERVAL * interval;
+    uint32 i;
+
+    dst->meta_files += src->meta_files;
+
+    if (src->allocations + src->deallocations == 0) {
+        return;
+    }
+
+    if (dst->allocations + dst->deallocations == 0) {
+        dst->first_time         = src->first_time;
+        dst->max_free_heap      = src->max_free_heap;
+        dst->max_free_heap_time = src->max_free_heap_time;
+    }
+    dst->last_time = src->last_time;
+
+    if (src->min_free_heap < dst->min_free_heap) {
+        dst->min_free_heap      = src->min_free_heap;
+        dst->min_free_heap_time = src->min_free_heap_time;
+    }
+
+    if (src->max_free_heap > dst->max_free_heap) {
+        dst->max_free_heap      = src->max_free_heap;
+        dst->max_free_heap_time = src->max_free_heap_time;
+    }
+
+    if (src->peak_live_blocks > dst->peak_live_blocks) {
+        dst->peak_live_blocks      = src->peak_live_blocks;
+        dst->peak_live_blocks_time = src->peak_live_blocks_time;
+    }
+
+    if (src->largest.size > dst->largest.size) {
+        dst->largest      = src->largest;
+        dst->largest_time = src->largest_time;
+    }
+
+    for (i = 0; i < AT_NUMS; i++) {
+        dst->type_allocations[i] += src->type_allocations[i];
+        dst->type_bytes[i]       += src->type_bytes[i];
+    }
+
+    for (i = 0; i < src->interval_nums; i++) {
+        if (src->intervals[i].allocations + src->intervals[i].deallocations == 0) {
+            continue;
+        }
+        interval = heap_report_interval(dst,(src->first_interval + i) * (HEAP_REPORT_INTERVAL_MINUTES * 60 * TIME_UNIT));
+        interval->allocations   += src->intervals[i].allocations;
+        interval->deallocations += src->intervals[i].deallocations;
+    }
+
+    dst->allocations   += src->allocations;
+    dst->deallocations += src->deallocations;
+}
+
+/* chunk walk: trace items are found in offset order */
+void blx_chunk_add_item(BLX_CHUNK * chunk,uint64 offset,uint64 next,uint32 first_record)
+{
+    if (chunk->item_nums == chunk->item_capacity) {
+        chunk->item_capacity = (chunk->item_capacity == 0 ? 4096 : chunk->item_capacity * 2);
+        chunk->items         = realloc(chunk->items,chunk->item_capacity * sizeof(BLX_TRACE_ITEM));
+        if (chunk->items == NULL) {
+            fprintf(stderr,"blx_chunk_add_item@Out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    chunk->items[chunk->item_nums].offset       = offset;
+    chunk->items[chunk->item_nums].next         = next;
+    chunk->items[chunk->item_nums].first_record = first_record;
+    chunk->item_nums++;
+}
+
+/* index of the last trace item at or before offset, 0 if there is none */
+uint32 blx_chunk_find_item(const BLX_CHUNK * chunk,uint64 offset)
+{
+    uint32 low  = 0;
+    uint32 high = chunk->item_nums;
+    uint32 mid;
+
+    while (high - low > 1) {
+        mid = low + (high - low) / 2;
+        if (chunk->items[mid].offset <= offset) {
+            low = mid;
+        } else {
+            high = mid;
+        }
+    }
+
+    return low;
+}
+
+/* did the chunk walk probe offset? It probes every offset from its beginning,
+   except the ones inside a trace item it jumped over
+ */
+uint8 blx_chunk_probed(const BLX_CHUNK * chunk,uint64 offset)
+{
+    const BLX_TRACE_ITEM * item;
+
+    if (offset < chunk->begin || offset >= chunk->final) {
+        return FALSE;
+    }
+
+    if (chunk->item_nums == 0) {
+        return TRUE;
+    }
+
+    item = &chunk->items[blx_chunk_find_item(chunk,offset)];
+
+    return (item->offset > offset || item->offset == offset || offset >= item->next) ? TRUE : FALSE;
+}
+
+/* trace header signature scanner: first offset >= pos where a STANDARD_MTBF_TRACE_HEADER of the
+   MTBF trace starts, returns size if there is none. The SIMD flavours test 16/32 offsets per step,
+   the scalar one finishes the tail. Selected once at runtime, see scan_trace_header_select
+ */
+#define IS_TRACE_HEADER(p) (((p)[0] == MEDIA_TYPE_TCPIP || (p)[0] == MEDIA_TYPE_USB) && \
+                            (p)[1] == RECEIVER_DEVICE_PC   && \
+                            (p)[2] == SEND_DEVICE_TRACEBOX && \
+                            (p)[3] == RESOURCE_TRACEBOX)
+
+typedef uint64 (*scan_trace_header_fn)(const uint8 * buf,uint64 pos,uint64 last);
+
+static uint64 scan_trace_header_scalar(const uint8 * buf,uint64 pos,uint64 last)
+{
+    for (; pos < last; pos++) {
+        if (IS_TRACE_HEADER(buf + pos)) {
+            return pos;
+        }
+    }
+
+    return last;
+}
+
+#ifdef HAS_X86_SIMD
+__attribute__((target("sse2")))
+static uint64 scan_trace_header_sse2(const uint8 * buf,uint64 pos,uint64 last)
+{
+    const __m128i tcpip    = _mm_set1_epi8(MEDIA_TYPE_TCPIP);
+    const __m128i usb      = _mm_set1_epi8(MEDIA_TYPE_USB);
+    const __m128i receiver = _mm_set1_epi8(RECEIVER_DEVICE_PC);
+    const __m128i sender   = _mm_set1_epi8(SEND_DEVICE_TRACEBOX);
+    const __m128i resource = _mm_set1_epi8(RESOURCE_TRACEBOX);
+
+    __m128i b0,b1,b2,b3,hit;
+    uint32  mask;
+
+    /* offsets up to last are valid header starts, so reading 3 bytes past pos+15 is in range */
+    for (; pos + 16 <= last; pos += 16) {
+        b0 = _mm_loadu_si128((const __m128i *)(buf + pos));
+        b1 = _mm_loadu_si128((const __m128i *)(buf + pos + 1));
+        b2 = _mm_loadu_si128((const __m128i *)(buf + pos + 2));
+        b3 = _mm_loadu_si128((const __m128i *)(buf + pos + 3));
+
+        hit = _mm_or_si128(_mm_cmpeq_epi8(b0,tcpip),_mm_cmpeq_epi8(b0,usb));
+        hit = _mm_and_si128(hit,_mm_cmpeq_epi8(b1,receiver));
+        hit = _mm_and_si128(hit,_mm_cmpeq_epi8(b2,sender));
+        hit = _mm_and_si128(hit,_mm_cmpeq_epi8(b3,resource));
+
+        mask = (uint32)_mm_movemask_epi8(hit);
+        if (mask != 0) {
+            return pos + __builtin_ctz(mask);
+        }
+    }
+
+    return scan_trace_header_scalar(buf,pos,last);
+}
+
+__attribute__((target("avx2")))
+static uint64 scan_trace_header_avx2(const uint8 * buf,uint64 pos,uint64 last)
+{
+    const __m256i tcpip    = _mm256_set1_epi8(MEDIA_TYPE_TCPIP);
+    const __m256i usb      = _mm256_set1_epi8(MEDIA_TYPE_USB);
+    const __m256i receiver = _mm256_set1_epi8(RECEIVER_DEVICE_PC);
+    const __m256i sender   = _mm256_set1_epi8(SEND_DEVICE_TRACEBOX);
+    const __m256i resource = _mm256_set1_epi8(RESOURCE_TRACEBOX);
+
+    __m256i b0,b1,b2,b3,hit;
+    uint32  mask;
+
+    for (; pos + 32 <= last; pos += 32) {
+        b0 = _mm256_loadu_si256((const __m256i *)(buf + pos));
+        b1 = _mm256_loadu_si256((const __m256i *)(buf + pos + 1));
+        b2 = _mm256_loadu_si256((const __m256i *)(buf + pos + 2));
+        b3 = _mm256_loadu_si256((const __m256i *)(buf + pos + 3));
+
+        hit = _mm256_or_si256(_mm256_cmpeq_epi8(b0,tcpip),_mm256_cmpeq_epi8(b0,usb));
+        hit = _mm256_and_si256(hit,_mm256_cmpeq_epi8(b1,receiver));
+        hit = _mm256_and_si256(hit,_mm256_cmpeq_epi8(b2,sender));
+        hit = _mm256_and_si256(hit,_mm256_cmpeq_epi8(b3,resource));
+
+        mask = (uint32)_mm256_movemask_epi8(hit);
+        if (mask != 0) {
+            return pos + __builtin_ctz(mask);
+        }
+    }
+
+    return scan_trace_header_sse2(buf,pos,last);
+}
+#endif
+
+static scan_trace_header_fn scan_trace_header_impl = scan_trace_header_scalar;
+static pthread_once_t       scan_trace_header_once = PTHREAD_ONCE_INIT;
+
+static void scan_trace_header_select(void)
+{
+#ifdef HAS_X86_SIMD
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2")) {
+        scan_trace_header_impl = scan_trace_header_avx2;
+    } else if (__builtin_cpu_supports("sse2")) {
+        scan_trace_header_impl = scan_trace_header_sse2;
+    }
+#endif
+}
+
+/* run one flavour from now on instead of the one picked for this cpu, FALSE if this cpu can't run it */
+uint8 scan_trace_header_force(uint32 flavour)
+{
+    pthread_once(&scan_trace_header_once,scan_trace_header_select);
+
+    switch (flavour)
+    {
+        case SCAN_FLAVOUR_SCALAR:
+            scan_trace_header_impl = scan_trace_header_scalar;
+            return TRUE;
+
+#ifdef HAS_X86_SIMD
+        case SCAN_FLAVOUR_SSE2:
+            if (__builtin_cpu_supports("sse2")) {
+                scan_trace_header_impl = scan_trace_header_sse2;
+                return TRUE;
+            }
+            break;
+
+        case SCAN_FLAVOUR_AVX2:
+            if (__builtin_cpu_supports("avx2")) {
+                scan_trace_header_impl = scan_trace_header_avx2;
+                return TRUE;
+            }
+            break;
+#endif
+
+        default:
+            break;
+    }
+
+    return FALSE;
+}
+
+uint64 scan_trace_header(const uint8 * buf,uint64 pos,uint64 size)
+{
+    uint64 last;
+
+    if (size < sizeof(STANDARD_MTBF_TRACE_HEADER) || pos > size - sizeof(STANDARD_MTBF_TRACE_HEADER)) {
+        return size;
+    }
+
+    /* one past the last offset a whole header still fits at */
+    last = size - sizeof(STANDARD_MTBF_TRACE_HEADER) + 1;
+
+    pthread_once(&scan_trace_header_once,scan_trace_header_select);
+
+    pos = scan_trace_header_impl(buf,pos,last);
+
+    return (pos == last ? size : pos);
+}
+
+/* heap allocation info table: fibonacci hashing, block addresses are aligned so the low bits are poor */
+static uint32 halloc_info_table_hash(uint32 addr, uint32 bits)
+{
+    return (uint32)(addr * 2654435769U) >> (32 - bits);
+}
+
+static void halloc_info_table_resize(HEAP_LIVE_TABLE * table, uint32 bits)
+{
+    HEAP_LIVE_NODE * old_slots = table->slots;
+    uint32 old_cap = (old_slots == NULL ? 0 : 1U << table->bits);
+    uint32 mask = (1U << bits) - 1;
+    uint32 i,pos;
+
+    table->slots = calloc(1U << bits, sizeof(HEAP_LIVE_NODE));
+    if (table->slots == NULL) {
+        fprintf(stderr,"halloc_info_table_resize@Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    table->bits = bits;
+
+    for (i = 0; i < old_cap; i++) {
+        if (!old_slots[i].used) {
+            continue;
+        }
+
+        pos = halloc_info_table_hash(old_slots[i].addr,bits);
+        while (table->slots[pos].used) {
+            pos = (pos + 1) & mask;
+        }
+
+        table->slots[pos] = old_slots[i];
+    }
+
+    free(old_slots);
+}
+
+static uint32 halloc_info_table_shadow_alloc(HEAP_LIVE_TABLE * table)
+{
+    uint32 index;
+
+    if (table->shadow_free != 0) {
+        index = table->shadow_free;
+        table->shadow_free = table->shadows[index-1].next;
+        return index;
+    }
+
+    if (table->shadow_top == table->shadow_cap) {
+        table->shadow_cap = (table->shadow_cap == 0 ? 1024 : table->shadow_cap * 2);
+        table->shadows    = realloc(table->shadows,table->shadow_cap * sizeof(HEAP_SHADOW_NODE));
+        if (table->shadows == NULL) {
+            fprintf(stderr,"halloc_info_table_shadow_alloc@Out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    return ++table->shadow_top;
+}
+
+void halloc_info_table_free(HEAP_LIVE_TABLE * table)
+{
+    free(table->slots);
+    free(table->shadows);
+
+    memset(table,0x0,sizeof(HEAP_LIVE_TABLE));
+
+    return;
+}
+
+/* heap allocation info table: remove the latest allocation at addr.
+   Returns FALSE if there is none, so a free of an unknown block is told from a free of a 0 bytes block
+ */
+uint8 halloc_info_table_remove(HEAP_LIVE_TABLE * table, uint32 addr, uint32 * size)
+{
+    uint32 caller;
+
+    return halloc_info_table_remove_caller(table,addr,size,&caller);
+}
+
+/* same as halloc_info_table_remove, caller gets the caller the block was added with */
+uint8 halloc_info_table_remove_caller(HEAP_LIVE_TABLE * table, uint32 addr, uint32 * size, uint32 * caller)
+{
+    HEAP_LIVE_NODE * slots = table->slots;
+    uint32 mask,pos,next,home,shadow;
+
+    *size   = 0;
+    *caller = 0;
+
+    if (slots == NULL) {
+        return FALSE;
+    }
+
+    mask = (1U << table->bits) - 1;
+    pos  = halloc_info_table_hash(addr,table->bits);
+
+    while (slots[pos].used && slots[pos].addr != addr) {
+        pos = (pos + 1) & mask;
+    }
+
+    if (!slots[pos].used) {
+        return FALSE;
+    }
+
+    *size   = slots[pos].size;
+    *caller = slots[pos].caller;
+    table->live_blocks--;
+
+    /* an older allocation at the same address becomes visible again */
+    if (slots[pos].shadow != 0) {
+        shadow = slots[pos].shadow;
+        slots[pos].size   = table->shadows[shadow-1].size;
+        slots[pos].caller = table->shadows[shadow-1].caller;
+        slots[pos].shadow = table->shadows[shadow-1].next;
+
+        table->shadows[shadow-1].next = table->shadow_free;
+        table->shadow_free = shadow;
+        return TRUE;
+    }
+
+    /* backward shift deletion, so no tombstones pile up on long traces */
+    next = pos;
+    while (1) {
+        next = (next + 1) & mask;
+        if (!slots[next].used) {
+            break;
+        }
+
+        home = halloc_info_table_hash(slots[next].addr,table->bits);
+        if (((next - home) & mask) < ((next - pos) & mask)) {
+            continue;   /* still reachable from its home slot */
+        }
+
+        slots[pos] = slots[next];
+        pos = next;
+    }
+
+    slots[pos].used = FALSE;
+    table->used_slots--;
+
+    return TRUE;
+}
+
+/* heap allocation info table: remove the latest allocation at addr and return its size */
+uint32 halloc_info_table_get_size(HEAP_LIVE_TABLE * table, uint32 addr)
+{
+    uint32 size;
+
+    if (!halloc_info_table_remove(table,addr,&size)) {
+#if ENABLE_TRACE_INFO == TRUE
+        printf("Warning:No allocation found for 0x%X\n",addr);
+#endif
+    }
+
+    return size;
+}
+
+/* heap allocation info table
+   when alloca heap, add address and size into the table. when dealloc, caller needs to know
+   the heap size of the deallocation request
+
+   see HEAP_LIVE_TABLE
+ */
+void halloc_info_table_add(HEAP_LIVE_TABLE * table, uint32 addr,uint32 size)
+{
+    halloc_info_table_add_caller(table,addr,size,0);
+}
+
+/* same as halloc_info_table_add, the caller(see HEAP_CALLER_TABLE) is kept with the block */
+void halloc_info_table_add_caller(HEAP_LIVE_TABLE * table, uint32 addr,uint32 size,uint32 caller)
+{
+    HEAP_LIVE_NODE * slot;
+    uint32 mask,pos,shadow;
+
+    if (table->slots == NULL) {
+        halloc_info_table_resize(table,HEAP_TABLE_INIT_BITS);
+    } else if (table->used_slots >= HEAP_TABLE_MAX_LOAD(1U << table->bits)) {
+        halloc_info_table_resize(table,table->bits + 1);
+    }
+
+    mask = (1U << table->bits) - 1;
+    pos  = halloc_info_table_hash(addr,table->bits);
+
+    while (table->slots[pos].used && table->slots[pos].addr != addr) {
+        pos = (pos + 1) & mask;
+    }
+
+    slot = &table->slots[pos];
+    table->live_blocks++;
+
+    if (slot->used) {
+        /* the address is still live, keep the older size behind the new one */
+        shadow = halloc_info_table_shadow_alloc(table);
+        table->shadows[shadow-1].size   = slot->size;
+        table->shadows[shadow-1].caller = slot->caller;
+        table->shadows[shadow-1].next   = slot->shadow;
+
+        slot->size   = size;
+        slot->caller = caller;
+        slot->shadow = shadow;
+        return;
+    }
+
+    slot->addr   = addr;
+    slot->size   = size;
+    slot->caller = caller;
+    slot->shadow = 0;
+    slot->used   = TRUE;
+    table->used_slots++;
+
+    return;
+}
+
+/* put the live blocks of src on top of dst, as if src's allocations happened after dst's */
+void halloc_info_table_merge(HEAP_LIVE_TABLE * dst, const HEAP_LIVE_TABLE * src)
+{
+    uint32 cap = (src->slots == NULL ? 0 : 1U << src->bits);
+    uint32 i,depth,shadow;
+    uint32 * chain = NULL;
+    uint32   chain_cap = 0;
+
+    for (i = 0; i < cap; i++) {
+
+        if (!src->slots[i].used) {
+            continue;
+        }
+
+        if (src->slots[i].shadow == 0) {
+            halloc_info_table_add_caller(dst,src->slots[i].addr,src->slots[i].size,src->slots[i].caller);
+            continue;
+        }
+
+        /* the shadow chain goes from newest to oldest, add the oldest first */
+        depth = 0;
+        for (shadow = src->slots[i].shadow; shadow != 0; shadow = src->shadows[shadow-1].next) {
+            if (depth == chain_cap) {
+                chain_cap = (chain_cap == 0 ? 64 : chain_cap * 2);
+                chain     = realloc(chain,chain_cap * sizeof(uint32));
+                if (chain == NULL) {
+                    fprintf(stderr,"halloc_info_table_merge@Out of memory\n");
+                    exit(EXIT_FAILURE);
+                }
+            }
+            chain[depth++] = shadow;
+        }
+
+        while (depth != 0) {
+            shadow = chain[--depth];
+            halloc_info_table_add_caller(dst,src->slots[i].addr,src->shadows[shadow-1].size,src->shadows[shadow-1].caller);
+        }
+
+        halloc_info_table_add_caller(dst,src->slots[i].addr,src->slots[i].size,src->slots[i].caller);
+    }
+
+    free(chain);
+}
+
+/* the table as a HEAP_LIVE_TABLE_HEADER, the slots and the used part of the shadow pool */
+uint8 halloc_info_table_write(const HEAP_LIVE_TABLE * table,FILE * fd_out)
+{
+    HEAP_LIVE_TABLE_HEADER header;
+    uint32 cap;
+
+    memset(&header,0x0,sizeof(HEAP_LIVE_TABLE_HEADER));
+    header.bits        = table->bits;
+    header.used_slots  = table->used_slots;
+    header.live_blocks = table->live_blocks;
+    header.shadow_top  = table->shadow_top;
+    header.shadow_free = table->shadow_free;
+    header.empty       = (table->slots == NULL);
+
+    cap = (header.empty ? 0 : 1U << table->bits);
+
+    /* slots and shadows are NULL until they are first needed, fwrite must not get them then */
+    return fwrite(&header,sizeof(HEAP_LIVE_TABLE_HEADER),1,fd_out) == 1 &&
+           (cap == 0 || fwrite(table->slots,sizeof(HEAP_LIVE_NODE),cap,fd_out) == cap) &&
+           (table->shadow_top == 0 ||
+            fwrite(table->shadows,sizeof(HEAP_SHADOW_NODE),table->shadow_top,fd_out) == table->shadow_top);
+}
+
+/* FALSE if the table can not be read, it is left empty then.
+   The table is the rest of the file, a header that does not fit the bytes left(a damaged or foreign file)
+   is turned down before anything is allocated for it
+ */
+uint8 halloc_info_table_read(HEAP_LIVE_TABLE * table,FILE * fd_in)
+{
+    HEAP_LIVE_TABLE_HEADER header;
+    struct stat stbuf;
+    uint32 cap;
+    long   pos;
+
+    memset(table,0x0,sizeof(HEAP_LIVE_TABLE));
+
+    if (fread(&header,sizeof(HEAP_LIVE_TABLE_HEADER),1,fd_in) != 1 || header.empty > 1 ||
+        header.shadow_free > header.shadow_top || header.used_slots > header.live_blocks) {
+        return FALSE;
+    }
+
+    if (header.empty) {
+        if (header.bits != 0 || header.live_blocks != 0 || header.shadow_top != 0) {
+            return FALSE;
+        }
+        cap = 0;
+    } else {
+        /* the table starts at HEAP_TABLE_INIT_BITS and grows once the load gets to HEAP_TABLE_MAX_LOAD */
+        if (header.bits < HEAP_TABLE_INIT_BITS || header.bits >= 32) {
+            return FALSE;
+        }
+        cap = 1U << header.bits;
+        if (header.used_slots > HEAP_TABLE_MAX_LOAD(cap)) {
+            return FALSE;
+        }
+    }
+
+    if (fstat(fileno(fd_in),&stbuf) != 0 || (pos = ftell(fd_in)) < 0 ||
+        (uint64)stbuf.st_size - pos != (uint64)cap * sizeof(HEAP_LIVE_NODE) + (uint64)header.shadow_top * sizeof(HEAP_SHADOW_NODE)) {
+        return FALSE;
+    }
+
+    table->slots   = (cap == 0 ? NULL : malloc(cap * sizeof(HEAP_LIVE_NODE)));
+    table->shadows = (header.shadow_top == 0 ? NULL : malloc(header.shadow_top * sizeof(HEAP_SHADOW_NODE)));
+    if ((cap != 0 && table->slots == NULL) || (header.shadow_top != 0 && table->shadows == NULL)) {
+        fprintf(stderr,"halloc_info_table_read@Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if ((cap != 0 && fread(table->slots,sizeof(HEAP_LIVE_NODE),cap,fd_in) != cap) ||
+        (header.shadow_top != 0 && fread(table->shadows,sizeof(HEAP_SHADOW_NODE),header.shadow_top,fd_in) != header.shadow_top)) {
+        halloc_info_table_free(table);
+        return FALSE;
+    }
+
+    table->bits        = header.bits;
+    table->used_slots  = header.used_slots;
+    table->live_blocks = header.live_blocks;
+    table->shadow_cap  = header.shadow_top;
+    table->shadow_top  = header.shadow_top;
+    table->shadow_free = header.shadow_free;
+
+    return TRUE;
+}
+
+/* caller table: fibonacci hashing of the caller pair */
+static uint32 heap_caller_table_hash(uint32 caller1, uint32 caller2, uint32 bits)
+{
+    return (uint32)((((uint64)caller1 << 32 | caller2) * 0x9E3779B97F4A7C15ULL) >> (64 - bits));
+}
+
+static void heap_caller_table_resize(HEAP_CALLER_TABLE * table, uint32 bits)
+{
+    uint32 mask = (1U << bits) - 1;
+    uint32 i,pos;
+
+    free(table->slots);
+
+    table->slots = calloc(1U << bits, sizeof(uint32));
+    if (table->slots == NULL) {
+        fprintf(stderr,"heap_caller_table_resize@Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    table->bits = bits;
+
+    for (i = 1; i <= table->nums; i++) {
+        pos = heap_caller_table_hash(table->callers[i].caller1,table->callers[i].caller2,bits);
+        while (table->slots[pos] != 0) {
+            pos = (pos + 1) & mask;
+        }
+        table->slots[pos] = i;
+    }
+}
+
+void heap_caller_table_free(HEAP_CALLER_TABLE * table)
+{
+    free(table->callers);
+    free(table->slots);
+    free(table->saved);
+
+    memset(table,0x0,sizeof(HEAP_CALLER_TABLE));
+}
+
+/* the caller of a caller pair, a new one starts with nothing live */
+uint32 heap_caller_table_id(HEAP_CALLER_TABLE * table, uint32 caller1, uint32 caller2)
+{
+    HEAP_CALLER * caller;
+    uint32 mask,pos;
+
+    if (table->slots == NULL) {
+        heap_caller_table_resize(table,10);
+        table->epoch = 1;
+    } else if (table->nums >= HEAP_TABLE_MAX_LOAD(1U << table->bits)) {
+        heap_caller_table_resize(table,table->bits + 1);
+    }
+
+    mask = (1U << table->bits) - 1;
+    pos  = heap_caller_table_hash(caller1,caller2,table->bits);
+
+    while (table->slots[pos] != 0) {
+        caller = &table->callers[table->slots[pos]];
+        if (caller->caller1 == caller1 && caller->caller2 == caller2) {
+            return table->slots[pos];
+        }
+        pos = (pos + 1) & mask;
+    }
+
+    if (table->nums + 1 >= table->capacity) {
+        table->capacity = (table->capacity == 0 ? 1024 : table->capacity * 2);
+        table->callers  = realloc(table->callers,table->capacity * sizeof(HEAP_CALLER));
+        if (table->callers == NULL) {
+            fprintf(stderr,"heap_caller_table_id@Out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    caller = &table->callers[++table->nums];
+    caller->caller1     = caller1;
+    caller->caller2     = caller2;
+    caller->live_bytes  = 0;
+    caller->live_blocks = 0;
+    caller->epoch       = 0;    /* older than any low water, it had nothing live at the last one */
+
+    table->slots[pos] = table->nums;
+
+    return table->nums;
+}
+
+void heap_caller_table_update(HEAP_CALLER_TABLE * table, uint32 caller, sint64 bytes, sint32 blocks)
+{
+    HEAP_CALLER       * hc = &table->callers[caller];
+    HEAP_CALLER_SAVED * saved;
+
+    if (hc->epoch != table->epoch) {
+
+        if (table->saved_nums == table->saved_capacity) {
+            table->saved_capacity = (table->saved_capacity == 0 ? 1024 : table->saved_capacity * 2);
+            table->saved          = realloc(table->saved,table->saved_capacity * sizeof(HEAP_CALLER_SAVED));
+            if (table->saved == NULL) {
+                fprintf(stderr,"heap_caller_table_update@Out of memory\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        saved = &table->saved[table->saved_nums++];
+        saved->caller      = caller;
+        saved->live_bytes  = hc->live_bytes;
+        saved->live_blocks = hc->live_blocks;
+
+        hc->epoch = table->epoch;
+    }
+
+    hc->live_bytes  += bytes;
+    hc->live_blocks += blocks;
+}
+
+/* the heap is at a new low water now */
+void heap_caller_table_mark(HEAP_CALLER_TABLE * table)
+{
+    table->epoch++;
+    table->saved_nums = 0;
+}
+
+/* a copy of the callers now or at the last low water, callers[0] is not used. Returns the number of callers */
+uint32 heap_caller_table_snapshot(const HEAP_CALLER_TABLE * table, uint8 bLowWater, HEAP_CALLER ** callers)
+{
+    const HEAP_CALLER_SAVED * saved;
+    uint32 i;
+
+    *callers = malloc((table->nums + 1) * sizeof(HEAP_CALLER));
+    if (*callers == NULL) {
+        fprintf(stderr,"heap_caller_table_snapshot@Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (table->nums > 0) {
+        memcpy(*callers,table->callers,(table->nums + 1) * sizeof(HEAP_CALLER));
+    }
+
+    for (i = 0; bLowWater && i < table->saved_nums; i++) {
+        saved = &table->saved[i];
+        (*callers)[saved->caller].live_bytes  = saved->live_bytes;
+        (*callers)[saved->caller].live_blocks = saved->live_blocks;
+    }
+
+    return table->nums;
+}
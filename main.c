@@ -29,6 +29,10 @@
 #include <sys/param.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
+#include <sys/syscall.h>
+#include <dirent.h>
+#include <fnmatch.h>
+#include <signal.h>
 
 #include "ma.h"
 #include "thread_pool.h"
@@ -37,747 +41,2925 @@
    global variables...
  **************************************************************************/
 TRACE_DATE           g_trace_date;
-BLX_FILE_LIST_NODE * g_bfln_header;
-HEAP_LINK_NODE     * g_heap_link;
+HEAP_LIVE_TABLE      g_heap_table;
+uint64               g_blx_chunk_size = BLX_CHUNK_SIZE;   /* see metadata_chunk_size */
 
 /************************************************************************** 
     functions...
  **************************************************************************/
 
-uint8 scan_single_meta_file(FILE * fd_rd, FILE * fd_wr, uint32 init_free_heap,uint8 bCheckHeapInit)
+/* hour bookkeeping of the replay, the day moves on when the trace passes midnight */
+void replay_advance_clock(REPLAY_STATE * rs, uint64 timestamp)
 {
-    META_FORMAT_UNIT * meta_unit;
-    uint32 hour,minute,second;
-    uint32 size;
+    uint32 hour,seconds;
 
-    char line_rd[MAX_SINGLE_METADATA_LEN] = {0};
-    char line_wr[MAX_SINGLE_METADATA_LEN] = {0};
-    char temp[3]; 
+    seconds = (timestamp / TIME_UNIT) % SECONDS_FOR_ONE_DAY;
+    hour    = seconds / 3600;
+
+    if (rs->last_hours == INVALID_HOUR) {
+        rs->last_hours = hour;
+    } else if (hour != rs->last_hours)  {
+        rs->last_hours++;
+    }
 
-    static uint32 last_hours       = INVALID_HOUR;
-    static uint8  find_begin_point = FALSE;
-    static uint32 free_heap        = 0;
+    // TODO:leap year
+    if (rs->last_hours > 24) {
+        rs->day++;
+        rs->last_hours = hour;
+    }
+}
 
-    uint32 addr;
+void replay_init_state(REPLAY_STATE * rs)
+{
+    rs->free_heap        = 0;
+    rs->last_hours       = INVALID_HOUR;
+    rs->day              = g_trace_date.day;
+    rs->find_begin_point = FALSE;
+}
 
-    if (free_heap == 0) {
-        free_heap = init_free_heap;
+/* every meta file starts from the initial free heap if the heap is used up(or nothing is replayed yet) */
+void replay_begin_file(REPLAY_STATE * rs, uint32 init_free_heap)
+{
+    if (rs->free_heap == 0) {
+        rs->free_heap = init_free_heap;
     }
+}
 
-    while (fgets(line_rd,MAX_SINGLE_METADATA_LEN, fd_rd) != 0) {
+/* format one csv line, returns its length */
+uint32 replay_format_line(char * line_wr, uint16 day, uint64 timestamp, uint32 free_heap)
+{
+    char time_stamp[32] = {0};
 
-        meta_unit = (META_FORMAT_UNIT *)line_rd;
+    format_timestamp(timestamp,time_stamp);
 
-        //meta_unit->skip6   = '\0';
-        meta_unit->mft.skip4 = '\0';
-        
-        temp[0] = meta_unit->mft.hour[0];temp[1] = meta_unit->mft.hour[1];temp[2]='\0';
-        hour   = strtouint32(temp);
-		
-        temp[0] = meta_unit->mft.minute[0];temp[1] = meta_unit->mft.minute[1];
-        minute = strtouint32(temp);
-		
-        temp[0] = meta_unit->mft.second[0];temp[1] = meta_unit->mft.second[1];
-        second = strtouint32(temp);
-
-        if (last_hours == INVALID_HOUR) {
-            last_hours = hour;
-        } else if (hour != last_hours)  {
-            last_hours++;
-        }
-
-        // TODO:leap year
-        if (last_hours > 24) {
-            g_trace_date.day++;
-            last_hours = hour;
-        }
-
-        size  = strtouint32(meta_unit->size);
-        addr  = (uint32)char_2_hex(meta_unit->address[0]) << 28   |
-                (uint32)char_2_hex(meta_unit->address[1]) << 24   |
-                (uint32)char_2_hex(meta_unit->address[2]) << 20   |
-                (uint32)char_2_hex(meta_unit->address[3]) << 16   |
-                (uint32)char_2_hex(meta_unit->address[4]) << 12   |
-                (uint32)char_2_hex(meta_unit->address[5]) << 8    |
-                (uint32)char_2_hex(meta_unit->address[6]) << 4    |
-                (uint32)char_2_hex(meta_unit->address[7]);
-
-        switch (meta_unit->type)
+    return sprintf(line_wr,"%02d/%02d/%04d %s, %08d\n",
+                   day,g_trace_date.month,g_trace_date.year,
+                   time_stamp,free_heap);
+}
+
+/* replay heap records in trace order and write a csv line for each allocation and deallocation */
+uint8 replay_meta_records(REPLAY_STATE * rs, const META_RECORD * records, uint32 nums, OUTPUT_WRITER * writer, META_INDEX * index, uint8 bCheckHeapInit)
+{
+    const META_RECORD * record;
+    uint32 i,len = 0;
+
+    char line_wr[MAX_SINGLE_METADATA_LEN] = {0};
+
+    for (i = 0; i < nums; i++) {
+
+        record = &records[i];
+
+        replay_advance_clock(rs,record->timestamp);
+
+        switch (record->type)
         {
             case TYPE_INIT:
-                  find_begin_point = TRUE;
+                  rs->find_begin_point = TRUE;
                   continue;
  
             case TYPE_ALLOCATE:
-                  halloc_info_linkedlst_add(addr,size);
-                  free_heap -= size;
-                  sprintf(line_wr,"%02d/%02d/%04d %02d:%02d:%02d.%9s, %08d\n",
-                          g_trace_date.day,g_trace_date.month,g_trace_date.year,
-                          hour,minute,second,meta_unit->mft.ms,free_heap);
+                  halloc_info_table_add(&g_heap_table,record->address,record->size);
+                  rs->free_heap -= record->size;
+                  len = replay_format_line(line_wr,rs->day,record->timestamp,rs->free_heap);
                   break;
 
             case TYPE_DEALLOCATE:
-                  free_heap += halloc_info_linkedlst_get_size(addr);
-                  sprintf(line_wr,"%02d/%02d/%04d %02d:%02d:%02d.%9s, %08d\n",
-                          g_trace_date.day,g_trace_date.month,g_trace_date.year,
-                          hour,minute,second,meta_unit->mft.ms,free_heap);
+                  rs->free_heap += halloc_info_table_get_size(&g_heap_table,record->address);
+                  len = replay_format_line(line_wr,rs->day,record->timestamp,rs->free_heap);
                   break;
 
             default:
                   assert(1);
         }
 
-        if (!bCheckHeapInit) {
-            fwrite(line_wr,strlen(line_wr),1,fd_wr);
-        } else if (find_begin_point) {
-            fwrite(line_wr,strlen(line_wr),1,fd_wr);
+        if (!bCheckHeapInit || rs->find_begin_point) {
+            output_writer_put(writer,line_wr,len);
+            meta_index_add_line(index,csv_time(rs->day,record->timestamp),rs->free_heap,len);
         }
     }
 
-    return find_begin_point;
+    return rs->find_begin_point;
 }
 
-uint8 build_csv(uint32 init_free_heap, uint8 bCheckHeapInit)
+void replay_job_set_stage(REPLAY_JOB * job, uint8 stage)
 {
-    uint8 bret = FALSE;
- 
-    FILE * fd_meta_list;
-    FILE * fd_csv;
-    FILE * fd_meta;
-    FILE * fd_date;
- 
-    uint16 len;
-
-    uint8  hasHeapInit = FALSE;
+    pthread_mutex_lock(&job->context->lock);
+    job->stage = stage;
+    pthread_cond_broadcast(&job->context->cond_stage);
+    pthread_mutex_unlock(&job->context->lock);
+}
 
-    struct timeval startTime;
-    struct timeval endTime;
+void replay_job_wait(REPLAY_JOB * job, uint8 stage)
+{
+    pthread_mutex_lock(&job->context->lock);
+    while (job->stage < stage) {
+        pthread_cond_wait(&job->context->cond_stage,&job->context->lock);
+    }
+    pthread_mutex_unlock(&job->context->lock);
+}
 
-    double wall_clock_counter = 0;
-    
-    char single_file_path[MAX_PATH_LEN] = {0};
+void replay_job_free(REPLAY_JOB * job)
+{
+    free(job->records);
+    free(job->deltas);
+    free(job->unresolved);
+    free(job->resolved_sizes);
+    free(job->resolved_found);
+    free(job->csv);
+    halloc_info_table_free(&job->survivors);
+    meta_index_free(&job->index);
+
+    if (job->report != NULL) {
+        heap_report_free(job->report);
+        free(job->report);
+    }
 
-    if ((fd_meta_list = fopen(META_FILE_LIST,"r")) == 0) {
-        fprintf(stderr,"build_csv@1@Read %s failed\n",META_FILE_LIST);
-        return bret;
+    if (job->size_classes != NULL) {
+        size_class_series_free(job->size_classes);
+        free(job->size_classes);
     }
 
-    system(REMOVE_DEFAULT_META_FILE);
-    if ((fd_csv = fopen(DEFAULT_META_FILE,"a")) == 0) {
-        fclose(fd_meta_list); 
-        fprintf(stderr,"Create %s failed\n",DEFAULT_META_FILE);
-        return bret;
+    job->records        = NULL;
+    job->deltas         = NULL;
+    job->unresolved     = NULL;
+    job->resolved_sizes = NULL;
+    job->resolved_found = NULL;
+    job->csv            = NULL;
+    job->report         = NULL;
+    job->size_classes   = NULL;
+}
+
+/* stage 1, in a pool thread: read a meta file and replay it against the blocks it allocates itself.
+   Deallocations of blocks from earlier files are left to replay_link_meta_file
+ */
+void replay_load_meta_file(void * arg)
+{
+    REPLAY_JOB * job = (REPLAY_JOB *)arg;
+
+    FILE * fd_meta;
+    META_READER reader;
+
+    const META_RECORD * record;
+    uint32 capacity = META_RECORDS_PER_READ;
+    uint32 i,size,nums;
+    uint32 delta = 0;
+
+    if ((fd_meta = fopen(job->filepath,"rb")) == 0)  {
+        job->failed = TRUE;
+        replay_job_set_stage(job,REPLAY_STAGE_LOADED);
+        return;
     }
 
-    if ((fd_date = fopen(TRACE_START_DATE,"rb")) == 0) {
-        SET_DEFAULT_START_DATE(g_trace_date);
-    } else {
+    job->records = malloc(capacity * sizeof(META_RECORD));
+    if (job->records == NULL) {
+        fprintf(stderr,"replay_load_meta_file@Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
 
-        fseek(fd_date, 0L, SEEK_SET);
-        fread((void *)&g_trace_date, sizeof(TRACE_DATE), 1,fd_date);
-        fclose(fd_date);
-    }   
+    /* a meta file with a bad header is replayed as an empty one */
+    if (meta_file_check_header(fd_meta)) {
 
-    /* get the current time(wall-clock time)
-       - NULL because we don't care about time zone
-     */
-    gettimeofday(&startTime, NULL);
-    fprintf(stdout,"Generating....\n");
+        meta_reader_init(&reader);
 
-    bret = TRUE;
+        while ((nums = meta_file_read_records(fd_meta,&reader,job->records + job->nums)) != 0) {
 
-    while (fgets(single_file_path, MAX_PATH_LEN, fd_meta_list) != 0) {
+            job->nums += nums;
 
-        /* remove 0x0D and 0x0A from the new line,otherwise ifstream can not work then...*/
-        len = strlen(single_file_path);
-        if (single_file_path[len-1] == 0x0A)  {
-           single_file_path[len-1] = 0x0;
+            if (capacity - job->nums < META_RECORDS_PER_READ) {
+                capacity    *= 2;
+                job->records = realloc(job->records,capacity * sizeof(META_RECORD));
+                if (job->records == NULL) {
+                    fprintf(stderr,"replay_load_meta_file@Out of memory\n");
+                    exit(EXIT_FAILURE);
+                }
+            }
         }
 
-        if ((fd_meta = fopen(single_file_path,"r")) == 0)  {
-           fprintf(stderr,"build_csv@2@Read %s failed\n",single_file_path);
-           bret = FALSE;
-           break;
+        meta_reader_free(&reader);
+    }
+
+    fclose(fd_meta);
+
+    job->deltas     = malloc(job->nums * sizeof(uint32) + 1);
+    job->unresolved = malloc(job->nums * sizeof(uint32) + 1);
+    if (job->deltas == NULL || job->unresolved == NULL) {
+        fprintf(stderr,"replay_load_meta_file@Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (i = 0; i < job->nums; i++) {
+
+        record = &job->records[i];
+
+        switch (record->type)
+        {
+            case TYPE_ALLOCATE:
+                  halloc_info_table_add(&job->survivors,record->address,record->size);
+                  delta -= record->size;
+                  break;
+
+            case TYPE_DEALLOCATE:
+                  if (halloc_info_table_remove(&job->survivors,record->address,&size)) {
+                      delta += size;
+                  } else {
+                      job->unresolved[job->unresolved_nums++] = i;
+                  }
+                  break;
+
+            default:
+                  break;
         }
 
-        bret = scan_single_meta_file(fd_meta,fd_csv,init_free_heap,bCheckHeapInit);
-        hasHeapInit = (bret == TRUE? TRUE : hasHeapInit);
+        job->deltas[i] = delta;
+    }
 
-        fclose(fd_meta);
+    replay_job_set_stage(job,REPLAY_STAGE_LOADED);
+}
 
-    } /* end while */
+/* stage 2, in file order: hand the unresolved deallocations to the blocks of earlier files,
+   then leave the file's surviving blocks for the later files
+ */
+void replay_link_meta_file(REPLAY_STATE * rs, REPLAY_JOB * job, uint32 init_free_heap)
+{
+    uint32 i,resolved = 0;
 
-    fclose(fd_meta_list);
-    fclose(fd_csv);
+    replay_begin_file(rs,init_free_heap);
+    job->start             = *rs;
+    job->start_live_blocks = g_heap_table.live_blocks;
 
-    /* get the end time */
-    gettimeofday(&endTime, NULL);
+    job->resolved_sizes = malloc(job->unresolved_nums * sizeof(uint32) + 1);
+    job->resolved_found = malloc(job->unresolved_nums + 1);
+    if (job->resolved_sizes == NULL || job->resolved_found == NULL) {
+        fprintf(stderr,"replay_link_meta_file@Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
 
-    if (!hasHeapInit) {
-        fprintf(stdout,"Warning: HEA_INIT no found!\n");
+    for (i = 0; i < job->unresolved_nums; i++) {
+        job->resolved_found[i] = halloc_info_table_remove(&g_heap_table,job->records[job->unresolved[i]].address,
+                                                          &job->resolved_sizes[i]);
+        resolved += job->resolved_sizes[i];
     }
 
-    /* calculate time in microseconds */
-    wall_clock_counter = (endTime.tv_sec*1000000  + (endTime.tv_usec)) - (startTime.tv_sec*1000000 + (startTime.tv_usec));
-    fprintf(stdout,"------------------------------------------------------\n");
-    fprintf(stdout,"Time cost:%f minutes\n",wall_clock_counter/(1000000*60));
+    halloc_info_table_merge(&g_heap_table,&job->survivors);
+    halloc_info_table_free(&job->survivors);
 
-    return bret;
+    for (i = 0; i < job->nums; i++) {
+        replay_advance_clock(rs,job->records[i].timestamp);
+        if (job->records[i].type == TYPE_INIT) {
+            rs->find_begin_point = TRUE;
+        }
+    }
+
+    rs->free_heap += (job->nums == 0 ? 0 : job->deltas[job->nums-1]) + resolved;
 }
 
-void metadata_single_blx_file(void * arg)
+/* stage 3 of -gs: count a record by the size class of its block, the live bytes are the change since the file started */
+void replay_size_class_record(REPLAY_JOB * job, uint32 i, uint32 resolved_size, uint8 bUnresolved, uint8 bVisible, uint64 time)
 {
-    THREAD_PARAMETER * tp = (THREAD_PARAMETER *)arg;
-
-    FILE * blx_file;
-    FILE * fd_meta;
+    SIZE_CLASS_SERIES * series = job->size_classes;
+    SIZE_CLASS_ROW    * row;
 
-    STANDARD_MTBF_TRACE_HEADER smth;
-    STANDARD_MTBF_TRACE_BODY   smtb; 
-    
-    char time_stamp[32] = {0};   
+    uint8  bAllocate = (job->records[i].type == TYPE_ALLOCATE);
+    uint32 size,class;
 
-    char metadata[MAX_SINGLE_METADATA_LEN] = {0};
-    char meta_file[MAX_PATH_LEN]; 
+    if (bAllocate) {
+        size = job->records[i].size;
+    } else if (bUnresolved) {
+        size = resolved_size;
+    } else {
+        size = job->deltas[i] - (i == 0 ? 0 : job->deltas[i-1]);
+    }
 
-    char temp[3];
-    long length; /* trace item length */
+    class = SIZE_CLASS(size);
 
-    //fpos_t pos;
+    if (!bVisible) {
+        series->lead_bytes[class] += bAllocate ? (sint64)size : -(sint64)size;
+        return;
+    }
 
-    if (tp == NULL) {
-        assert(1);
+    time /= job->size_class_width;
+    if (series->nums == 0 || series->rows[series->nums-1].bucket != time) {
+        size_class_series_append(series,time);
     }
 
-    memset(&smth,0x0,sizeof(STANDARD_MTBF_TRACE_HEADER));
-    memset(&smtb,0x0,sizeof(STANDARD_MTBF_TRACE_BODY));
+    row = &series->rows[series->nums-1];
+    row->allocations[class] += bAllocate;
+    row->live_bytes[class]  += bAllocate ? (sint64)size : -(sint64)size;
+}
 
-    /* open blx file for reading */
-    blx_file = fopen(tp->filepath, "rb");
-    if (blx_file == NULL)  {
-       fprintf(stderr,"Could not open %s\n",tp->filepath);
-       free(tp);
-       return;
+/* stage 3, in a pool thread: the free heap of every record is known now, format the csv lines */
+void replay_format_meta_file(void * arg)
+{
+    REPLAY_JOB * job = (REPLAY_JOB *)arg;
+    REPLAY_STATE rs  = job->start;
+
+    const META_RECORD * record;
+    uint64 capacity;
+    uint32 i,k = 0;
+    uint32 resolved = 0;
+    uint32 len,free_heap;
+    uint8  bUnresolved;
+
+    if (job->size_class_width != 0) {
+        job->size_classes = malloc(sizeof(SIZE_CLASS_SERIES));
+        if (job->size_classes == NULL) {
+            fprintf(stderr,"replay_format_meta_file@Out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+        size_class_series_init(job->size_classes);
     }
 
-    /* open meta file for writing */
-    sprintf(meta_file,"%s%s.%d%s",DEFAULT_META_FOLDER_PREFIX,basename(tp->filepath),tp->fileindex,DEFAULT_META_FILE_SUFFRIX);
-    fd_meta = fopen(meta_file, "a");
-    if (fd_meta == NULL)  {
-       fclose(blx_file);
-       free(tp);
-       fprintf(stderr,"Could not create %s\n",meta_file);
-       return;
+    capacity = (uint64)job->nums * 40 + MAX_SINGLE_METADATA_LEN;
+    job->csv = malloc(capacity);
+    if (job->csv == NULL) {
+        fprintf(stderr,"replay_format_meta_file@Out of memory\n");
+        exit(EXIT_FAILURE);
     }
 
-    /* jump fixed header,maybe more bytes I can jump... */
-    fseek(blx_file, 0L, SEEK_SET);
-    fseek(blx_file, BLX_STARTING_POINT, SEEK_CUR);
+    for (i = 0; i < job->nums; i++) {
 
-    while (!feof(blx_file))   {
+        record = &job->records[i];
 
-        //fgetpos(blx_file, &pos);
-        //printf("read 0x%x\n", pos);
+        replay_advance_clock(&rs,record->timestamp);
 
-        if (fread(&smth, sizeof(smth), 1, blx_file) != 1) {
-            break;
+        if (record->type == TYPE_INIT) {
+            rs.find_begin_point = TRUE;
+            continue;
         }
 
-        switch (tp->tracetype ) 
-        {  
-        case TRACE_TYPE_DEFAULT:     /* default type for MTBF trace */
-            if ((smth.media != MEDIA_TYPE_TCPIP && smth.media != MEDIA_TYPE_USB) ||
-                smth.receiver_device != RECEIVER_DEVICE_PC || 
-                smth.sender_device != SEND_DEVICE_TRACEBOX || 
-                smth.resource != RESOURCE_TRACEBOX )  {
-                
-                /* it's not a stand trace iteam at all, remember to back... */ 
-                fseek(blx_file, -sizeof(smth)+1L, SEEK_CUR);
-                continue; 
-            }
- 
-            /* yes, it is a available trace item... */
+        if (record->type != TYPE_ALLOCATE && record->type != TYPE_DEALLOCATE) {
+            continue;
+        }
 
-            temp[0] = smth.length[0];
-            temp[1] = smth.length[1];
-            temp[2] = '\0';
-            length = strtouint32(temp);
+        bUnresolved = (k < job->unresolved_nums && job->unresolved[k] == i);
+        if (bUnresolved) {
+            resolved += job->resolved_sizes[k++];
+        }
 
-            if (fread(&smtb, sizeof(smtb), 1, blx_file) != 1)  {
-                break;
-            }
+        if (job->size_classes != NULL) {
+            replay_size_class_record(job,i,bUnresolved ? job->resolved_sizes[k-1] : 0,bUnresolved,
+                                     !job->bCheckHeapInit || rs.find_begin_point,csv_time(rs.day,record->timestamp));
+        }
 
-            if (smtb.msg_id != SIGNATURE_MESSAGE_ID ||
-                smtb.master != SIGNATURE_MASTER     ||
-                smtb.trace_type != SIGNATURE_HEAP_TYPE )  {
-              
-                /* it's an available trace item but it's not the HEAP trace we are looking for...jump to next trace item */
-                fseek(blx_file, -sizeof(smtb)+length, SEEK_CUR);
-                continue;
-            }
-                     
-            if (smtb.trace_id != SIGNATURE_HEAP_DEALLOC       && smtb.trace_id != SIGNATURE_HEAP_ALLOC &&
-                smtb.trace_id != SIGNATURE_HEAP_ALLOC_NO_WAIT && smtb.trace_id != SIGNATURE_HEAP_INIT &&
-                smtb.trace_id != SIGNATURE_HEAP_COND_ALLOC    && smtb.trace_id != SIGNATURE_ALIGNED_ALLOC_NO_WAIT &&
-                smtb.trace_id != SIGNATURE_ALIGNED_ALLOC      && smtb.trace_id != SIGNATURE_HEAP_ALLOC_NO_WAIT_FROM )  {
-                
-                /* it's an available heap trace item, but it's not the ALLOC/DEALLOC/INIT HEAP trace we are looking for
-                   ...jump to next trace item */
-                fseek(blx_file, -sizeof(smtb)+length, SEEK_CUR);
-                continue;
+        if (job->bCheckHeapInit && !rs.find_begin_point) {
+            continue;
+        }
+
+        if (capacity - job->csv_len < MAX_SINGLE_METADATA_LEN) {
+            capacity *= 2;
+            job->csv  = realloc(job->csv,capacity);
+            if (job->csv == NULL) {
+                fprintf(stderr,"replay_format_meta_file@Out of memory\n");
+                exit(EXIT_FAILURE);
             }
- 
-            decode_timestamp(&smtb.time[0],time_stamp);
-             
-            switch (smtb.trace_id)
-            {
-                case SIGNATURE_HEAP_INIT:
-                    sprintf(metadata,META_DATA_FORMAT,time_stamp,TYPE_INIT,0,0,0,0,0);
-                    fwrite(metadata,strlen(metadata),1,fd_meta);                
-                    break;
+        }
 
-                case SIGNATURE_HEAP_DEALLOC:
-                    sprintf(metadata,META_DATA_FORMAT,time_stamp,TYPE_DEALLOCATE,GET_PTR(smtb.ptr),0,0,
-                            GET_PTR(smtb.hdt.caller1),GET_PTR(smtb.hdt.caller2));
-                    fwrite(metadata,strlen(metadata),1,fd_meta);
-                    break;
+        free_heap     = job->start.free_heap + job->deltas[i] + resolved;
+        len           = replay_format_line(job->csv + job->csv_len,rs.day,record->timestamp,free_heap);
+        job->csv_len += len;
 
-                case SIGNATURE_HEAP_ALLOC:
-                    sprintf(metadata,META_DATA_FORMAT,time_stamp,TYPE_ALLOCATE,GET_PTR(smtb.ptr),GET_SIZE(smtb.hat.size),AT_HEAP_ALLOC,
-                            GET_PTR(smtb.hat.caller1), GET_PTR(smtb.hat.caller2));
-                    fwrite(metadata,strlen(metadata),1,fd_meta);
-                    break; 
-                case SIGNATURE_HEAP_ALLOC_NO_WAIT:
-                    sprintf(metadata,META_DATA_FORMAT,time_stamp,TYPE_ALLOCATE,GET_PTR(smtb.ptr),GET_SIZE(smtb.hat.size),AT_HEAP_ALLOC_NO_WAIT,
-                            GET_PTR(smtb.hat.caller1), GET_PTR(smtb.hat.caller2));
-                    fwrite(metadata,strlen(metadata),1,fd_meta);
-                    break; 
-                case SIGNATURE_HEAP_COND_ALLOC:
-                    sprintf(metadata,META_DATA_FORMAT,time_stamp,TYPE_ALLOCATE,GET_PTR(smtb.ptr),GET_SIZE(smtb.hat.size),AT_HEAP_COND_ALLOC,
-                            GET_PTR(smtb.hcat.caller1), GET_PTR(smtb.hcat.caller2));
-                    fwrite(metadata,strlen(metadata),1,fd_meta);
-                    break; 
-                case SIGNATURE_ALIGNED_ALLOC_NO_WAIT:
-                    sprintf(metadata,META_DATA_FORMAT,time_stamp,TYPE_ALLOCATE,GET_PTR(smtb.ptr),GET_SIZE(smtb.hat.size),AT_ALIGNED_ALLOC_NO_WAIT,
-                            GET_PTR(smtb.haat.caller1), GET_PTR(smtb.haat.caller2));
-                    fwrite(metadata,strlen(metadata),1,fd_meta);
-                    break; 
-                case SIGNATURE_ALIGNED_ALLOC:
-                    sprintf(metadata,META_DATA_FORMAT,time_stamp,TYPE_ALLOCATE,GET_PTR(smtb.ptr),GET_SIZE(smtb.hat.size),AT_ALIGNED_ALLOC,
-                            GET_PTR(smtb.haat.caller1), GET_PTR(smtb.haat.caller2));
-                    fwrite(metadata,strlen(metadata),1,fd_meta);
-                    break; 
-                case SIGNATURE_HEAP_ALLOC_NO_WAIT_FROM:
-                    sprintf(metadata,META_DATA_FORMAT,time_stamp,TYPE_ALLOCATE,GET_PTR(smtb.ptr),GET_SIZE(smtb.hat.size),AT_ALLOC_NO_WAIT_FROM,
-                            GET_PTR(smtb.hanwft.caller1), GET_PTR(smtb.hanwft.caller2));
-                    fwrite(metadata,strlen(metadata),1,fd_meta);
-                    break; 
-                default:
-                    break;
-            } /* end switch (smtb.trace_id) */
+        meta_index_add_line(&job->index,csv_time(rs.day,record->timestamp),free_heap,len);
+    }
 
-            /* move cursor to a right place */
-            fseek(blx_file, -sizeof(smtb)+length, SEEK_CUR);
-            break;
+    replay_job_set_stage(job,REPLAY_STAGE_FORMATTED);
+}
 
-        default:
-            fseek(blx_file, -sizeof(smth)+1L, SEEK_CUR);
-            break;
+/* stage 3 of -r, in a pool thread: the free heap and the live blocks of every record are known now */
+void replay_report_meta_file(void * arg)
+{
+    REPLAY_JOB * job = (REPLAY_JOB *)arg;
+    REPLAY_STATE rs  = job->start;
+
+    const META_RECORD * record;
+    uint32 i,k = 0;
+    uint32 resolved    = 0;
+    uint32 live_blocks = job->start_live_blocks;
+
+    job->report = malloc(sizeof(HEAP_REPORT));
+    if (job->report == NULL) {
+        fprintf(stderr,"replay_report_meta_file@Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
 
-        } /* end switch (tp->tracetype ) */
-    } /* end while */
+    heap_report_init(job->report);
+    job->report->meta_files = 1;
 
-    fclose(blx_file);
-    fclose(fd_meta);
-    
-    free(tp);
+    for (i = 0; i < job->nums; i++) {
 
-    return;
-}
+        record = &job->records[i];
+
+        replay_advance_clock(&rs,record->timestamp);
+
+        if (record->type == TYPE_INIT) {
+            rs.find_begin_point = TRUE;
+            continue;
+        }
+
+        if (record->type == TYPE_ALLOCATE) {
+            live_blocks++;
+        } else if (record->type != TYPE_DEALLOCATE) {
+            continue;
+        } else if (k < job->unresolved_nums && job->unresolved[k] == i) {
+            /* a block of an earlier file, if it was there */
+            resolved    += job->resolved_sizes[k];
+            live_blocks -= job->resolved_found[k++];
+        } else {
+            live_blocks--;
+        }
+
+        if (job->bCheckHeapInit && !rs.find_begin_point) {
+            continue;
+        }
+
+        heap_report_add(job->report,csv_time(rs.day,record->timestamp),record,
+                        job->start.free_heap + job->deltas[i] + resolved,live_blocks);
+    }
 
+    replay_job_set_stage(job,REPLAY_STAGE_FORMATTED);
+}
 
-uint8 build_metadata(char * trace_type)
+/* read META_FILE_LIST and the date of the trace, one replay job for each meta file */
+REPLAY_JOB * replay_open_jobs(uint8 bCheckHeapInit, uint32 * filenums)
 {
-    uint8 bret = FALSE;
+    FILE * fd_meta_list;
+    FILE * fd_date;
 
-    FILE * fd_blx_list_file;
-    FILE * fd_meta_list_file;
-    FILE * fd_date_file;
+    REPLAY_JOB * jobs;
+    uint16 len;
+    uint32 i;
 
-    char   single_file_path[MAX_PATH_LEN+1] = {0};
-    char   meta_file_path[MAX_PATH_LEN+1] = {0};
-    char   commandstr[128];
+    if ((fd_meta_list = fopen(META_FILE_LIST,"r")) == 0) {
+        fprintf(stderr,"replay_open_jobs@1@Read %s failed\n",META_FILE_LIST);
+        return NULL;
+    }
 
-    uint32 t_type = (trace_type == NULL ? 0 : strtouint32(trace_type));
-    uint32 fileindex;
-    uint32 len,filenums = 0;
+    *filenums = get_file_lines(META_FILE_LIST);
+    jobs      = calloc(*filenums + 1,sizeof(REPLAY_JOB));
+    if (jobs == NULL) {
+        fclose(fd_meta_list);
+        fprintf(stderr,"replay_open_jobs@2@Out of memory\n");
+        return NULL;
+    }
 
-    struct timeval startTime;
-    struct timeval endTime;
+    for (i = 0; i < *filenums && fgets(jobs[i].filepath, MAX_PATH_LEN, fd_meta_list) != 0; i++) {
 
-    threadpool tpool;
-    
-    THREAD_PARAMETER * tp;
+        /* remove 0x0D and 0x0A from the new line,otherwise ifstream can not work then...*/
+        len = strlen(jobs[i].filepath);
+        if (len > 0 && jobs[i].filepath[len-1] == 0x0A)  {
+           jobs[i].filepath[len-1] = 0x0;
+        }
 
-    double wall_clock_counter = 0;
+        jobs[i].bCheckHeapInit = bCheckHeapInit;
+    }
 
-    static uint8 has_start_date = FALSE; /* we need an initialization date to cover 120 hours timeline */
-    struct stat stbuf;
-    struct tm * tm_date;
+    *filenums = i;
+    fclose(fd_meta_list);
 
-    system(REMOVE_DEFAULT_META_FOLDER);
-    system(CREATE_DEFAULT_META_FOLDER);
+    if ((fd_date = fopen(TRACE_START_DATE,"rb")) == 0) {
+        SET_DEFAULT_START_DATE(g_trace_date);
+    } else {
 
-    sprintf(commandstr,
-            "ls -l --sort=extension $(find $PWD -type f -name '*.blx') | awk '{print $NF}' > %s",TEMPLATE_FILE_LIST);
-    if (system(commandstr) != 0) {
-        fprintf(stderr, "Can not get source file list, please check your shell or path\n"); 
-        return bret;
+        fseek(fd_date, 0L, SEEK_SET);
+        fread((void *)&g_trace_date, sizeof(TRACE_DATE), 1,fd_date);
+        fclose(fd_date);
+    }   
+
+    return jobs;
+}
+
+/* the csv lines of a meta file depend on the blocks all earlier files left allocated, so:
+     stage 1 replays each file on its own in parallel,
+     stage 2 links the files in order, which only touches deallocations of older blocks and the surviving blocks,
+     stage 3(finish) runs in parallel, e.g. replay_format_meta_file formats the csv lines.
+   consume gets the jobs in file order after stage 3. Up to REPLAY_WINDOW meta files are in memory at once.
+   With resume the replay starts after the files an earlier run replayed, see build_csv.
+   The jobs are freed, returns FALSE if a meta file can not be read or the last one is before the heap init
+ */
+uint8 replay_run_jobs(REPLAY_JOB * jobs, uint32 filenums, uint32 init_free_heap, dispatch_fn finish,
+                      replay_consume_fn consume, void * arg, uint8 * hasHeapInit, REPLAY_RESUME * resume)
+{
+    uint8 bret = TRUE;
+
+    REPLAY_CONTEXT context;
+    REPLAY_STATE   rs;
+    threadpool     tpool;
+
+    uint32 i,linked;
+    uint32 first = (resume == NULL ? 0 : resume->first);
+
+    pthread_mutex_init(&context.lock,NULL);
+    pthread_cond_init(&context.cond_stage,NULL);
+
+    for (i = 0; i < filenums; i++) {
+        jobs[i].context = &context;
     }
 
-    filenums = get_file_lines(TEMPLATE_FILE_LIST);
-    switch ( filenums ) 
-    { 
-        case 0:
-            return bret;
-        case 1:
+    replay_init_state(&rs);
+    *hasHeapInit = FALSE;
+
+    if (first > 0) {
+        rs           = resume->state;
+        *hasHeapInit = resume->hasHeapInit;
+    }
+
+    tpool = tp_init_threadpool(MAX_NUM_THREADS);
+
+    for (i = first; i < filenums && i < first + REPLAY_WINDOW; i++) {
+        tp_dispatch(tpool, replay_load_meta_file, (void *)&jobs[i]);
+    }
+
+    for (linked = first; linked < filenums; linked++) {
+
+        replay_job_wait(&jobs[linked],REPLAY_STAGE_LOADED);
+
+        if (jobs[linked].failed) {
+            fprintf(stderr,"replay_run_jobs@Read %s failed\n",jobs[linked].filepath);
+            bret = FALSE;
             break;
-        default:
-            /* check if files are sorted in tmp_blx_file_list based on modification time
-               if not, then correct it
-             */
-            sort_filelist(TEMPLATE_FILE_LIST);
+        }
+
+        if (resume != NULL && resume->checkpoint != NULL && linked + 1 == filenums) {
+            resume->checkpoint(jobs,linked,&rs,*hasHeapInit,arg);
+        }
+
+        replay_link_meta_file(&rs,&jobs[linked],init_free_heap);
+
+        bret = rs.find_begin_point;
+        *hasHeapInit = (bret == TRUE? TRUE : *hasHeapInit);
+
+        tp_dispatch(tpool, finish, (void *)&jobs[linked]);
+
+        /* consume the previous file while this one is being finished */
+        if (linked > first) {
+            i = linked - 1;
+
+            replay_job_wait(&jobs[i],REPLAY_STAGE_FORMATTED);
+            consume(&jobs[i],arg);
+            replay_job_free(&jobs[i]);
+
+            if (i + REPLAY_WINDOW < filenums) {
+                tp_dispatch(tpool, replay_load_meta_file, (void *)&jobs[i + REPLAY_WINDOW]);
+            }
+        }
+
+    } /* end for */
+
+    if (linked > first) {
+        replay_job_wait(&jobs[linked-1],REPLAY_STAGE_FORMATTED);
+        consume(&jobs[linked-1],arg);
     }
 
-    if ((fd_blx_list_file = fopen(TEMPLATE_FILE_LIST,"r")) == 0) {
-        fprintf(stderr,"build_metadata@1@Read %s failed\n",TEMPLATE_FILE_LIST);
-        return bret;
+    /* files after a failed one may still be loading */
+    tp_destroy_threadpool(tpool);
+
+    for (i = 0; i < filenums; i++) {
+        replay_job_free(&jobs[i]);
     }
 
-    fseek(fd_blx_list_file, 0L, SEEK_SET);
+    free(jobs);
 
-    if ((fd_meta_list_file = fopen(META_FILE_LIST,"a")) == 0) {
-        fclose(fd_blx_list_file);
-        fprintf(stderr,"build_metadata@2@Read %s failed\n",META_FILE_LIST);
-        return bret;
+    pthread_mutex_destroy(&context.lock);
+    pthread_cond_destroy(&context.cond_stage);
+
+    g_trace_date.day = rs.day;
+    halloc_info_table_free(&g_heap_table);
+
+    return bret;
+}
+
+/* build_csv: write the csv lines of a meta file */
+void build_csv_write_job(REPLAY_JOB * job, void * arg)
+{
+    REPLAY_CSV_OUTPUT * out = (REPLAY_CSV_OUTPUT *)arg;
+
+    /* where the csv lines of the files the checkpoint covers end */
+    if (out->checkpoint_files != 0 && out->consumed == out->checkpoint_files) {
+        out->checkpoint_csv_size = out->index.csv_size;
+        out->checkpoint_lines    = out->index.lines;
     }
 
-    /* get the current time(wall-clock time)
+    fwrite(job->csv,job->csv_len,1,out->fd_csv);
+    meta_index_append(&out->index,&job->index);
+
+    if (job->size_classes != NULL) {
+        size_class_series_merge(&out->size_classes,job->size_classes);
+    }
+
+    out->consumed++;
+}
+
+/* build_csv: write the replay state after the first files meta files to TEMP_CHECKPOINT_FILE,
+   build_csv_finish_checkpoint fills in the rest once their csv lines are written
+ */
+void build_csv_checkpoint(REPLAY_JOB * jobs, uint32 files, const REPLAY_STATE * rs, uint8 hasHeapInit, void * arg)
+{
+    REPLAY_CSV_OUTPUT * out = (REPLAY_CSV_OUTPUT *)arg;
+
+    REPLAY_CHECKPOINT_HEADER rch;
+    REPLAY_CHECKPOINT_FILE   rcf;
+    struct stat stbuf;
+    FILE * fd_checkpoint;
+    uint8  bret = TRUE;
+    uint32 i;
+
+    if (files == 0 || (fd_checkpoint = fopen(TEMP_CHECKPOINT_FILE,"wb")) == 0) {
+        return;
+    }
+
+    memset(&rch,0x0,sizeof(REPLAY_CHECKPOINT_HEADER));
+    rch.magic       = REPLAY_CHECKPOINT_MAGIC;
+    rch.version     = REPLAY_CHECKPOINT_VERSION;
+    rch.hasHeapInit = hasHeapInit;
+    rch.date        = g_trace_date;
+    rch.state       = *rs;
+    rch.files       = files;
+
+    bret = fwrite(&rch,sizeof(REPLAY_CHECKPOINT_HEADER),1,fd_checkpoint) == 1;
+
+    for (i = 0; i < files && bret; i++) {
+        memset(&rcf,0x0,sizeof(REPLAY_CHECKPOINT_FILE));
+        strcpy(rcf.filepath,jobs[i].filepath);
+
+        bret = stat(jobs[i].filepath,&stbuf) == 0;
+        rcf.size  = stbuf.st_size;
+        rcf.mtime = stbuf.st_mtime;
+
+        bret = bret && fwrite(&rcf,sizeof(REPLAY_CHECKPOINT_FILE),1,fd_checkpoint) == 1;
+    }
+
+    bret = bret && halloc_info_table_write(&g_heap_table,fd_checkpoint);
+
+    if (fclose(fd_checkpoint) != 0 || !bret) {
+        fprintf(stderr,"build_csv_checkpoint@Write %s failed\n",TEMP_CHECKPOINT_FILE);
+        unlink(TEMP_CHECKPOINT_FILE);
+        return;
+    }
+
+    out->checkpoint_files = files;
+}
+
+/* build_csv: the checkpoint is good once all csv lines are written */
+void build_csv_finish_checkpoint(REPLAY_CSV_OUTPUT * out, uint32 filenums, uint32 init_free_heap, uint8 bCheckHeapInit)
+{
+    REPLAY_CHECKPOINT_HEADER rch;
+    FILE * fd_checkpoint;
+    uint8  bret;
+
+    if (out->checkpoint_files == 0 || out->consumed != filenums) {
+        unlink(TEMP_CHECKPOINT_FILE);
+        return;
+    }
+
+    if ((fd_checkpoint = fopen(TEMP_CHECKPOINT_FILE,"r+b")) == 0) {
+        return;
+    }
+
+    bret = fread(&rch,sizeof(REPLAY_CHECKPOINT_HEADER),1,fd_checkpoint) == 1;
+
+    rch.init_free_heap = init_free_heap;
+    rch.bCheckHeapInit = bCheckHeapInit;
+    rch.csv_size       = out->checkpoint_csv_size;
+    rch.lines          = out->checkpoint_lines;
+
+    bret = bret && fseek(fd_checkpoint,0L,SEEK_SET) == 0 &&
+           fwrite(&rch,sizeof(REPLAY_CHECKPOINT_HEADER),1,fd_checkpoint) == 1;
+
+    if (fclose(fd_checkpoint) != 0 || !bret || rename(TEMP_CHECKPOINT_FILE,DEFAULT_CHECKPOINT_FILE) != 0) {
+        fprintf(stderr,"build_csv_finish_checkpoint@Write %s failed\n",DEFAULT_CHECKPOINT_FILE);
+        unlink(TEMP_CHECKPOINT_FILE);
+    }
+}
+
+/* build_csv: pick up after the meta files the last run checkpointed, if none of them changed since and
+   the csv and its index are still the ones it wrote. g_heap_table gets their live blocks, the csv and
+   its index are cut back to their lines. FALSE means the csv is replayed from the first meta file
+ */
+uint8 build_csv_resume(REPLAY_JOB * jobs, uint32 filenums, uint32 init_free_heap, uint8 bCheckHeapInit,
+                       REPLAY_RESUME * resume, REPLAY_CSV_OUTPUT * out)
+{
+    REPLAY_CHECKPOINT_HEADER rch;
+    REPLAY_CHECKPOINT_FILE   rcf;
+    struct stat stbuf;
+    FILE * fd_checkpoint;
+    uint32 i;
+
+    if ((fd_checkpoint = fopen(DEFAULT_CHECKPOINT_FILE,"rb")) == 0) {
+        return FALSE;
+    }
+
+    if (fread(&rch,sizeof(REPLAY_CHECKPOINT_HEADER),1,fd_checkpoint) != 1 ||
+        rch.magic != REPLAY_CHECKPOINT_MAGIC || rch.version != REPLAY_CHECKPOINT_VERSION ||
+        rch.init_free_heap != init_free_heap || rch.bCheckHeapInit != bCheckHeapInit ||
+        memcmp(&rch.date,&g_trace_date,sizeof(TRACE_DATE)) != 0 || rch.files == 0 || rch.files >= filenums) {
+        fclose(fd_checkpoint);
+        return FALSE;
+    }
+
+    for (i = 0; i < rch.files; i++) {
+        if (fread(&rcf,sizeof(REPLAY_CHECKPOINT_FILE),1,fd_checkpoint) != 1 || strcmp(rcf.filepath,jobs[i].filepath) != 0 ||
+            stat(jobs[i].filepath,&stbuf) != 0 || rcf.size != (uint64)stbuf.st_size || rcf.mtime != stbuf.st_mtime) {
+            fclose(fd_checkpoint);
+            return FALSE;
+        }
+    }
+
+    if (!meta_index_load(&out->index,DEFAULT_META_INDEX_FILE,DEFAULT_META_FILE) ||
+        out->index.csv_size < rch.csv_size || out->index.lines < rch.lines) {
+        meta_index_free(&out->index);
+        fclose(fd_checkpoint);
+        return FALSE;
+    }
+
+    if (!halloc_info_table_read(&g_heap_table,fd_checkpoint)) {
+        meta_index_free(&out->index);
+        fclose(fd_checkpoint);
+        return FALSE;
+    }
+
+    fclose(fd_checkpoint);
+
+    if (truncate(DEFAULT_META_FILE,rch.csv_size) != 0) {
+        halloc_info_table_free(&g_heap_table);
+        meta_index_free(&out->index);
+        return FALSE;
+    }
+
+    meta_index_truncate(&out->index,rch.lines,rch.csv_size);
+
+    resume->first       = rch.files;
+    resume->state       = rch.state;
+    resume->hasHeapInit = rch.hasHeapInit;
+    out->consumed       = rch.files;
+
+    return TRUE;
+}
+
+/* replay the meta files into DEFAULT_META_FILE and its index, see replay_run_jobs.
+   A run leaves DEFAULT_CHECKPOINT_FILE behind, the next one only replays the meta files after it.
+   size_class_minutes > 0 also writes DEFAULT_SIZE_CLASS_FILE with buckets of that many minutes,
+   which always takes a replay from the first meta file
+ */
+uint8 build_csv(uint32 init_free_heap, uint8 bCheckHeapInit, uint32 size_class_minutes)
+{
+    uint8 bret = FALSE;
+ 
+    uint8  hasHeapInit = FALSE;
+
+    struct timeval startTime;
+    struct timeval endTime;
+
+    double wall_clock_counter = 0;
+
+    REPLAY_JOB      * jobs;
+    REPLAY_CSV_OUTPUT out;
+    REPLAY_RESUME     resume;
+
+    uint32 filenums,i;
+
+    if ((jobs = replay_open_jobs(bCheckHeapInit,&filenums)) == NULL) {
+        return bret;
+    }
+
+    for (i = 0; i < filenums; i++) {
+        jobs[i].size_class_width = (uint64)size_class_minutes * 60 * TIME_UNIT;
+    }
+
+    memset(&out,0x0,sizeof(REPLAY_CSV_OUTPUT));
+    memset(&resume,0x0,sizeof(REPLAY_RESUME));
+    resume.checkpoint = build_csv_checkpoint;
+
+    if (size_class_minutes == 0 && build_csv_resume(jobs,filenums,init_free_heap,bCheckHeapInit,&resume,&out)) {
+        fprintf(stdout,"Resuming after %u of %u meta files\n",resume.first,filenums);
+    } else {
+        meta_index_init(&out.index);
+        system(REMOVE_DEFAULT_META_FILE);
+    }
+
+    /* the checkpoint is only good again once this run is done */
+    unlink(DEFAULT_CHECKPOINT_FILE);
+
+    if ((out.fd_csv = fopen(DEFAULT_META_FILE,"a")) == 0) {
+        free(jobs);
+        meta_index_free(&out.index);
+        halloc_info_table_free(&g_heap_table);
+        fprintf(stderr,"Create %s failed\n",DEFAULT_META_FILE);
+        return bret;
+    }
+
+    /* get the current time(wall-clock time)
        - NULL because we don't care about time zone
      */
     gettimeofday(&startTime, NULL);
-    fileindex = 0;
+    fprintf(stdout,"Generating....\n");
+
+    size_class_series_init(&out.size_classes);
+
+    bret = replay_run_jobs(jobs,filenums,init_free_heap,replay_format_meta_file,build_csv_write_job,&out,&hasHeapInit,&resume);
+
+    fclose(out.fd_csv);
+
+    meta_index_save(&out.index,DEFAULT_META_INDEX_FILE);
+    meta_index_free(&out.index);
+
+    build_csv_finish_checkpoint(&out,filenums,init_free_heap,bCheckHeapInit);
+
+    if (size_class_minutes > 0) {
+        size_class_series_save(&out.size_classes,(uint64)size_class_minutes * 60 * TIME_UNIT,DEFAULT_SIZE_CLASS_FILE);
+    }
+    size_class_series_free(&out.size_classes);
+
+    /* get the end time */
+    gettimeofday(&endTime, NULL);
+
+    if (!hasHeapInit) {
+        fprintf(stdout,"Warning: HEA_INIT no found!\n");
+    }
+
+    /* calculate time in microseconds */
+    wall_clock_counter = (endTime.tv_sec*1000000  + (endTime.tv_usec)) - (startTime.tv_sec*1000000 + (startTime.tv_usec));
+    fprintf(stdout,"------------------------------------------------------\n");
+    fprintf(stdout,"Time cost:%f minutes\n",wall_clock_counter/(1000000*60));
+
+    return bret;
+}
+
+/* -bg: tell the replay that all records of a blx file are in its stream */
+void meta_stream_done(META_STREAM * stream)
+{
+    if (stream == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&stream->lock);
+    stream->done = TRUE;
+    pthread_cond_signal(&stream->cond_done);
+    pthread_mutex_unlock(&stream->lock);
+}
+
+/* -bg: replay the blx files in list order as soon as each one is decoded */
+uint8 replay_meta_streams(META_STREAM * streams, uint32 nums, uint32 init_free_heap, uint8 bCheckHeapInit)
+{
+    OUTPUT_WRITER * writer = NULL;
+    int    fd_csv;
+    uint32 i;
+    uint8  hasHeapInit = FALSE;
+
+    REPLAY_STATE rs;
+    META_INDEX   index;
+
+    replay_init_state(&rs);
+    meta_index_init(&index);
+
+    system(REMOVE_DEFAULT_META_FILE);
+    if ((fd_csv = open(DEFAULT_META_FILE,O_WRONLY | O_CREAT | O_APPEND,0644)) == -1) {
+        fprintf(stderr,"Create %s failed\n",DEFAULT_META_FILE);
+    } else {
+        writer = output_writer_thread();
+        output_writer_open(writer,fd_csv);
+    }
+
+    for (i = 0; i < nums; i++) {
+
+        pthread_mutex_lock(&streams[i].lock);
+        while (!streams[i].done) {
+            pthread_cond_wait(&streams[i].cond_done,&streams[i].lock);
+        }
+        pthread_mutex_unlock(&streams[i].lock);
+
+        if (writer != NULL) {
+            replay_begin_file(&rs,init_free_heap);
+            meta_index_next_file(&index);
+            hasHeapInit = replay_meta_records(&rs,streams[i].buffer.records,streams[i].buffer.nums,writer,&index,bCheckHeapInit);
+        }
+
+        meta_buffer_free(&streams[i].buffer);
+        pthread_mutex_destroy(&streams[i].lock);
+        pthread_cond_destroy(&streams[i].cond_done);
+    }
+
+    g_trace_date.day = rs.day;
+    halloc_info_table_free(&g_heap_table);
+
+    if (writer == NULL) {
+        return FALSE;
+    }
+
+    output_writer_close(writer);
+
+    meta_index_save(&index,DEFAULT_META_INDEX_FILE);
+    meta_index_free(&index);
+
+    if (!hasHeapInit) {
+        fprintf(stdout,"Warning: HEA_INIT no found!\n");
+    }
+
+    return TRUE;
+}
+
+/* decode the trace item at pos, returns the offset the next probe starts from.
+   *is_item tells if a trace item header was found at pos, *is_heap if record is filled with a heap record
+ */
+uint64 decode_blx_item(const uint8 * mapped_blx, uint64 blx_size, uint64 pos, uint32 tracetype,
+                       META_RECORD * record, uint8 * is_item, uint8 * is_heap)
+{
+    const STANDARD_MTBF_TRACE_HEADER * smth;
+    const STANDARD_MTBF_TRACE_BODY   * smtb;
+
+    char temp[3];
+    long length; /* trace item length */
+
+    *is_item = FALSE;
+    *is_heap = FALSE;
+
+    switch (tracetype ) 
+    {  
+    case TRACE_TYPE_DEFAULT:     /* default type for MTBF trace */
+        smth = (const STANDARD_MTBF_TRACE_HEADER *)(mapped_blx + pos);
+
+        if ((smth->media != MEDIA_TYPE_TCPIP && smth->media != MEDIA_TYPE_USB) ||
+            smth->receiver_device != RECEIVER_DEVICE_PC || 
+            smth->sender_device != SEND_DEVICE_TRACEBOX || 
+            smth->resource != RESOURCE_TRACEBOX )  {
+            
+            /* it's not a stand trace iteam at all, skip to the next header signature... */ 
+            return scan_trace_header(mapped_blx, pos + 1, blx_size);
+        }
+
+        /* yes, it is a available trace item... */
+        *is_item = TRUE;
+
+        temp[0] = smth->length[0];
+        temp[1] = smth->length[1];
+        temp[2] = '\0';
+        length = strtouint32(temp);
+
+        if (pos + sizeof(STANDARD_MTBF_TRACE_HEADER) + sizeof(STANDARD_MTBF_TRACE_BODY) > blx_size)  {
+            return blx_size;
+        }
+
+        smtb = (const STANDARD_MTBF_TRACE_BODY *)(mapped_blx + pos + sizeof(STANDARD_MTBF_TRACE_HEADER));
+
+        /* whatever the trace item is, the next one starts right after its body */
+        pos += sizeof(STANDARD_MTBF_TRACE_HEADER) + length;
+
+        if (smtb->msg_id != SIGNATURE_MESSAGE_ID ||
+            smtb->master != SIGNATURE_MASTER     ||
+            smtb->trace_type != SIGNATURE_HEAP_TYPE )  {
+          
+            /* it's an available trace item but it's not the HEAP trace we are looking for...jump to next trace item */
+            return pos;
+        }
+                 
+        if (smtb->trace_id != SIGNATURE_HEAP_DEALLOC       && smtb->trace_id != SIGNATURE_HEAP_ALLOC &&
+            smtb->trace_id != SIGNATURE_HEAP_ALLOC_NO_WAIT && smtb->trace_id != SIGNATURE_HEAP_INIT &&
+            smtb->trace_id != SIGNATURE_HEAP_COND_ALLOC    && smtb->trace_id != SIGNATURE_ALIGNED_ALLOC_NO_WAIT &&
+            smtb->trace_id != SIGNATURE_ALIGNED_ALLOC      && smtb->trace_id != SIGNATURE_HEAP_ALLOC_NO_WAIT_FROM )  {
+            
+            /* it's an available heap trace item, but it's not the ALLOC/DEALLOC/INIT HEAP trace we are looking for
+               ...jump to next trace item */
+            return pos;
+        }
+
+        memset(record,0x0,sizeof(META_RECORD));
+        record->timestamp = decode_timestamp_ns((uint8 *)&smtb->time[0]);
+        record->address   = GET_PTR(smtb->ptr);
+        record->type      = TYPE_ALLOCATE;
+         
+        switch (smtb->trace_id)
+        {
+            case SIGNATURE_HEAP_INIT:
+                record->type    = TYPE_INIT;
+                record->address = 0;
+                break;
+
+            case SIGNATURE_HEAP_DEALLOC:
+                record->type    = TYPE_DEALLOCATE;
+                record->caller1 = GET_PTR(smtb->hdt.caller1);
+                record->caller2 = GET_PTR(smtb->hdt.caller2);
+                break;
+
+            case SIGNATURE_HEAP_ALLOC:
+                record->size            = GET_SIZE(smtb->hat.size);
+                record->allocation_type = AT_HEAP_ALLOC;
+                record->caller1         = GET_PTR(smtb->hat.caller1);
+                record->caller2         = GET_PTR(smtb->hat.caller2);
+                break; 
+            case SIGNATURE_HEAP_ALLOC_NO_WAIT:
+                record->size            = GET_SIZE(smtb->hat.size);
+                record->allocation_type = AT_HEAP_ALLOC_NO_WAIT;
+                record->caller1         = GET_PTR(smtb->hat.caller1);
+                record->caller2         = GET_PTR(smtb->hat.caller2);
+                break; 
+            case SIGNATURE_HEAP_COND_ALLOC:
+                record->size            = GET_SIZE(smtb->hat.size);
+                record->allocation_type = AT_HEAP_COND_ALLOC;
+                record->caller1         = GET_PTR(smtb->hcat.caller1);
+                record->caller2         = GET_PTR(smtb->hcat.caller2);
+                break; 
+            case SIGNATURE_ALIGNED_ALLOC_NO_WAIT:
+                record->size            = GET_SIZE(smtb->hat.size);
+                record->allocation_type = AT_ALIGNED_ALLOC_NO_WAIT;
+                record->caller1         = GET_PTR(smtb->haat.caller1);
+                record->caller2         = GET_PTR(smtb->haat.caller2);
+                break; 
+            case SIGNATURE_ALIGNED_ALLOC:
+                record->size            = GET_SIZE(smtb->hat.size);
+                record->allocation_type = AT_ALIGNED_ALLOC;
+                record->caller1         = GET_PTR(smtb->haat.caller1);
+                record->caller2         = GET_PTR(smtb->haat.caller2);
+                break; 
+            case SIGNATURE_HEAP_ALLOC_NO_WAIT_FROM:
+                record->size            = GET_SIZE(smtb->hat.size);
+                record->allocation_type = AT_ALLOC_NO_WAIT_FROM;
+                record->caller1         = GET_PTR(smtb->hanwft.caller1);
+                record->caller2         = GET_PTR(smtb->hanwft.caller2);
+                break; 
+            default:
+                break;
+        } /* end switch (smtb->trace_id) */
+
+        *is_heap = TRUE;
+        return pos;
+
+    default:
+        return pos + 1;
+
+    } /* end switch (tracetype ) */
+}
+
+/* decode trace items from begin until the walk gets to end, returns where the walk stopped.
+   With chunk != NULL every trace item found is remembered for stitching, see metadata_stitch_chunks
+ */
+uint64 decode_blx_range(const uint8 * mapped_blx, uint64 blx_size, uint64 begin, uint64 end, uint32 tracetype,
+                        META_RECORD_BUFFER * out, BLX_CHUNK * chunk)
+{
+    uint64 pos = begin;   /* offset of the trace item being probed */
+    uint64 next;
+    uint8  is_item,is_heap;
+
+    META_RECORD record;
+
+    while (pos < end && pos + sizeof(STANDARD_MTBF_TRACE_HEADER) <= blx_size)   {
+
+        next = decode_blx_item(mapped_blx,blx_size,pos,tracetype,&record,&is_item,&is_heap);
+
+        if (chunk != NULL && is_item) {
+            blx_chunk_add_item(chunk,pos,next,out->nums);
+        }
+
+        if (is_heap) {
+            meta_buffer_append(out,&record);
+        }
+
+        pos = next;
+    }
+
+    return pos;
+}
+
+/* the whole blx file is mapped and trace items are parsed in place,
+   so resyncing over non-trace bytes is a pointer increment instead of a fseek/fread pair */
+uint8 * metadata_map_blx_file(char * filepath, uint64 * blx_size)
+{
+    int    blx_fd;
+    struct stat stbuf;
+    uint8 * mapped_blx = NULL;
+
+    /* open blx file for reading */
+    blx_fd = open(filepath, O_RDONLY);
+    if (blx_fd == -1 || fstat(blx_fd, &stbuf) == -1)  {
+       fprintf(stderr,"Could not open %s\n",filepath);
+       if (blx_fd != -1) {
+           close(blx_fd);
+       }
+       return MAP_FAILED;
+    }
+
+    *blx_size = stbuf.st_size;
+
+    if (*blx_size > BLX_STARTING_POINT)  {
+        mapped_blx = (uint8 *)mmap(NULL,*blx_size,PROT_READ,MAP_PRIVATE,blx_fd,0);
+        if (mapped_blx == MAP_FAILED) {
+            fprintf(stderr,"Could not map %s\n",filepath);
+            mapped_blx = NULL;
+        } else {
+            madvise(mapped_blx,*blx_size,MADV_SEQUENTIAL);
+        }
+    }
+
+    close(blx_fd);
+
+    return mapped_blx;
+}
+
+/* where the records of a blx file go: its .meta file, or the -bg stream */
+META_RECORD_BUFFER * metadata_open_output(THREAD_PARAMETER * tp, META_RECORD_BUFFER * file_buffer)
+{
+    OUTPUT_WRITER * writer;
+    int    fd_meta;
+    char   meta_file[MAX_PATH_LEN]; 
+
+    if (tp->stream != NULL) {
+        /* -bg, records go to the replay directly */
+        return &tp->stream->buffer;
+    }
+
+    /* open meta file for writing */
+    sprintf(meta_file,"%s%s.%d%s",DEFAULT_META_FOLDER_PREFIX,basename(tp->filepath),tp->fileindex,DEFAULT_META_FILE_SUFFRIX);
+    fd_meta = open(meta_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd_meta == -1)  {
+       fprintf(stderr,"Could not create %s\n",meta_file);
+       return NULL;
+    }
+
+    /* records are encoded into the thread's writer, which hands them to write() in OUTPUT_BUFFER_SIZE pieces */
+    writer = output_writer_thread();
+    output_writer_open(writer,fd_meta);
+
+    meta_file_write_header(writer);
+    meta_buffer_init(file_buffer,writer);
+
+    return file_buffer;
+}
+
+void metadata_close_output(THREAD_PARAMETER * tp, META_RECORD_BUFFER * out)
+{
+    if (out != NULL && out->writer != NULL) {
+        meta_buffer_flush(out);
+        output_writer_close(out->writer);
+        meta_buffer_free(out);
+    }
+
+    meta_stream_done(tp->stream);
+}
+
+void metadata_single_blx_file(void * arg)
+{
+    THREAD_PARAMETER * tp = (THREAD_PARAMETER *)arg;
+
+    META_RECORD_BUFFER   file_buffer;
+    META_RECORD_BUFFER * out;
+
+    uint8 * mapped_blx;
+    uint64  blx_size = 0;
+
+    if (tp == NULL) {
+        assert(1);
+    }
+
+    fprintf(stdout,"%sThread%u is working on %s%s\n",cyan,(uint32)pthread_self(),tp->filepath,none);
+
+    mapped_blx = metadata_map_blx_file(tp->filepath,&blx_size);
+    if (mapped_blx == MAP_FAILED) {
+       meta_stream_done(tp->stream);
+       free(tp);
+       return;
+    }
+
+    out = metadata_open_output(tp,&file_buffer);
+
+    /* jump fixed header,maybe more bytes I can jump... */
+    if (mapped_blx != NULL && out != NULL) {
+        decode_blx_range(mapped_blx,blx_size,BLX_STARTING_POINT,blx_size,tp->tracetype,out,NULL);
+    }
+
+    if (mapped_blx != NULL) {
+        munmap(mapped_blx, blx_size);
+    }
+
+    metadata_close_output(tp,out);
     
-    tpool = tp_init_threadpool(MAX_NUM_THREADS);
+    free(tp);
+
+    return;
+}
+
+/* put the chunks of a blx file together as if the file was decoded from the beginning in one go.
+   A chunk walk starts at an arbitrary offset, so it may decode a few bogus items before it falls
+   in step with the real walk. Since the walk is deterministic, from the first offset both walks
+   probe on they are the same, and everything the chunk decoded from there on is taken as is.
+   Up to that offset the real walk is redone here, that is usually one or two trace items.
+ */
+void metadata_stitch_chunks(THREAD_PARAMETER * tp, const uint8 * mapped_blx, uint64 blx_size, META_RECORD_BUFFER * out)
+{
+    BLX_CHUNK * chunk;
+    uint64 pos = BLX_STARTING_POINT;
+    uint32 i,k,first;
+    uint8  is_item,is_heap;
+
+    META_RECORD record;
+
+    for (k = 0; k < tp->chunk_nums; k++) {
+
+        chunk = &tp->chunks[k];
+
+        /* redo the real walk until it probes an offset the chunk walk probed as well */
+        while (pos < chunk->end && pos + sizeof(STANDARD_MTBF_TRACE_HEADER) <= blx_size &&
+               !blx_chunk_probed(chunk,pos)) {
+
+            pos = decode_blx_item(mapped_blx,blx_size,pos,tp->tracetype,&record,&is_item,&is_heap);
+            if (is_heap) {
+                meta_buffer_append(out,&record);
+            }
+        }
+
+        if (pos >= chunk->end || pos + sizeof(STANDARD_MTBF_TRACE_HEADER) > blx_size) {
+            continue;
+        }
+
+        /* in step: the records of the chunk from the first trace item at or after pos */
+        first = chunk->records.nums;
+        for (i = blx_chunk_find_item(chunk,pos); i < chunk->item_nums; i++) {
+            if (chunk->items[i].offset >= pos) {
+                first = chunk->items[i].first_record;
+                break;
+            }
+        }
+
+        meta_buffer_append_records(out,&chunk->records.records[first],chunk->records.nums - first);
+
+        pos = chunk->final;
+    }
+}
+
+/* one chunk of a large blx file, the last chunk to finish stitches all of them together */
+void metadata_blx_chunk(void * arg)
+{
+    BLX_CHUNK        * chunk = (BLX_CHUNK *)arg;
+    THREAD_PARAMETER * tp    = chunk->parent;
+
+    META_RECORD_BUFFER   file_buffer;
+    META_RECORD_BUFFER * out;
+
+    uint8 * mapped_blx;
+    uint64  blx_size = 0;
+    uint32  chunks_left,k;
+
+    fprintf(stdout,"%sThread%u is working on %s@%llu%s\n",cyan,(uint32)pthread_self(),tp->filepath,chunk->begin,none);
+
+    meta_buffer_init(&chunk->records,NULL);
+    chunk->final = chunk->end;
+
+    mapped_blx = metadata_map_blx_file(tp->filepath,&blx_size);
+    if (mapped_blx != MAP_FAILED && mapped_blx != NULL) {
+        chunk->final = decode_blx_range(mapped_blx,blx_size,chunk->begin,chunk->end,tp->tracetype,&chunk->records,chunk);
+        munmap(mapped_blx, blx_size);
+    }
+
+    pthread_mutex_lock(&tp->chunk_lock);
+    chunks_left = --tp->chunks_left;
+    pthread_mutex_unlock(&tp->chunk_lock);
+
+    if (chunks_left != 0) {
+        return;
+    }
+
+    mapped_blx = metadata_map_blx_file(tp->filepath,&blx_size);
+    out = metadata_open_output(tp,&file_buffer);
+
+    if (mapped_blx != MAP_FAILED && mapped_blx != NULL && out != NULL) {
+        metadata_stitch_chunks(tp,mapped_blx,blx_size,out);
+    }
+
+    if (mapped_blx != MAP_FAILED && mapped_blx != NULL) {
+        munmap(mapped_blx, blx_size);
+    }
+
+    metadata_close_output(tp,out);
+
+    for (k = 0; k < tp->chunk_nums; k++) {
+        meta_buffer_free(&tp->chunks[k].records);
+        free(tp->chunks[k].items);
+    }
+
+    pthread_mutex_destroy(&tp->chunk_lock);
+    free(tp->chunks);
+    free(tp);
+}
+
+/* a job of its own for a large blx file: cut it into g_blx_chunk_size byte ranges.
+   The chunks are dispatched from inside the pool, so they go to this thread's deque and idle threads steal them
+ */
+void metadata_split_blx_file(void * arg)
+{
+    THREAD_PARAMETER * tp = (THREAD_PARAMETER *)arg;
+    uint32 k;
+
+    tp->chunk_nums  = (tp->blx_size - BLX_STARTING_POINT + g_blx_chunk_size - 1) / g_blx_chunk_size;
+    tp->chunks_left = tp->chunk_nums;
+    tp->chunks      = calloc(tp->chunk_nums,sizeof(BLX_CHUNK));
+    pthread_mutex_init(&tp->chunk_lock,NULL);
+
+    if (tp->chunks == NULL) {
+        fprintf(stderr,"metadata_split_blx_file@Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (k = 0; k < tp->chunk_nums; k++) {
+        tp->chunks[k].parent = tp;
+        tp->chunks[k].begin  = BLX_STARTING_POINT + (uint64)k * g_blx_chunk_size;
+        tp->chunks[k].end    = (k == tp->chunk_nums - 1 ? tp->blx_size : tp->chunks[k].begin + g_blx_chunk_size);
+    }
+
+    /* the deque pops the latest first, push the tail chunks first so this thread starts from the head */
+    for (k = tp->chunk_nums; k > 0; k--) {
+        tp_dispatch(tp->tpool, metadata_blx_chunk, (void *)&tp->chunks[k-1]);
+    }
+}
+
+/* chunk size of the parallel decode, BLX_CHUNK_SIZE unless BLX_CHUNK_SIZE_ENV says otherwise.
+   Small chunks cut most trace items somewhere, that is how the stitching gets tested(see bench_blx -v)
+ */
+uint64 metadata_chunk_size(void)
+{
+    char * env = getenv(BLX_CHUNK_SIZE_ENV);
+    char * endptr = NULL;
+    uint64 size;
+
+    if (env == NULL) {
+        return BLX_CHUNK_SIZE;
+    }
+
+    errno = 0;
+    size  = strtoull(env,&endptr,10);
+
+    if (errno != 0 || endptr == env || *endptr != '\0' || size < BLX_CHUNK_SIZE_MIN) {
+        fprintf(stderr,"metadata_chunk_size@%s=%s is not a chunk size, using %d\n",BLX_CHUNK_SIZE_ENV,env,BLX_CHUNK_SIZE);
+        return BLX_CHUNK_SIZE;
+    }
+
+    return size;
+}
+
+/* large blx files are cut into g_blx_chunk_size byte ranges decoded in parallel */
+void metadata_dispatch_blx_file(threadpool tpool, THREAD_PARAMETER * tp, uint64 blx_size)
+{
+    tp->chunk_nums = 0;
+    tp->chunks     = NULL;
+    tp->tpool      = tpool;
+    tp->blx_size   = blx_size;
+
+    if (blx_size <= BLX_STARTING_POINT + 2 * g_blx_chunk_size) {
+        tp_dispatch(tpool, metadata_single_blx_file, (void *)tp);
+    } else {
+        tp_dispatch(tpool, metadata_split_blx_file, (void *)tp);
+    }
+}
+
+/* one directory of the walk: blx files go to the list, sub directories are walked by other pool threads */
+void metadata_walk_directory(void * arg)
+{
+    BLX_WALK_DIR   * dir = (BLX_WALK_DIR *)arg;
+    BLX_WALK_DIR   * sub;
+    LINUX_DIRENT64 * entry;
+
+    char   buffer[32 * 1024];
+    char   path[MAX_PATH_LEN];
+    long   nread,offset;
+    int    dir_fd;
+    uint8  type;
+    struct stat stbuf;
+
+    dir_fd = open(dir->path, O_RDONLY | O_DIRECTORY);
+    if (dir_fd == -1) {
+        fprintf(stderr,"Could not open %s\n",dir->path);
+        free(dir);
+        return;
+    }
+
+    while ((nread = syscall(SYS_getdents64, dir_fd, buffer, sizeof(buffer))) > 0) {
+
+        for (offset = 0; offset < nread; offset += entry->d_reclen) {
+
+            entry = (LINUX_DIRENT64 *)(buffer + offset);
+            type  = entry->d_type;
+
+            if (strcmp(entry->d_name,".") == 0 || strcmp(entry->d_name,"..") == 0) {
+                continue;
+            }
+
+            if (type != DT_DIR && type != DT_REG && type != DT_UNKNOWN) {
+                continue;   /* like find -type f, symbolic links are not followed */
+            }
+
+            if (type == DT_REG && fnmatch("*.blx",entry->d_name,0) != 0) {
+                continue;
+            }
+
+            /* size and modification time of a blx file, or what the file system did not tell */
+            if (type != DT_DIR) {
+                if (fstatat(dir_fd, entry->d_name, &stbuf, AT_SYMLINK_NOFOLLOW) == -1) {
+                    continue;
+                }
+
+                type = (S_ISDIR(stbuf.st_mode) ? DT_DIR : (S_ISREG(stbuf.st_mode) ? DT_REG : DT_UNKNOWN));
+                if (type == DT_UNKNOWN || (type == DT_REG && fnmatch("*.blx",entry->d_name,0) != 0)) {
+                    continue;
+                }
+            }
+
+            if (snprintf(path,MAX_PATH_LEN,"%s%s%s",dir->path,(dir->path[strlen(dir->path)-1] == '/' ? "" : "/"),
+                         entry->d_name) >= MAX_PATH_LEN) {
+                fprintf(stderr,"Path too long, %s/%s is skipped\n",dir->path,entry->d_name);
+                continue;
+            }
+
+            if (type == DT_DIR) {
+                sub = malloc(sizeof(BLX_WALK_DIR));
+                if (sub == NULL) {
+                    fprintf(stderr,"metadata_walk_directory@Out of memory\n");
+                    exit(EXIT_FAILURE);
+                }
+
+                sub->list  = dir->list;
+                sub->tpool = dir->tpool;
+                strcpy(sub->path,path);
+
+                tp_dispatch(dir->tpool, metadata_walk_directory, (void *)sub);
+
+            } else {
+                blx_file_list_add(dir->list,path,stbuf.st_size,stbuf.st_mtime);
+            }
+        }
+    }
+
+    close(dir_fd);
+    free(dir);
+}
+
+/* every blx file under the working directory with its size and modification time,
+   sorted like 'ls -l --sort=extension $(find $PWD -type f -name '*.blx')' and then by sort_filelist
+ */
+uint32 metadata_find_blx_files(BLX_FILE_LIST * list)
+{
+    BLX_WALK_DIR * root;
+    threadpool     tpool;
+    char         * pwd = getenv("PWD");
+    struct stat    pwd_stbuf,cwd_stbuf;
+
+    memset(list,0x0,sizeof(BLX_FILE_LIST));
+    pthread_mutex_init(&list->lock,NULL);
+
+    root = malloc(sizeof(BLX_WALK_DIR));
+    if (root == NULL) {
+        fprintf(stderr,"metadata_find_blx_files@Out of memory\n");
+        return 0;
+    }
+
+    /* $PWD keeps the path the user went through, as long as it is still the working directory */
+    if (pwd != NULL && strlen(pwd) < MAX_PATH_LEN && stat(pwd,&pwd_stbuf) == 0 && stat(".",&cwd_stbuf) == 0 &&
+        pwd_stbuf.st_dev == cwd_stbuf.st_dev && pwd_stbuf.st_ino == cwd_stbuf.st_ino) {
+        strcpy(root->path,pwd);
+    } else if (getcwd(root->path,MAX_PATH_LEN) == NULL) {
+        fprintf(stderr,"Can not get the working directory\n");
+        free(root);
+        return 0;
+    }
+
+    tpool = tp_init_threadpool(MAX_NUM_THREADS);
+
+    root->list  = list;
+    root->tpool = tpool;
+    tp_dispatch(tpool, metadata_walk_directory, (void *)root);
+
+    /* returns when the last directory is walked */
+    tp_destroy_threadpool(tpool);
+
+    sort_filelist(list);
+
+    return list->nums;
+}
+
+/* a meta file the last run left is still good if its header is */
+uint8 metadata_cached_file_ok(const char * meta_file)
+{
+    META_FILE_HEADER mfh;
+    FILE * fd_meta;
+    uint8  bret;
+
+    if ((fd_meta = fopen(meta_file,"rb")) == 0) {
+        return FALSE;
+    }
+
+    bret = fread(&mfh,sizeof(META_FILE_HEADER),1,fd_meta) == 1 && mfh.magic == META_FILE_MAGIC &&
+           mfh.version == META_FILE_VERSION;
+
+    fclose(fd_meta);
+
+    return bret;
+}
+
+/* everything in the meta folder goes but the meta files being reused,
+   and the csv with its index and checkpoint, build_csv tells if they are still good
+ */
+void metadata_clean_folder(void)
+{
+    DIR * dir;
+    struct dirent * entry;
+    char  path[MAX_PATH_LEN];
+    uint32 len,suffix = strlen(DECODE_CACHE_REUSE_SUFFIX);
+
+    if ((dir = opendir(DEFAULT_META_FOLDER_PREFIX)) == NULL) {
+        return;
+    }
+
+    while ((entry = readdir(dir)) != NULL) {
+
+        len = strlen(entry->d_name);
+        if (strcmp(entry->d_name,".") == 0 || strcmp(entry->d_name,"..") == 0 ||
+            (len > suffix && strcmp(entry->d_name + len - suffix,DECODE_CACHE_REUSE_SUFFIX) == 0)) {
+            continue;
+        }
+
+        if (snprintf(path,MAX_PATH_LEN,"%s%s",DEFAULT_META_FOLDER_PREFIX,entry->d_name) >= MAX_PATH_LEN ||
+            strcmp(path,DEFAULT_META_FILE) == 0 || strcmp(path,DEFAULT_META_INDEX_FILE) == 0 ||
+            strcmp(path,DEFAULT_CHECKPOINT_FILE) == 0) {
+            continue;
+        }
+
+        unlink(path);
+    }
+
+    closedir(dir);
+}
+
+/* -b: the blx files that did not change since the last run keep their meta files, moved to their new file index.
+   Returns which files are reused, next gets every file for the cache of this run
+ */
+uint8 * metadata_reuse_cached_files(BLX_FILE_LIST * list, uint32 tracetype, DECODE_CACHE * next, uint32 * reused)
+{
+    DECODE_CACHE cache;
+    const DECODE_CACHE_ENTRY * entry;
+
+    char   meta_file[MAX_PATH_LEN];
+    char   reuse_file[MAX_PATH_LEN + 8];
+    char   blx_path[MAX_PATH_LEN];
+    uint8  * reuse;
+    uint64 tail_hash;
+    uint32 i;
+
+    *reused = 0;
+    decode_cache_init(next);
+
+    reuse = calloc(list->nums + 1,sizeof(uint8));
+    if (reuse == NULL) {
+        fprintf(stderr,"metadata_reuse_cached_files@Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    decode_cache_load(&cache,DEFAULT_DECODE_CACHE_FILE);
+
+    /* move the good meta files out of the way first, a file index may be taken by another blx file now */
+    for (i = 0; i < list->nums; i++) {
+
+        tail_hash = blx_file_tail_hash(list->files[i].filepath,list->files[i].size);
+        decode_cache_add(next,&list->files[i],tail_hash,tracetype,i);
+
+        entry = decode_cache_find(&cache,list->files[i].filepath);
+        if (entry == NULL || entry->size != list->files[i].size || entry->mtime != list->files[i].mtime ||
+            entry->tail_hash != tail_hash || entry->tracetype != tracetype) {
+            continue;
+        }
+
+        strncpy(blx_path,list->files[i].filepath,MAX_PATH_LEN - 1);
+        blx_path[MAX_PATH_LEN - 1] = 0x0;
+        sprintf(meta_file,"%s%s.%d%s",DEFAULT_META_FOLDER_PREFIX,basename(blx_path),entry->fileindex,DEFAULT_META_FILE_SUFFRIX);
+        sprintf(reuse_file,"%s.%d%s",meta_file,i,DECODE_CACHE_REUSE_SUFFIX);
+
+        if (metadata_cached_file_ok(meta_file) && rename(meta_file,reuse_file) == 0) {
+            reuse[i] = TRUE;
+            (*reused)++;
+        }
+    }
+
+    metadata_clean_folder();
+
+    for (i = 0; i < list->nums; i++) {
+
+        if (!reuse[i]) {
+            continue;
+        }
+
+        strncpy(blx_path,list->files[i].filepath,MAX_PATH_LEN - 1);
+        blx_path[MAX_PATH_LEN - 1] = 0x0;
+        entry = decode_cache_find(&cache,list->files[i].filepath);
+
+        sprintf(meta_file,"%s%s.%d%s",DEFAULT_META_FOLDER_PREFIX,basename(blx_path),entry->fileindex,DEFAULT_META_FILE_SUFFRIX);
+        sprintf(reuse_file,"%s.%d%s",meta_file,i,DECODE_CACHE_REUSE_SUFFIX);
+        sprintf(meta_file,"%s%s.%d%s",DEFAULT_META_FOLDER_PREFIX,basename(blx_path),i,DEFAULT_META_FILE_SUFFRIX);
+
+        if (rename(reuse_file,meta_file) != 0) {
+            fprintf(stderr,"metadata_reuse_cached_files@Move %s failed\n",reuse_file);
+            unlink(reuse_file);
+            reuse[i] = FALSE;
+            (*reused)--;
+        }
+    }
+
+    decode_cache_free(&cache);
+
+    return reuse;
+}
+
+/* bReplay: -bg option, decoded records are replayed into the csv file in memory and no meta file is written.
+   Otherwise only the blx files that changed since the last -b are decoded, see metadata_reuse_cached_files
+ */
+uint8 build_metadata(char * trace_type, uint8 bReplay, uint32 init_free_heap, uint8 bCheckHeapInit)
+{
+    uint8 bret = FALSE;
+
+    FILE * fd_meta_list_file = NULL;
+    FILE * fd_date_file;
+
+    META_STREAM * streams = NULL;
+    BLX_FILE_LIST blx_files;
+    DECODE_CACHE  decode_cache;
+    uint8       * reuse = NULL;
+    uint32        reused = 0;
+    BLX_FILE_INFO * blx_file;
+
+    char   meta_file_path[MAX_PATH_LEN+1] = {0};
+
+    uint32 t_type = (trace_type == NULL ? 0 : strtouint32(trace_type));
+    uint32 fileindex;
+    uint32 filenums = 0;
+    uint64 total_bytes = 0;
+    uint64 written_bytes,flushes;
+
+    struct timeval startTime;
+    struct timeval endTime;
+
+    threadpool tpool;
+    
+    THREAD_PARAMETER * tp;
+
+    double wall_clock_counter = 0;
+
+    static uint8 has_start_date = FALSE; /* we need an initialization date to cover 120 hours timeline */
+    struct tm * tm_date;
+
+    g_blx_chunk_size = metadata_chunk_size();
+
+    if (bReplay) {
+        system(REMOVE_DEFAULT_META_FOLDER);
+        system(CREATE_DEFAULT_META_FOLDER);
+    } else {
+        mkdir(DEFAULT_META_FOLDER_PREFIX,0755);
+    }
+
+    /* sorted list of all blx files with their size and modification time */
+    filenums = metadata_find_blx_files(&blx_files);
+    if (filenums == 0) {
+        blx_file_list_free(&blx_files);
+        return bret;
+    }
+
+    if (!bReplay) {
+        reuse = metadata_reuse_cached_files(&blx_files,t_type,&decode_cache,&reused);
+    }
+
+    if (bReplay) {
+        streams = calloc(filenums,sizeof(META_STREAM));
+        if (streams == NULL) {
+            blx_file_list_free(&blx_files);
+            fprintf(stderr,"build_metadata@2@Out of memory\n");
+            return bret;
+        }
+    } else if ((fd_meta_list_file = fopen(META_FILE_LIST,"a")) == 0) {
+        blx_file_list_free(&blx_files);
+        decode_cache_free(&decode_cache);
+        free(reuse);
+        fprintf(stderr,"build_metadata@2@Read %s failed\n",META_FILE_LIST);
+        return bret;
+    }
+
+    /* get the current time(wall-clock time)
+       - NULL because we don't care about time zone
+     */
+    gettimeofday(&startTime, NULL);
+    fileindex = 0;
+    
+    /* threads are running already, each file is decoded while the rest of the list is dispatched */
+    tpool = tp_init_threadpool(MAX_NUM_THREADS);
+
+    for (fileindex = 0; fileindex < filenums; fileindex++) {
+
+        blx_file = &blx_files.files[fileindex];
+
+        /* get first file's date as base date */ 
+        if (has_start_date == FALSE || g_trace_date.day == 0)  {
+            tm_date = localtime(&blx_file->mtime);
+
+            g_trace_date.day   = tm_date->tm_mday;
+            g_trace_date.month = tm_date->tm_mon+1;
+            g_trace_date.year  = tm_date->tm_year+1900;
+
+            has_start_date = TRUE;
+
+            if (bReplay) {
+                /* -bg replays with g_trace_date directly */
+            } else if ((fd_date_file = fopen(TRACE_START_DATE,"wb")) == 0) {
+                SET_DEFAULT_START_DATE(g_trace_date);                
+            } else {
+                fwrite((const void *)&g_trace_date,sizeof(g_trace_date),1,fd_date_file);
+                fclose(fd_date_file);
+            }
+        }        
+
+        if (reuse != NULL && reuse[fileindex]) {
+            sprintf(meta_file_path,"%s%s.%d%s\n",DEFAULT_META_FOLDER_PREFIX,basename(blx_file->filepath),fileindex,DEFAULT_META_FILE_SUFFRIX);
+            fwrite(meta_file_path,strlen(meta_file_path),1,fd_meta_list_file);
+            continue;
+        }
+
+        total_bytes += blx_file->size;
+
+        /* add a job with input parameters(blx_file) into thread pool. The job will handle by metadata_single_blx_file function */
+        tp = malloc(sizeof(THREAD_PARAMETER));
+        
+        tp->tracetype = t_type;
+        tp->fileindex = fileindex;
+        strncpy(tp->filepath,blx_file->filepath,MAX_PATH_LEN);
+        tp->stream    = NULL;
+
+        if (bReplay) {
+            tp->stream = &streams[tp->fileindex];
+            meta_buffer_init(&tp->stream->buffer,NULL);
+            pthread_mutex_init(&tp->stream->lock,NULL);
+            pthread_cond_init(&tp->stream->cond_done,NULL);
+        } else {
+            sprintf(meta_file_path,"%s%s.%d%s\n",DEFAULT_META_FOLDER_PREFIX,basename(blx_file->filepath),tp->fileindex,DEFAULT_META_FILE_SUFFRIX);
+            fwrite(meta_file_path,strlen(meta_file_path),1,fd_meta_list_file);
+        }
+
+        metadata_dispatch_blx_file(tpool, tp, blx_file->size);
+
+    } /* end-for */
+
+    if (fd_meta_list_file != NULL) {
+        fclose(fd_meta_list_file);
+    }
+
+    if (bReplay) {
+        /* replay in file order while the later files are still being decoded */
+        replay_meta_streams(streams,fileindex,init_free_heap,bCheckHeapInit);
+        free(streams);
+    }
+
+    tp_destroy_threadpool(tpool);
+    blx_file_list_free(&blx_files);
+
+    /* only now all meta files are complete */
+    if (!bReplay) {
+        decode_cache_save(&decode_cache,DEFAULT_DECODE_CACHE_FILE);
+        decode_cache_free(&decode_cache);
+        free(reuse);
+    }
+
+    /* get the end time */
+    gettimeofday(&endTime, NULL);
+
+    /* calculate time in microseconds */
+    wall_clock_counter = (endTime.tv_sec*1000000  + (endTime.tv_usec)) - (startTime.tv_sec*1000000 + (startTime.tv_usec));
+
+    fprintf(stdout,"---------------------------------------------------\n");
+    fprintf(stdout,"Time cost:%f minutes\n",wall_clock_counter/(1000000*60));
+    if (wall_clock_counter > 0) {
+        fprintf(stdout,"Decoded %llu bytes, %f MB/s\n",total_bytes,total_bytes/wall_clock_counter);
+    }
+
+    if (reused > 0) {
+        fprintf(stdout,"Reused the meta files of %u of %u blx files\n",reused,filenums);
+    }
+
+    output_writer_stats(&written_bytes,&flushes);
+    fprintf(stdout,"Wrote %llu bytes in %llu flushes\n",written_bytes,flushes);
+
+    bret = TRUE;
+
+    return bret;
+}
+
+/* -f: set by SIGINT/SIGTERM, the csv and its index are left complete */
+static volatile sig_atomic_t g_follow_stop = FALSE;
+
+void follow_stop(int signum)
+{
+    (void)signum;
+    g_follow_stop = TRUE;
+}
+
+uint8 follow_open(BLX_FOLLOW * follow, const char * filepath)
+{
+    memset(follow,0x0,sizeof(BLX_FOLLOW));
+
+    strncpy(follow->filepath,filepath,MAX_PATH_LEN - 1);
+    follow->base = BLX_STARTING_POINT;
+    follow->pos  = BLX_STARTING_POINT;
+
+    if ((follow->fd = open(filepath, O_RDONLY)) == -1) {
+        fprintf(stderr,"Could not open %s\n",filepath);
+        return FALSE;
+    }
+
+    fprintf(stdout,"Following %s\n",filepath);
+
+    return TRUE;
+}
+
+void follow_close(BLX_FOLLOW * follow)
+{
+    if (follow->fd != -1) {
+        close(follow->fd);
+    }
+
+    free(follow->buffer);
+    memset(follow,0x0,sizeof(BLX_FOLLOW));
+    follow->fd = -1;
+}
+
+/* read what was written since the last call, the bytes before the next probe are dropped first.
+   Returns the number of new bytes
+ */
+uint64 follow_read(BLX_FOLLOW * follow)
+{
+    struct stat stbuf;
+    uint64 shift,want;
+    ssize_t got;
+
+    if (fstat(follow->fd,&stbuf) == -1 || (uint64)stbuf.st_size <= follow->base + follow->len) {
+        return 0;
+    }
+
+    shift = MIN(follow->pos,follow->base + follow->len) - follow->base;
+    memmove(follow->buffer,follow->buffer + shift,follow->len - shift);
+    follow->base += shift;
+    follow->len  -= shift;
+
+    /* a part that is already long is taken a chunk at a time */
+    want = MIN(stbuf.st_size - follow->base - follow->len,BLX_CHUNK_SIZE);
+
+    if (follow->len + want > follow->capacity) {
+        follow->capacity = MAX(follow->len + want,follow->capacity * 2);
+        follow->buffer   = realloc(follow->buffer,follow->capacity);
+        if (follow->buffer == NULL) {
+            fprintf(stderr,"follow_read@Out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    got = pread(follow->fd,follow->buffer + follow->len,want,follow->base + follow->len);
+    if (got <= 0) {
+        return 0;
+    }
+
+    follow->len += got;
+
+    return got;
+}
+
+/* decode the trace items that are complete in the buffer, the walk is the one decode_blx_range does on
+   the whole file: an item is only probed once its header and body are there, and a scan that finds no
+   header goes on from where a header could still start
+ */
+void follow_decode(BLX_FOLLOW * follow, META_RECORD_BUFFER * out)
+{
+    const uint64 probe = sizeof(STANDARD_MTBF_TRACE_HEADER) + sizeof(STANDARD_MTBF_TRACE_BODY);
+
+    uint64 end = follow->base + follow->len;
+    uint64 next;
+    uint8  is_item,is_heap;
+
+    META_RECORD record;
+
+    while (follow->pos >= follow->base && follow->pos + probe <= end) {
+
+        next = decode_blx_item(follow->buffer,follow->len,follow->pos - follow->base,TRACE_TYPE_DEFAULT,
+                               &record,&is_item,&is_heap) + follow->base;
+
+        if (is_heap) {
+            meta_buffer_append(out,&record);
+        }
+
+        if (!is_item && next == end) {
+            follow->pos = end - sizeof(STANDARD_MTBF_TRACE_HEADER) + 1;
+            break;
+        }
+
+        follow->pos = next;
+    }
+}
+
+/* -f: replay the blx files like -bg(from the heap init on), then keep following the newest part and append
+   csv lines as the capture writes them. When a part stops growing the directories are walked for the next one.
+   Runs until it is interrupted
+ */
+uint8 opt_handler_f(uint32 poll_seconds, uint32 init_free_heap)
+{
+    struct stat stbuf;
+
+    OUTPUT_WRITER * writer;
+    FILE * fd_date_file;
+    int    fd_csv;
+
+    BLX_FILE_LIST blx_files;
+    BLX_FOLLOW    follow;
+    META_RECORD_BUFFER records;
+    REPLAY_STATE  rs;
+    META_INDEX    index;
+    struct tm   * tm_date;
+
+    uint32 current = 0;
+    uint32 idle    = 0;
+    uint32 i;
+    uint64 saved_lines = 0;
+
+    mkdir(DEFAULT_META_FOLDER_PREFIX,0755);
+
+    signal(SIGINT,follow_stop);
+    signal(SIGTERM,follow_stop);
+
+    while (metadata_find_blx_files(&blx_files) == 0) {
+        blx_file_list_free(&blx_files);
+        if (g_follow_stop) {
+            return FALSE;
+        }
+        fprintf(stdout,"Waiting for blx files...\n");
+        sleep(poll_seconds);
+    }
+
+    /* the first file's date is the base date, as with -b */
+    tm_date = localtime(&blx_files.files[0].mtime);
+    g_trace_date.day   = tm_date->tm_mday;
+    g_trace_date.month = tm_date->tm_mon+1;
+    g_trace_date.year  = tm_date->tm_year+1900;
+
+    if ((fd_date_file = fopen(TRACE_START_DATE,"wb")) != 0) {
+        fwrite((const void *)&g_trace_date,sizeof(g_trace_date),1,fd_date_file);
+        fclose(fd_date_file);
+    }
+
+    /* the csv is not the one the checkpoint was taken for any more */
+    unlink(DEFAULT_CHECKPOINT_FILE);
+    system(REMOVE_DEFAULT_META_FILE);
+    if ((fd_csv = open(DEFAULT_META_FILE,O_WRONLY | O_CREAT | O_APPEND,0644)) == -1) {
+        blx_file_list_free(&blx_files);
+        fprintf(stderr,"Create %s failed\n",DEFAULT_META_FILE);
+        return FALSE;
+    }
+
+    writer = output_writer_thread();
+    output_writer_open(writer,fd_csv);
+
+    replay_init_state(&rs);
+    meta_index_init(&index);
+    meta_buffer_init(&records,NULL);
+
+    follow_open(&follow,blx_files.files[0].filepath);
+    replay_begin_file(&rs,init_free_heap);
+
+    while (!g_follow_stop) {
+
+        if (follow.fd != -1 && follow_read(&follow) > 0) {
+
+            follow_decode(&follow,&records);
+            replay_meta_records(&rs,records.records,records.nums,writer,&index,TRUE);
+            records.nums = 0;
+            idle = 0;
+
+            continue;
+        }
+
+        /* nothing new in this part: a later part means it is complete */
+        if (current + 1 == blx_files.nums && ++idle % FOLLOW_RESCAN_POLLS == 0) {
+
+            blx_file_list_free(&blx_files);
+            metadata_find_blx_files(&blx_files);
+
+            /* a part renamed or removed while it is followed is put back, the parts after it in sort order
+               are still followed in turn and none before it is replayed again
+             */
+            for (i = 0; i < blx_files.nums && strcmp(blx_files.files[i].filepath,follow.filepath) != 0; i++) {
+            }
+            if (i == blx_files.nums) {
+                memset(&stbuf,0x0,sizeof(stbuf));
+                fstat(follow.fd,&stbuf);
+
+                blx_file_list_add(&blx_files,follow.filepath,stbuf.st_size,stbuf.st_mtime);
+                sort_filelist(&blx_files);
+
+                for (i = 0; strcmp(blx_files.files[i].filepath,follow.filepath) != 0; i++) {
+                }
+            }
+            current = i;
+        }
+
+        if (current + 1 < blx_files.nums) {
+
+            /* what was written to this part after the last read, before the next part showed up */
+            while (follow.fd != -1 && follow_read(&follow) > 0) {
+                follow_decode(&follow,&records);
+                replay_meta_records(&rs,records.records,records.nums,writer,&index,TRUE);
+                records.nums = 0;
+            }
+
+            follow_close(&follow);
+            follow_open(&follow,blx_files.files[++current].filepath);
+            replay_begin_file(&rs,init_free_heap);
+            meta_index_next_file(&index);
+            idle = 0;
+            continue;
+        }
+
+        /* caught up: make the new lines visible to -t/-z and plots */
+        if (index.lines != saved_lines) {
+            output_writer_flush(writer);
+            meta_index_save(&index,DEFAULT_META_INDEX_FILE);
+            saved_lines = index.lines;
+        }
+
+        sleep(poll_seconds);
+    }
+
+    follow_close(&follow);
+    meta_buffer_free(&records);
+    blx_file_list_free(&blx_files);
+    halloc_info_table_free(&g_heap_table);
+
+    output_writer_close(writer);
+    meta_index_save(&index,DEFAULT_META_INDEX_FILE);
+
+    fprintf(stdout,"Stopped, %llu csv lines in %s\n",index.lines,DEFAULT_META_FILE);
+    meta_index_free(&index);
+
+    return TRUE;
+}
+
+uint8 sampling_csv_from_meta(uint64 sample_rate)
+{
+    uint8 bret = FALSE;
+
+    FILE * fd_metadata;
+    FILE * fd_csv;
+
+    uint64 counter = 0; 
+
+    char single_file_path[MAX_PATH_LEN+1] = {0};
+    char csv_file[MAX_PATH_LEN] = {0};
+
+    if (sample_rate <= 1) {
+        return bret; /* just same as meta data */ 
+    }
+
+    if ((fd_metadata = fopen(DEFAULT_META_FILE,"r")) == 0) {
+        printf("Read metadata file failed\n");
+        return bret;
+    }
+
+    sprintf(csv_file,"rm -f ./%s%llu.csv",DEFAULT_CSV_FILE_PREFIX,sample_rate);
+    system(csv_file);
+
+    sprintf(csv_file,"./%slines_%llu.csv",DEFAULT_CSV_FILE_PREFIX,sample_rate);
+    if ((fd_csv = fopen(csv_file,"a")) == 0) {
+        fprintf(stderr,"Create csv file failed\n");
+        return bret;
+    }
+
+    while (fgets(single_file_path, MAX_PATH_LEN, fd_metadata) != 0)  {
+
+        if (counter == 0) {
+            /* always need the first line of meta data because it is the first point of Y axis*/ 
+            fwrite(single_file_path,strlen(single_file_path),1,fd_csv);
+            counter++;  
+            continue;
+        }
+
+        if (counter++ < sample_rate) {
+            continue;    
+        }
+
+        fwrite(single_file_path,strlen(single_file_path),1,fd_csv);
+        counter = 1;
+    }
+
+    fclose(fd_metadata);
+    fclose(fd_csv);
+
+    bret = TRUE;
+    return bret;
+}
+
+/* -t: write the min/max/mean/last free heap of a bucket after the time of its first line */
+void csv_bucket_write(FILE * fd_new_csv, const CSV_BUCKET * bucket)
+{
+    fprintf(fd_new_csv,"%.*s, %08d, %08d, %08d, %08d\n",(int)sizeof(META_DATE),bucket->first,
+            bucket->min,bucket->max,(uint32)(bucket->sum / bucket->lines),bucket->last);
+}
+
+void csv_point_bucket_add(CSV_POINT_BUCKET * bucket, const CSV_POINT * point)
+{
+    if (bucket->nums == bucket->capacity) {
+        bucket->capacity = bucket->capacity == 0 ? 1024 : bucket->capacity * 2;
+        bucket->points   = realloc(bucket->points,bucket->capacity * sizeof(CSV_POINT));
+        if (bucket->points == NULL) {
+            fprintf(stderr,"csv_point_bucket_add@Out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    bucket->points[bucket->nums++] = *point;
+}
+
+/* -t lttb: largest triangle three buckets, keep the point of the bucket making the largest triangle with
+   the point kept from the previous bucket(selected) and the average point of the next bucket.
+   Times are in seconds from origin so the doubles keep their precision
+ */
+void csv_point_bucket_select(FILE * fd_new_csv, CSV_POINT_BUCKET * bucket, CSV_POINT * selected,
+                             double next_time, double next_heap, uint64 origin)
+{
+    double ax,ay,bx,by,area;
+    double largest = -1;
+    uint32 i,k = 0;
+
+    if (bucket->nums == 0) {
+        return;
+    }
+
+    ax = (sint64)(selected->time - origin) / (double)TIME_UNIT;
+    ay = selected->free_heap;
+
+    for (i = 0; i < bucket->nums; i++) {
+        bx   = (sint64)(bucket->points[i].time - origin) / (double)TIME_UNIT;
+        by   = bucket->points[i].free_heap;
+        area = fabs((ax - next_time) * (by - ay) - (ax - bx) * (next_heap - ay));
+        if (area > largest) {
+            largest = area;
+            k       = i;
+        }
+    }
+
+    *selected = bucket->points[k];
+    fwrite(selected->line,strlen(selected->line),1,fd_new_csv);
+
+    bucket->nums = 0;
+}
+
+void csv_point_bucket_average(const CSV_POINT_BUCKET * bucket, uint64 origin, double * time, double * heap)
+{
+    uint32 i;
+
+    *time = 0;
+    *heap = 0;
+
+    for (i = 0; i < bucket->nums; i++) {
+        *time += (sint64)(bucket->points[i].time - origin) / (double)TIME_UNIT;
+        *heap += bucket->points[i].free_heap;
+    }
+
+    *time /= bucket->nums;
+    *heap /= bucket->nums;
+}
+
+/* -t <minutes> [lttb] option
+      split the csv in buckets of <minutes> from its first line, a bucket starts again when the csv
+      goes back in time to another capture. 
+
+      Without lttb, one line for each bucket: the time of its first line, then the lowest, highest, mean
+      and last free heap of the bucket.
+
+      With lttb, one line of the csv for each bucket, picked by largest triangle three buckets so the
+      shape of the full csv(and its low-water spikes) is kept. The first and the last line are always kept
+ */
+uint8 opt_handler_t(char * time, uint8 bLttb)
+{
+    uint8 bret = FALSE;
+
+    uint32 time_step = strtouint32(time);
+    uint64 width,index;
+    uint64 origin = 0;
+
+    FILE * fd_meta_csv;
+    FILE * fd_new_csv;
+
+    CSV_BUCKET       bucket;
+    CSV_POINT        point,selected;
+    CSV_POINT_BUCKET buckets[2];    /* the current bucket and the one after it */
+    CSV_POINT_BUCKET swap;
+    double           next_time,next_heap;
+
+    uint8 first_line = TRUE;
+
+    char new_file[MAX_PATH_LEN];
+
+    if (time_step == 0) {
+        return bret;
+    }
+
+    sprintf(new_file,"./%s%dminutes%s.csv",DEFAULT_CSV_FILE_PREFIX,time_step,bLttb ? "_lttb" : "");
+
+    if( (fd_meta_csv = fopen(DEFAULT_META_FILE,"r")) == 0) {
+        fprintf(stderr,"Can not open :%s\n",DEFAULT_META_FILE);
+        return bret;
+    }
+
+    if( (fd_new_csv = fopen(new_file,"w")) == 0) {
+        fprintf(stderr,"Can not open :%s\n",new_file);
+        fclose(fd_meta_csv);
+        return bret;
+    }
+
+    width = (uint64)time_step * 60 * TIME_UNIT;
+
+    memset(&bucket,0x0,sizeof(CSV_BUCKET));
+    memset(buckets,0x0,sizeof(buckets));
+
+    while (fgets(point.line, MAX_SINGLE_METADATA_LEN, fd_meta_csv) != 0)  {
+
+        if (!csv_line_time(point.line,&point.time)) {
+            continue;
+        }
+
+        point.free_heap = strtouint32(((CSV_FORMAT_UNIT *)point.line)->freesize);
+
+        if (first_line == TRUE) {
+            origin     = point.time;
+            selected   = point;
+            first_line = FALSE;
+
+            if (bLttb) {
+                /* always need the first line of meta data because it is the first point of Y axis*/ 
+                fwrite(point.line,strlen(point.line),1,fd_new_csv);
+                continue;
+            }
+        }
+
+        index = (sint64)(point.time - origin) < 0 ? 0 : (point.time - origin) / width;
+
+        if (!bLttb) {
+
+            if (bucket.lines > 0 && bucket.index != index) {
+                csv_bucket_write(fd_new_csv,&bucket);
+                bucket.lines = 0;
+            }
+
+            if (bucket.lines == 0) {
+                bucket.index = index;
+                bucket.sum   = 0;
+                bucket.min   = point.free_heap;
+                bucket.max   = point.free_heap;
+                strcpy(bucket.first,point.line);
+            }
+
+            bucket.lines++;
+            bucket.sum  += point.free_heap;
+            bucket.min   = MIN(bucket.min,point.free_heap);
+            bucket.max   = MAX(bucket.max,point.free_heap);
+            bucket.last  = point.free_heap;
+            continue;
+        }
+
+        if (buckets[0].nums == 0 || (buckets[1].nums == 0 && buckets[0].index == index)) {
+            buckets[0].index = index;
+            csv_point_bucket_add(&buckets[0],&point);
+            continue;
+        }
+
+        if (buckets[1].nums > 0 && buckets[1].index != index) {
+            /* the bucket after the current one is complete */
+            csv_point_bucket_average(&buckets[1],origin,&next_time,&next_heap);
+            csv_point_bucket_select(fd_new_csv,&buckets[0],&selected,next_time,next_heap,origin);
+
+            swap       = buckets[0];
+            buckets[0] = buckets[1];
+            buckets[1] = swap;
+        }
+
+        buckets[1].index = index;
+        csv_point_bucket_add(&buckets[1],&point);
+    }
+
+    if (!bLttb && bucket.lines > 0) {
+        csv_bucket_write(fd_new_csv,&bucket);
+    }
+
+    /* the last line is a bucket of its own */
+    if (buckets[0].nums > 0) {
+
+        point = buckets[1].nums > 0 ? buckets[1].points[--buckets[1].nums] : buckets[0].points[--buckets[0].nums];
+
+        if (buckets[1].nums > 0) {
+            csv_point_bucket_average(&buckets[1],origin,&next_time,&next_heap);
+        } else {
+            next_time = (sint64)(point.time - origin) / (double)TIME_UNIT;
+            next_heap = point.free_heap;
+        }
+
+        csv_point_bucket_select(fd_new_csv,&buckets[0],&selected,next_time,next_heap,origin);
+        csv_point_bucket_select(fd_new_csv,&buckets[1],&selected,(sint64)(point.time - origin) / (double)TIME_UNIT,
+                                point.free_heap,origin);
+
+        fwrite(point.line,strlen(point.line),1,fd_new_csv);
+    }
+
+    free(buckets[0].points);
+    free(buckets[1].points);
+
+    fclose(fd_meta_csv);
+    fclose(fd_new_csv);
+
+    bret = TRUE;
+    return bret;
+}
+
+/* -s <lines> option
+      set the sampling rate by specifying the lines of the increment on the X-axis between lines in the full csv file
+      generated by scan_all function. 
+
+      For example, the original full csv file has 90000 lines. You can reduce the sampling rate by getting a sample point for every 1000 line
+        $ma -s 10000
+ */
+uint8 opt_handler_s(char * in)
+{
+    uint8 bret = FALSE;
+    char * sampling_rate_lines = 0;
+    char * endptr = NULL; 
+    uint64 sample_rate;
+
+    sampling_rate_lines = in;
+         
+    /* To distinguish success/failure after call */
+    errno = 0;
+    sample_rate = strtoll(sampling_rate_lines, &endptr, 10);
+
+    /* Check for various possible errors */
+    if ( errno == ERANGE || (errno != 0 && sample_rate == 0) || endptr == sampling_rate_lines)  {
+        return bret;
+    }
+
+    sampling_csv_from_meta(sample_rate);
+
+    bret = TRUE;
+    return bret;
+}
+
+/* -r: names of ALLOCATION_TYPE in the report */
+static const char * g_allocation_type_names[AT_NUMS] = {
+    "unknown",
+    "heap_alloc",
+    "heap_alloc_no_wait",
+    "heap_cond_alloc",
+    "aligned_alloc_no_wait",
+    "aligned_alloc",
+    "alloc_no_wait_from"
+};
+
+void opt_handler_r_merge(REPLAY_JOB * job, void * arg)
+{
+    heap_report_merge((HEAP_REPORT *)arg,job->report);
+}
+
+void heap_report_print_text(const HEAP_REPORT * report)
+{
+    char   time_text[64];
+    double seconds = HEAP_REPORT_INTERVAL_MINUTES * 60.0;
+    uint32 i;
+
+    fprintf(stdout,"Heap report of %u meta files\n",report->meta_files);
+
+    if (report->allocations + report->deallocations == 0) {
+        fprintf(stdout,"No allocation or deallocation\n");
+        return;
+    }
+
+    format_csv_time(report->first_time,time_text);
+    fprintf(stdout,"  From                %s\n",time_text);
+    format_csv_time(report->last_time,time_text);
+    fprintf(stdout,"  To                  %s\n",time_text);
+    fprintf(stdout,"  Allocations         %llu\n",report->allocations);
+    fprintf(stdout,"  Deallocations       %llu\n",report->deallocations);
+
+    format_csv_time(report->min_free_heap_time,time_text);
+    fprintf(stdout,"  Lowest free heap    %d at %s\n",report->min_free_heap,time_text);
+    format_csv_time(report->max_free_heap_time,time_text);
+    fprintf(stdout,"  Highest free heap   %d at %s\n",report->max_free_heap,time_text);
+    format_csv_time(report->peak_live_blocks_time,time_text);
+    fprintf(stdout,"  Peak live blocks    %u at %s\n",report->peak_live_blocks,time_text);
+
+    if (report->largest.size > 0) {
+        format_csv_time(report->largest_time,time_text);
+        fprintf(stdout,"  Largest allocation  %u bytes at 0x%08X by 0x%08X/0x%08X(%s) at %s\n",
+                report->largest.size,report->largest.address,report->largest.caller1,report->largest.caller2,
+                g_allocation_type_names[report->largest.allocation_type < AT_NUMS ? report->largest.allocation_type : 0],
+                time_text);
+    }
+
+    fprintf(stdout,"\n  %-24s %12s %14s\n","Allocation type","Allocations","Bytes");
+    for (i = 0; i < AT_NUMS; i++) {
+        if (report->type_allocations[i] > 0) {
+            fprintf(stdout,"  %-24s %12llu %14llu\n",g_allocation_type_names[i],report->type_allocations[i],report->type_bytes[i]);
+        }
+    }
+
+    sprintf(time_text,"Every %d minutes from",HEAP_REPORT_INTERVAL_MINUTES);
+    fprintf(stdout,"\n  %-29s %12s %14s %10s %10s\n",time_text,"Allocations","Deallocations","Allocs/s","Frees/s");
+    for (i = 0; i < report->interval_nums; i++) {
+        if (report->intervals[i].allocations + report->intervals[i].deallocations == 0) {
+            continue;
+        }
+        format_csv_time((report->first_interval + i) * (HEAP_REPORT_INTERVAL_MINUTES * 60 * TIME_UNIT),time_text);
+        fprintf(stdout,"  %-29s %12llu %14llu %10.2f %10.2f\n",time_text,
+                report->intervals[i].allocations,report->intervals[i].deallocations,
+                report->intervals[i].allocations / seconds,report->intervals[i].deallocations / seconds);
+    }
+}
+
+void heap_report_print_json(const HEAP_REPORT * report)
+{
+    char   time_text[64];
+    uint8  first = TRUE;
+    uint32 i;
+
+    fprintf(stdout,"{\n  \"meta_files\": %u,\n",report->meta_files);
+    fprintf(stdout,"  \"allocations\": %llu,\n  \"deallocations\": %llu",report->allocations,report->deallocations);
+
+    if (report->allocations + report->deallocations > 0) {
+        format_csv_time(report->first_time,time_text);
+        fprintf(stdout,",\n  \"from\": \"%s\",\n",time_text);
+        format_csv_time(report->last_time,time_text);
+        fprintf(stdout,"  \"to\": \"%s\",\n",time_text);
+
+        format_csv_time(report->min_free_heap_time,time_text);
+        fprintf(stdout,"  \"min_free_heap\": {\"value\": %d, \"time\": \"%s\"},\n",report->min_free_heap,time_text);
+        format_csv_time(report->max_free_heap_time,time_text);
+        fprintf(stdout,"  \"max_free_heap\": {\"value\": %d, \"time\": \"%s\"},\n",report->max_free_heap,time_text);
+        format_csv_time(report->peak_live_blocks_time,time_text);
+        fprintf(stdout,"  \"peak_live_blocks\": {\"value\": %u, \"time\": \"%s\"}",report->peak_live_blocks,time_text);
+    }
+
+    if (report->largest.size > 0) {
+        format_csv_time(report->largest_time,time_text);
+        fprintf(stdout,",\n  \"largest_allocation\": {\"size\": %u, \"address\": \"0x%08X\", \"caller1\": \"0x%08X\", "
+                "\"caller2\": \"0x%08X\", \"allocation_type\": \"%s\", \"time\": \"%s\"}",
+                report->largest.size,report->largest.address,report->largest.caller1,report->largest.caller2,
+                g_allocation_type_names[report->largest.allocation_type < AT_NUMS ? report->largest.allocation_type : 0],
+                time_text);
+    }
+
+    fprintf(stdout,",\n  \"allocation_types\": [");
+    for (i = 0; i < AT_NUMS; i++) {
+        if (report->type_allocations[i] > 0) {
+            fprintf(stdout,"%s\n    {\"type\": \"%s\", \"allocations\": %llu, \"bytes\": %llu}",first ? "" : ",",
+                    g_allocation_type_names[i],report->type_allocations[i],report->type_bytes[i]);
+            first = FALSE;
+        }
+    }
+    fprintf(stdout,"%s],\n",first ? "" : "\n  ");
+
+    first = TRUE;
+    fprintf(stdout,"  \"interval_minutes\": %d,\n  \"intervals\": [",HEAP_REPORT_INTERVAL_MINUTES);
+    for (i = 0; i < report->interval_nums; i++) {
+        if (report->intervals[i].allocations + report->intervals[i].deallocations == 0) {
+            continue;
+        }
+        format_csv_time((report->first_interval + i) * (HEAP_REPORT_INTERVAL_MINUTES * 60 * TIME_UNIT),time_text);
+        fprintf(stdout,"%s\n    {\"from\": \"%s\", \"allocations\": %llu, \"deallocations\": %llu}",first ? "" : ",",
+                time_text,report->intervals[i].allocations,report->intervals[i].deallocations);
+        first = FALSE;
+    }
+    fprintf(stdout,"%s]\n}\n",first ? "" : "\n  ");
+}
+
+/* -r [json] option
+      output a heap report of the meta files, as text or as json.
+
+      The meta files are replayed like -g does(default free heap, from the heap init on), each file is
+      reported on in parallel once its free heap and live blocks are known and the reports are merged in
+      file order. Only the records which make csv lines are counted.
+
+      The report needs the meta files of -b, -bg only leaves the csv behind and has nothing to replay
+ */
+uint8 opt_handler_r(uint8 bJson)
+{
+    uint8 bret = FALSE;
+    uint8 hasHeapInit;
+
+    REPLAY_JOB * jobs;
+    HEAP_REPORT  report;
+    uint32       filenums;
+
+    if (access(META_FILE_LIST,R_OK) != 0) {
+        fprintf(stderr,"opt_handler_r@No meta files(%s), run ma -b first, -bg does not keep them\n",META_FILE_LIST);
+        return bret;
+    }
+
+    if ((jobs = replay_open_jobs(TRUE,&filenums)) == NULL) {
+        return bret;
+    }
+
+    heap_report_init(&report);
+
+    bret = replay_run_jobs(jobs,filenums,DEFAULT_TOTAL_FREE_HEAP,replay_report_meta_file,opt_handler_r_merge,&report,
+                           &hasHeapInit,NULL);
+
+    if (bJson) {
+        heap_report_print_json(&report);
+    } else {
+        heap_report_print_text(&report);
+    }
+
+    heap_report_free(&report);
+
+    /* a meta file which could not be read is reported by replay_run_jobs, the report stops before it */
+    if (!hasHeapInit) {
+        fprintf(stderr,"Warning: HEA_INIT no found!\n");
+    }
+
+    return bret;
+}
+
+/* -c: biggest callers first, by live bytes or by live blocks */
+static int heap_caller_compare_bytes(const void * a, const void * b)
+{
+    const HEAP_CALLER * ca = (const HEAP_CALLER *)a;
+    const HEAP_CALLER * cb = (const HEAP_CALLER *)b;
+
+    if (ca->live_bytes != cb->live_bytes) {
+        return ca->live_bytes < cb->live_bytes ? 1 : -1;
+    }
+    if (ca->live_blocks != cb->live_blocks) {
+        return ca->live_blocks < cb->live_blocks ? 1 : -1;
+    }
+    if (ca->caller1 != cb->caller1) {
+        return ca->caller1 < cb->caller1 ? -1 : 1;
+    }
+    return ca->caller2 < cb->caller2 ? -1 : (ca->caller2 > cb->caller2);
+}
+
+static int heap_caller_compare_blocks(const void * a, const void * b)
+{
+    const HEAP_CALLER * ca = (const HEAP_CALLER *)a;
+    const HEAP_CALLER * cb = (const HEAP_CALLER *)b;
 
-    while (fgets(single_file_path, MAX_PATH_LEN, fd_blx_list_file) != 0) {
+    if (ca->live_blocks != cb->live_blocks) {
+        return ca->live_blocks < cb->live_blocks ? 1 : -1;
+    }
+    return heap_caller_compare_bytes(a,b);
+}
 
-        /* remove 0x0D and 0x0A from the new line,otherwise ifstream can not work then...*/
-        len = strlen(single_file_path);
-        if (single_file_path[len-1] == 0x0A)  {
-           single_file_path[len-1] = 0x0;
-        }
+/* -c: print the top callers of a snapshot, callers[0] is not used */
+void heap_caller_print(HEAP_CALLER * callers, uint32 nums, uint32 topn, const char * title, uint64 time)
+{
+    char   time_text[64];
+    uint32 i,k;
+    uint64 bytes  = 0;
+    uint64 blocks = 0;
+
+    for (i = 1; i <= nums; i++) {
+        bytes  += callers[i].live_bytes;
+        blocks += callers[i].live_blocks;
+    }
 
-        /* get first file's date as base date */ 
-        if (has_start_date == FALSE || g_trace_date.day == 0)  {
-            if (stat(single_file_path, &stbuf) == -1) {
-                SET_DEFAULT_START_DATE(g_trace_date);
-                fprintf(stderr,"fstat failed, What's wrong with the file!?\n");
-            }
+    format_csv_time(time,time_text);
+    fprintf(stdout,"%s at %s: %llu bytes in %llu blocks\n",title,time_text,bytes,blocks);
 
-            if (S_ISREG(stbuf.st_mode)) {
-                tm_date = localtime(&stbuf.st_mtime);
+    for (k = 0; k < 2; k++) {
 
-                g_trace_date.day   = tm_date->tm_mday;
-                g_trace_date.month = tm_date->tm_mon+1;
-                g_trace_date.year  = tm_date->tm_year+1900;
+        qsort(callers + 1,nums,sizeof(HEAP_CALLER),k == 0 ? heap_caller_compare_bytes : heap_caller_compare_blocks);
 
-                has_start_date = TRUE;
-               
-            } else {
-                //TODO: What can I do without modification time?
-                SET_DEFAULT_START_DATE(g_trace_date);
-                fprintf(stderr,"It is NOT a regual file!?\n");
-            }
+        fprintf(stdout,"  %-4s %-10s %-10s %12s %10s   (by live %s)\n","#","Caller1","Caller2","Live bytes","Blocks",
+                k == 0 ? "bytes" : "blocks");
 
-            if ((fd_date_file = fopen(TRACE_START_DATE,"wb")) == 0) {
-                SET_DEFAULT_START_DATE(g_trace_date);                
-            } else {
-                fwrite((const void *)&g_trace_date,sizeof(g_trace_date),1,fd_date_file);
+        for (i = 1; i <= nums && i <= topn; i++) {
+            if (callers[i].live_blocks == 0) {
+                break;
             }
-        }        
+            fprintf(stdout,"  %-4u 0x%08X 0x%08X %12llu %10u\n",i,callers[i].caller1,callers[i].caller2,
+                    callers[i].live_bytes,callers[i].live_blocks);
+        }
+    }
 
-        /* add a job with input parameters(single_file_path) into thread pool. The job will handle by metadata_single_blx_file function */
-        tp = malloc(sizeof(THREAD_PARAMETER));
-        
-        tp->tracetype = t_type;
-        tp->fileindex = fileindex++;
-        strncpy(tp->filepath,single_file_path,MAX_PATH_LEN);
+    fprintf(stdout,"\n");
+}
 
-        sprintf(meta_file_path,"%s%s.%d%s\n",DEFAULT_META_FOLDER_PREFIX,basename(single_file_path),tp->fileindex,DEFAULT_META_FILE_SUFFRIX);
-        fwrite(meta_file_path,strlen(meta_file_path),1,fd_meta_list_file);
+/* stage 3 of -c, in a pool thread: nothing to do in parallel, the callers are followed in file order by
+   opt_handler_c_consume
+ */
+void replay_pass_meta_file(void * arg)
+{
+    replay_job_set_stage((REPLAY_JOB *)arg,REPLAY_STAGE_FORMATTED);
+}
 
-        tp_dispatch(tpool, metadata_single_blx_file, (void *)tp);
+/* -c: the caller table gets the records of each meta file in file order, the free heap of every record comes
+   from the replay like the csv lines of -g
+ */
+void opt_handler_c_consume(REPLAY_JOB * job, void * arg)
+{
+    HEAP_CALLER_REPLAY * cr = (HEAP_CALLER_REPLAY *)arg;
+    REPLAY_STATE         rs = job->start;
 
-        /* Is it necessary here? */
-        memset(single_file_path,0x0,MAX_PATH_LEN);
+    const META_RECORD * record;
+    uint32 i,k = 0;
+    uint32 resolved = 0;
+    uint32 size,caller,free_heap;
 
-    } /* end-while */
+    for (i = 0; i < job->nums; i++) {
 
-    fclose(fd_blx_list_file);
-    fclose(fd_meta_list_file);
+        record = &job->records[i];
 
-    tp_start_threadpool(tpool);
+        replay_advance_clock(&rs,record->timestamp);
+        cr->time = csv_time(rs.day,record->timestamp);
 
-    tp_destroy_threadpool(tpool);
-    
-    /* get the end time */
-    gettimeofday(&endTime, NULL);
+        if (record->type == TYPE_INIT) {
+            rs.find_begin_point = TRUE;
+            continue;
+        }
 
-    /* calculate time in microseconds */
-    wall_clock_counter = (endTime.tv_sec*1000000  + (endTime.tv_usec)) - (startTime.tv_sec*1000000 + (startTime.tv_usec));
+        if (record->type != TYPE_ALLOCATE && record->type != TYPE_DEALLOCATE) {
+            continue;
+        }
 
-    fprintf(stdout,"---------------------------------------------------\n");
-    fprintf(stdout,"Time cost:%f minutes\n",wall_clock_counter/(1000000*60));
+        if (k < job->unresolved_nums && job->unresolved[k] == i) {
+            resolved += job->resolved_sizes[k++];
+        }
 
-    bret = TRUE;
+        /* the live blocks just before the first record at or after [minutes] */
+        if (cr->reported && cr->minutes >= 0 && cr->at_callers == NULL && cr->time >= cr->at_time) {
+            cr->at_nums = heap_caller_table_snapshot(&cr->table,FALSE,&cr->at_callers);
+            cr->at_time = cr->time;
+        }
 
-    return bret;
+        if (record->type == TYPE_ALLOCATE) {
+            caller = heap_caller_table_id(&cr->table,record->caller1,record->caller2);
+            halloc_info_table_add_caller(&cr->live,record->address,record->size,caller);
+            heap_caller_table_update(&cr->table,caller,record->size,1);
+        } else if (halloc_info_table_remove_caller(&cr->live,record->address,&size,&caller)) {
+            heap_caller_table_update(&cr->table,caller,-(sint64)size,-1);
+        }
+
+        if (!rs.find_begin_point) {
+            continue;
+        }
+
+        if (!cr->reported) {
+            cr->reported   = TRUE;
+            cr->first_time = cr->time;
+            cr->at_time    = cr->first_time + (uint64)(cr->minutes < 0 ? 0 : cr->minutes) * 60 * TIME_UNIT;
+        }
+
+        free_heap = job->start.free_heap + job->deltas[i] + resolved;
+        if (free_heap < cr->low_water) {
+            cr->low_water = free_heap;
+            cr->low_time  = cr->time;
+            heap_caller_table_mark(&cr->table);
+        }
+    }
 }
 
-uint8 sampling_csv_from_meta(uint64 sample_rate)
+/* -c <N> [minutes] option
+      the <N> caller pairs holding the most live bytes and the most live blocks at the low water of the free heap,
+      at [minutes] after the first csv line and at the end of the trace(leak candidates).
+
+      The meta files are replayed like -g does(default free heap, from the heap init on), see replay_run_jobs.
+      The caller table is updated with every allocation and deallocation in file order by opt_handler_c_consume,
+      see HEAP_CALLER_TABLE for how the low water is kept without copying the callers at every new one
+ */
+uint8 opt_handler_c(uint32 topn, sint32 minutes)
 {
     uint8 bret = FALSE;
+    uint8 hasHeapInit;
 
-    FILE * fd_metadata;
-    FILE * fd_csv;
-
-    uint64 counter = 0; 
-
-    char single_file_path[MAX_PATH_LEN+1] = {0};
-    char csv_file[MAX_PATH_LEN] = {0};
+    REPLAY_JOB       * jobs;
+    HEAP_CALLER_REPLAY cr;
+    HEAP_CALLER      * callers;
 
-    if (sample_rate <= 1) {
-        return bret; /* just same as meta data */ 
-    }
+    uint32 filenums,nums;
 
-    if ((fd_metadata = fopen(DEFAULT_META_FILE,"r")) == 0) {
-        printf("Read metadata file failed\n");
+    if ((jobs = replay_open_jobs(TRUE,&filenums)) == NULL) {
         return bret;
     }
 
-    sprintf(csv_file,"rm -f ./%s%llu.csv",DEFAULT_CSV_FILE_PREFIX,sample_rate);
-    system(csv_file);
+    memset(&cr,0x0,sizeof(HEAP_CALLER_REPLAY));
+    cr.minutes   = minutes;
+    cr.low_water = MAX_THEORY_HEAP_SIZE;
 
-    sprintf(csv_file,"./%slines_%llu.csv",DEFAULT_CSV_FILE_PREFIX,sample_rate);
-    if ((fd_csv = fopen(csv_file,"a")) == 0) {
-        fprintf(stderr,"Create csv file failed\n");
-        return bret;
-    }
+    bret = replay_run_jobs(jobs,filenums,DEFAULT_TOTAL_FREE_HEAP,replay_pass_meta_file,opt_handler_c_consume,&cr,
+                           &hasHeapInit,NULL);
 
-    while (fgets(single_file_path, MAX_PATH_LEN, fd_metadata) != 0)  {
+    if (!cr.reported) {
+        fprintf(stdout,"Warning: HEA_INIT no found!\n");
+    } else {
 
-        if (counter == 0) {
-            /* always need the first line of meta data because it is the first point of Y axis*/ 
-            fwrite(single_file_path,strlen(single_file_path),1,fd_csv);
-            counter++;  
-            continue;
-        }
+        nums = heap_caller_table_snapshot(&cr.table,TRUE,&callers);
+        fprintf(stdout,"Free heap low water is %d\n",cr.low_water);
+        heap_caller_print(callers,nums,topn,"Live blocks at the low water",cr.low_time);
+        free(callers);
 
-        if (counter++ < sample_rate) {
-            continue;    
+        if (cr.at_callers != NULL) {
+            heap_caller_print(cr.at_callers,cr.at_nums,topn,"Live blocks",cr.at_time);
         }
 
-        fwrite(single_file_path,strlen(single_file_path),1,fd_csv);
-        counter = 1;
+        nums = heap_caller_table_snapshot(&cr.table,FALSE,&callers);
+        heap_caller_print(callers,nums,topn,"Live blocks at the end of the trace(leak candidates)",cr.time);
+        free(callers);
     }
 
-    fclose(fd_metadata);
-    fclose(fd_csv);
+    free(cr.at_callers);
+    heap_caller_table_free(&cr.table);
+    halloc_info_table_free(&cr.live);
 
-    bret = TRUE;
     return bret;
 }
 
-/* -t <minutes> option
-      sampling for every <minutes>
+/* -d <meta file> option
+      dump a binary meta file to stdout in the META_DATA_FORMAT text layout
  */
-uint8 opt_handler_t(char * time)
+uint8 opt_handler_d(char * meta_file)
 {
     uint8 bret = FALSE;
 
-    uint32 time_step = strtouint32(time);
-    TRACE_TIME time_next;
-    TRACE_TIME time_current;
-
-    uint8 first_line = TRUE;
-    char temp[3];
+    FILE * fd_meta;
+    META_READER reader;
 
-    FILE * fd_meta_csv;
-    FILE * fd_new_csv;
-    
-    uint16 d,h,m;
+    META_RECORD records[META_RECORDS_PER_READ];
+    uint32 nums,i;
 
-    META_DATE * tmd;
+    char line_wr[MAX_SINGLE_METADATA_LEN] = {0};
 
-    char new_file[MAX_PATH_LEN];
-    char commandstr[MAX_PATH_LEN];
-    char line_rw[MAX_SINGLE_METADATA_LEN] = {0};
+    if ((fd_meta = fopen(meta_file,"rb")) == 0) {
+        fprintf(stderr,"Can not open :%s\n",meta_file);
+        return bret;
+    }
 
-    if (time_step == 0) {
+    if (!meta_file_check_header(fd_meta)) {
+        fclose(fd_meta);
         return bret;
     }
 
-    sprintf(new_file,"./%s%dminutes.csv",DEFAULT_CSV_FILE_PREFIX,time_step);
-    sprintf(commandstr,"rm -f %s",new_file);
-    system(commandstr);
+    meta_reader_init(&reader);
 
-    if( (fd_meta_csv = fopen(DEFAULT_META_FILE,"r")) == 0) {
-        fprintf(stderr,"Can not open :%s\n",DEFAULT_META_FILE);
+    while ((nums = meta_file_read_records(fd_meta,&reader,records)) != 0) {
+        for (i = 0; i < nums; i++) {
+            fwrite(line_wr,meta_record_to_text(&records[i],line_wr),1,stdout);
+        }
     }
 
-    if( (fd_new_csv = fopen(new_file,"a")) == 0) {
-        fprintf(stderr,"Can not open :%s\n",new_file);
+    meta_reader_free(&reader);
+    fclose(fd_meta);
+
+    bret = TRUE;
+    return bret;
+}
+
+/* offset of the first csv line starting at or after pos */
+uint64 csv_line_start(FILE * fd_csv, uint64 pos)
+{
+    int c;
+
+    if (pos == 0) {
+        return 0;
+    }
+
+    fseek(fd_csv,pos - 1,SEEK_SET);
+    while ((c = fgetc(fd_csv)) != EOF && c != '\n') {
+        pos++;
     }
 
-    while (fgets(line_rw, MAX_SINGLE_METADATA_LEN, fd_meta_csv) != 0)  {
+    return pos;
+}
 
-        tmd = (META_DATE *)line_rw;
+/* without an index: binary search the csv for the first line at or after time, the lines are in time order */
+uint64 csv_search_time(FILE * fd_csv, uint64 csv_size, uint64 time)
+{
+    uint64 low  = 0;
+    uint64 high = csv_size;
+    uint64 mid,line_start,line_time;
 
-        temp[0] = tmd->minute[0];temp[1] = tmd->minute[1];temp[2] = '\0';
-        time_current.minute = strtouint32(temp);
+    char line_rd[MAX_SINGLE_METADATA_LEN] = {0};
 
-        temp[0] = tmd->hour[0];temp[1] = tmd->hour[1];
-        time_current.hour = strtouint32(temp);
+    while (low < high) {
 
-        temp[0] = tmd->day[0];temp[1] = tmd->day[1];
-        time_current.day = strtouint32(temp);
+        mid        = low + (high - low) / 2;
+        line_start = csv_line_start(fd_csv,mid);
 
-        if (first_line == TRUE) {
-            /* always need the first line of meta data because it is the first point of Y axis*/ 
-            fwrite(line_rw,strlen(line_rw),1,fd_new_csv);
+        if (line_start >= csv_size || fgets(line_rd, MAX_SINGLE_METADATA_LEN, fd_csv) == 0 ||
+            !csv_line_time(line_rd,&line_time) || line_time >= time) {
+            high = mid;
+        } else {
+            low = line_start + 1;
+        }
+    }
 
-            /* update time if necessary... */
-            time_next.minute = (time_current.minute+time_step)%60;
-            time_next.hour   = (time_current.hour + (time_current.minute+time_step)/60)%24;
-            time_next.day    = time_current.day + time_current.hour/24;
+    return csv_line_start(fd_csv,low);
+}
 
-            first_line = FALSE;
-            continue;
+/* -z: copy the lines of the window out of <lines> csv lines from the current position of fd_meta_csv,
+   with bTimeOrder the copy stops at the first line after the window
+ */
+void opt_handler_z_copy(FILE * fd_meta_csv, FILE * fd_new_csv, uint64 lines, uint64 begin_time, uint64 end_time,
+                        uint64 sample_rate, uint64 * counter, uint8 bTimeOrder)
+{
+    uint64 line_time;
 
-        } 
+    char line_rw[MAX_SINGLE_METADATA_LEN] = {0};
 
-        if (time_current.day < time_next.day)  {
-            continue;
-        } 
+    while (lines-- > 0 && fgets(line_rw, MAX_SINGLE_METADATA_LEN, fd_meta_csv) != 0)  {
 
-        if (time_current.hour < time_next.hour) {
+        if (!csv_line_time(line_rw,&line_time) || line_time < begin_time) {
             continue;
         }
 
-        if (time_current.minute < time_next.minute)  {
+        if (line_time >= end_time) {
+            if (bTimeOrder) {
+                return;
+            }
             continue;
         }
 
-        /* update time... */
-        m = (time_current.minute+time_step)%60;
-        h = (time_current.hour + (time_current.minute+time_step)/60)%24;
-        d = time_current.day + time_current.hour/24;
-
-        if (time_next.minute == m && time_next.hour == h && time_next.day == d ) {
-            continue;
+        if ((*counter)++ % sample_rate == 0) {
+            fwrite(line_rw,strlen(line_rw),1,fd_new_csv);
         }
-
-        time_next.minute = m;
-        time_next.hour   = h;
-        time_next.day    = d;
-
-        fwrite(line_rw,strlen(line_rw),1,fd_new_csv);
     }
-
-    fclose(fd_meta_csv);
-    fclose(fd_new_csv);
-
-    bret = TRUE;
-    return bret;
 }
 
-/* -s <lines> option
-      set the sampling rate by specifying the lines of the increment on the X-axis between lines in the full csv file
-      generated by scan_all function. 
+/* -z <start> <end> [sampling rate] option
+      generate a csv with the lines from <start> to <end> minutes after the first line of the full csv,
+      keeping one line of every <sampling rate> like -s does.
 
-      For example, the original full csv file has 90000 lines. You can reduce the sampling rate by getting a sample point for every 1000 line
-        $ma -s 10000
+      With the index of the csv only the entries with lines in the window are read, a csv of several captures
+      goes back in time and can have the window more than once. Without an index the csv is taken to be in
+      time order, the beginning of the window is binary searched and the copy stops at the end of it
  */
-uint8 opt_handler_s(char * in)
+uint8 opt_handler_z(uint32 starttime,uint32 endtime,uint64 sample_rate)
 {
     uint8 bret = FALSE;
-    char * sampling_rate_lines = 0;
-    char * endptr = NULL; 
-    uint64 sample_rate;
 
-    sampling_rate_lines = in;
-         
-    /* To distinguish success/failure after call */
-    errno = 0;
-    sample_rate = strtoll(sampling_rate_lines, &endptr, 10);
+    FILE * fd_meta_csv;
+    FILE * fd_new_csv;
 
-    /* Check for various possible errors */
-    if ( errno == ERANGE || (errno != 0 && sample_rate == 0) || endptr == sampling_rate_lines)  {
+    META_INDEX         index;
+    META_INDEX_ENTRY * entry;
+    struct stat        stbuf;
+
+    uint64 first_time,begin_time,end_time;
+    uint64 counter = 0;
+    uint32 i;
+
+    char new_file[MAX_PATH_LEN];
+    char line_rw[MAX_SINGLE_METADATA_LEN] = {0};
+
+    if (starttime >= endtime || sample_rate == 0) {
         return bret;
     }
 
-    sampling_csv_from_meta(sample_rate);
+    if ((fd_meta_csv = fopen(DEFAULT_META_FILE,"r")) == 0 || fstat(fileno(fd_meta_csv),&stbuf) != 0) {
+        fprintf(stderr,"Can not open :%s\n",DEFAULT_META_FILE);
+        return bret;
+    }
 
-    bret = TRUE;
-    return bret;
-}
+    if (fgets(line_rw, MAX_SINGLE_METADATA_LEN, fd_meta_csv) == 0 || !csv_line_time(line_rw,&first_time)) {
+        fprintf(stderr,"opt_handler_z@No csv line in %s\n",DEFAULT_META_FILE);
+        fclose(fd_meta_csv);
+        return bret;
+    }
 
-/* -r option
-      output a brief report(TODO: only for heap right now) 
- */
-uint8 opt_handler_r(char * in)
-{
-    uint8 bret = FALSE;
+    begin_time = first_time + (uint64)starttime * 60 * TIME_UNIT;
+    end_time   = first_time + (uint64)endtime * 60 * TIME_UNIT;
+
+    sprintf(new_file,"./%s%d_%dminutes.csv",DEFAULT_CSV_FILE_PREFIX,starttime,endtime);
+    if ((fd_new_csv = fopen(new_file,"w")) == 0) {
+        fprintf(stderr,"Can not open :%s\n",new_file);
+        fclose(fd_meta_csv);
+        return bret;
+    }
 
-	FILE * fd_meta_csv; 
-	
-    CSV_FORMAT_UNIT * csv_unit;
-    static uint32 bottom_heap_size = MAX_THEORY_HEAP_SIZE;
+    if (meta_index_load(&index,DEFAULT_META_INDEX_FILE,DEFAULT_META_FILE)) {
 
-    char line_rd[MAX_SINGLE_METADATA_LEN] = {0};
-	char line_tm[MAX_SINGLE_METADATA_LEN] = {0};
+        for (i = meta_index_find(&index,begin_time); i < index.nums; i++) {
 
-    if( (fd_meta_csv = fopen(DEFAULT_META_FILE,"r")) == 0) {
-        fprintf(stderr,"Can not open :%s\n",DEFAULT_META_FILE);
-		return bret; 
-    }
-	
-    while (fgets(line_rd, MAX_SINGLE_METADATA_LEN, fd_meta_csv) != 0)  {
-        csv_unit   = (CSV_FORMAT_UNIT *)line_rd;
-		
-        if (strtouint32(csv_unit->freesize) < bottom_heap_size) {
-		    bottom_heap_size = strtouint32(csv_unit->freesize);
-			strcpy(line_tm,line_rd);
-			continue;
-		} 
+            entry = &index.entries[i];
+            if (entry->max_time < begin_time || entry->min_time >= end_time) {
+                continue;
+            }
+
+            fseek(fd_meta_csv,entry->offset,SEEK_SET);
+            opt_handler_z_copy(fd_meta_csv,fd_new_csv,meta_index_entry_lines(&index,i),begin_time,end_time,sample_rate,&counter,FALSE);
+        }
+
+        meta_index_free(&index);
+
+    } else {
+
+        fseek(fd_meta_csv,csv_search_time(fd_meta_csv,stbuf.st_size,begin_time),SEEK_SET);
+        opt_handler_z_copy(fd_meta_csv,fd_new_csv,~0ULL,begin_time,end_time,sample_rate,&counter,TRUE);
     }
 
     fclose(fd_meta_csv);
-	
-	fprintf(stdout,"Bottom heap size is %d.\n%s\n",bottom_heap_size,line_tm);
+    fclose(fd_new_csv);
 
     bret = TRUE;
     return bret;
 }
 
-uint8 opt_handler_z(uint32 starttime,uint32 endtime)
-{
-    uint8 bret = FALSE;
-    //TODO:
-    return bret;
-}
-
 sint32 get_expression_result(char * argv)
 {
     sint32 ret = 0;
@@ -806,11 +2988,24 @@ void show_usage(void)
     fprintf(stdout,"  Currently, the following options are supported...\r\n");
     fprintf(stdout,"   -b                   build meta data by scanning all blx files recursively and generate metadata at %s\r\n",DEFAULT_META_FOLDER_PREFIX);
     fprintf(stdout,"   -b <type>            same as -b, <type> indicate trace type, default type is MTBF trace,1 mean 11.2 trace \r\n");
-    fprintf(stdout,"   -r                   output general heap usage\r\n");
+    fprintf(stdout,"   -bg                  same as -b followed by -g, but no meta files are written\r\n");
+    fprintf(stdout,"   -bg <free heap size> same as -bg, but specify init free heap size\r\n");
+    fprintf(stdout,"   -c <N>               top <N> callers of the live blocks at the free heap low water and at the end\r\n");
+    fprintf(stdout,"   -c <N> <minutes>     same as -c, and at <minutes> into the trace\r\n");
+    fprintf(stdout,"   -d <meta file>       dump a binary meta file as text\r\n");
+    fprintf(stdout,"   -f                   follow a capture being written: replay the blx files into %s, then append lines as the newest part grows\r\n",DEFAULT_META_FILE);
+    fprintf(stdout,"   -f <seconds>         same as -f, but check for new bytes every <seconds>\r\n");
+    fprintf(stdout,"   -f <seconds> <free heap size> same as -f <seconds>, but specify init free heap size\r\n");
+    fprintf(stdout,"   -r                   output a heap report of the meta files, needs -b(-bg does not keep meta files)\r\n");
+    fprintf(stdout,"   -r json              same as -r, but as json\r\n");
     fprintf(stdout,"   -s <sampling rate>   generate a csv with specified sampling rate\r\n");
-    fprintf(stdout,"   -t <minutes>         generate a csv by sampling every <minutes>\r\n");
+    fprintf(stdout,"   -t <minutes>         generate a csv with the lowest/highest/mean/last free heap of every <minutes>\r\n");
+    fprintf(stdout,"   -t <minutes> lttb    generate a csv by picking a line of every <minutes> with largest triangle three buckets\r\n");
+    fprintf(stdout,"   -z <start> <end>     generate a csv with the lines from <start> to <end> minutes into the trace\r\n");
+    fprintf(stdout,"   -z <start> <end> <sampling rate> same as -z, but keep one line of every <sampling rate>\r\n");
     fprintf(stdout,"   -g                   generate a completely csv file based on meta files\r\n");
     fprintf(stdout,"   -g <free heap size>  same as -g, but specify init free heap size\r\n");
+    fprintf(stdout,"   -gs <minutes>        same as -g, and write allocations and live bytes by size class of every <minutes> to %s\r\n",DEFAULT_SIZE_CLASS_FILE);
     fprintf(stdout,"   -ng <init_heap_size>,same as -g, but specify init free heap size, and no need to check heap_init \r\n");
     fprintf(stdout,"   -ng                  same as -g, same as -g, but use default init free heap size,and no need to check heap_init \r\n");
     fprintf(stdout,"\r\n");
@@ -820,12 +3015,13 @@ int main(int argc, char * argv[])
 {
     sint32 start_time;
     sint32 end_time;
+    sint32 sample_rate;
     uint8 bret = FALSE;
 
 ////////////////////////////////////////////////////////////////////////////////////
     switch (argc)
     {
-       case 2:  /* --help, -r, -b, -g */
+       case 2:  /* --help, -r, -b, -g, -f */
            if (argv[1][0] != '-' ) {
                 goto MISSING_OR_WRONG_OPTIONS;
            } 
@@ -841,22 +3037,29 @@ int main(int argc, char * argv[])
                    break;
 
                case 'b':                      /* -b, build meta data by scanning all blx files recursively */
-                   bret = build_metadata(TRACE_TYPE_DEFAULT);
+                   if (argv[1][2] == 'g') {   /* -bg, build csv straight from blx files without meta files */
+                       bret = build_metadata(NULL,TRUE,DEFAULT_TOTAL_FREE_HEAP,TRUE);
+                   } else {
+                       bret = build_metadata(NULL,FALSE,0,FALSE);
+                   }
                    break;
 
                case 'g':                      /* -g, build big csv based on meta files with default total heap size   */
-                   bret = build_csv(DEFAULT_TOTAL_FREE_HEAP,TRUE);
+                   bret = build_csv(DEFAULT_TOTAL_FREE_HEAP,TRUE,0);
                    break;
 
                case 'n':                      /* -ng, build big csv based on meta files with default total free heap size,no need to check heap_init  */
                    if (argv[1][2] == 'g')  {
-                       bret = build_csv(DEFAULT_TOTAL_FREE_HEAP,FALSE);
+                       bret = build_csv(DEFAULT_TOTAL_FREE_HEAP,FALSE,0);
                    }
                    break;
 
                case 'r':                      /* -r, generate general heap report  */
-                   //TODO
-                   bret = opt_handler_r(argv[2]);   
+                   bret = opt_handler_r(FALSE);
+                   break;
+
+               case 'f':                      /* -f, follow a capture that is still being written */
+                   bret = opt_handler_f(FOLLOW_POLL_SECONDS,DEFAULT_TOTAL_FREE_HEAP);
                    break;
 
 
@@ -877,16 +3080,56 @@ int main(int argc, char * argv[])
                    break;
 
                case 't':               /* -t <minutes>, generate csv by every minutes */
-                   bret = opt_handler_t(argv[2]);
+                   bret = opt_handler_t(argv[2],FALSE);
+                   break;
+
+               case 'r':               /* -r json, generate general heap report as json */
+                   if (strcmp(argv[2],"json") == 0) {
+                       bret = opt_handler_r(TRUE);
+                   } else {
+                       show_usage();
+                       return 1;
+                   }
+                   break;
+
+               case 'c':               /* -c <N>, top N callers of the live blocks */
+                   if (get_expression_result(argv[2]) > 0) {
+                       bret = opt_handler_c(get_expression_result(argv[2]),-1);
+                   } else {
+                       show_usage();
+                       return 1;
+                   }
+                   break;
+
+               case 'f':               /* -f <seconds>, follow a capture, checking for new bytes every <seconds> */
+                   if (get_expression_result(argv[2]) > 0) {
+                       bret = opt_handler_f(get_expression_result(argv[2]),DEFAULT_TOTAL_FREE_HEAP);
+                   } else {
+                       show_usage();
+                       return 1;
+                   }
+                   break;
+
+               case 'd':               /* -d <meta file>, dump a meta file as text */
+                   bret = opt_handler_d(argv[2]);
                    break;
 
                case 'b':               /* -b <type>, build blx based on type. Default type is for MTBF trace */
-                   bret = build_metadata(argv[2]);
+                   if (argv[1][2] != 'g') {
+                       bret = build_metadata(argv[2],FALSE,0,FALSE);
+                   } else if (get_expression_result(argv[2]) > 0)  {   /* -bg <init_heap_size> */
+                       bret = build_metadata(NULL,TRUE,get_expression_result(argv[2]),TRUE);
+                   } else {
+                       show_usage();
+                       return 1;
+                   }
                    break;
 
-               case 'g':               /* -g <init_heap_size> */
-                   if (get_expression_result(argv[2]) > 0)  {
-                       bret = build_csv(get_expression_result(argv[2]),TRUE);
+               case 'g':               /* -g <init_heap_size>, -gs <minutes> */
+                   if (argv[1][2] == 's' && get_expression_result(argv[2]) > 0)  {
+                       bret = build_csv(DEFAULT_TOTAL_FREE_HEAP,TRUE,get_expression_result(argv[2]));
+                   } else if (argv[1][2] != 's' && get_expression_result(argv[2]) > 0)  {
+                       bret = build_csv(get_expression_result(argv[2]),TRUE,0);
                    } else {
                        show_usage();
                        return 1;
@@ -895,7 +3138,7 @@ int main(int argc, char * argv[])
 
                case 'n':               /* -ng <init_heap_size>,no need to check heap_init */
                    if (argv[1][2] == 'g' && get_expression_result(argv[2]) > 0)  {
-                       bret = build_csv(get_expression_result(argv[2]),FALSE);
+                       bret = build_csv(get_expression_result(argv[2]),FALSE,0);
                    } else {
                        show_usage();
                        return 1;
@@ -907,21 +3150,54 @@ int main(int argc, char * argv[])
            }           
            break;
 
-       case 4: /* -z*/                 
+       case 4: /* -z, -t lttb, -c, -f */
+       case 5:
            if (argv[1][0] != '-' ) {
                 goto MISSING_OR_WRONG_OPTIONS;
            }
 
            switch (argv[1][1])
            {
-               case 'z':              /* -z <beginning_time> <end_time>, generate csv between start and end time  */
-                   start_time = get_expression_result(argv[2]);
-                   end_time   = get_expression_result(argv[3]);
-                   if (start_time > 0 && end_time > 0 && start_time < end_time) 
+               case 'f':              /* -f <seconds> <init_heap_size>, follow a capture with that init free heap */
+                   if (argc == 4 && get_expression_result(argv[2]) > 0 && get_expression_result(argv[3]) > 0) {
+                       bret = opt_handler_f(get_expression_result(argv[2]),get_expression_result(argv[3]));
+                   } else {
+                       show_usage();
+                       return 1;
+                   }
+                   break;
+
+               case 'c':              /* -c <N> <minutes>, top N callers of the live blocks at minutes too */
+                   if (argc == 4 && get_expression_result(argv[2]) > 0 && get_expression_result(argv[3]) >= 0) {
+                       bret = opt_handler_c(get_expression_result(argv[2]),get_expression_result(argv[3]));
+                   } else {
+                       show_usage();
+                       return 1;
+                   }
+                   break;
+
+               case 't':              /* -t <minutes> lttb, pick a line of every minutes by lttb */
+                   if (argc == 4 && strcmp(argv[3],"lttb") == 0) {
+                       bret = opt_handler_t(argv[2],TRUE);
+                   } else {
+                       show_usage();
+                       return 1;
+                   }
+                   break;
+
+               case 'z':              /* -z <beginning_time> <end_time> [sampling rate], generate csv between start and end time  */
+                   start_time  = get_expression_result(argv[2]);
+                   end_time    = get_expression_result(argv[3]);
+                   sample_rate = argc == 5 ? get_expression_result(argv[4]) : 1;
+                   if (start_time >= 0 && end_time > 0 && start_time < end_time && sample_rate > 0) 
                    {
-                       //TODO
-                       bret = opt_handler_z((uint32)start_time, (uint32)end_time);
+                       bret = opt_handler_z((uint32)start_time, (uint32)end_time, (uint64)sample_rate);
+                   } else {
+                       show_usage();
+                       return 1;
                    }
+                   break;
+
                default:
                    break;
            }
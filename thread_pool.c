@@ -3,148 +3,351 @@
  *
  * Example:
  * void dispatch_to_me(void *arg) {
- *      int seconds = (int) arg;
- *      do shomething here...
+ *      do something with arg...
  * }
  *
  * int main(int argc, char **argv) 
  * {
  *    threadpool tp;
  * 
- *    tp = create_threadpool(7);
+ *    tp = tp_init_threadpool(7);
  *    for(;i < 16;i ++) {
- *       dispatch(tp, dispatch_to_me, (void *) arg);    
+ *       tp_dispatch(tp, dispatch_to_me, (void *) arg);    
  *    }
  * 
- *    sleep(1);
- *    destroy_threadpool(tp);
- *    sleep(5);
- *    exit(-1);
+ *    tp_destroy_threadpool(tp);    (returns once all 16 jobs are done)
+ *    return 0;
  * }
+ *
+ * Scheduling:
+ *   - every working thread owns a deque(Chase-Lev). Jobs dispatched from inside a job are pushed
+ *     to the bottom of the deque of the thread running it, and the thread pops its own jobs from the bottom
+ *   - an idle thread steals from the top of the other deques without taking any lock
+ *   - jobs dispatched from outside the pool go to the inject queue, which is only locked
+ *     when no deque has work left. It is a fixed ring, the dispatching thread waits while it is full
+ *   - threads start working as soon as the pool is created
  */
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <pthread.h>
-#include <semaphore.h>
+#include <sched.h>
+#include <stdatomic.h>
 
 #include "types.h"
 #include "ma.h"
 #include "thread_pool.h"
 
+#define TP_DEQUE_INIT_SIZE   256   /* must be power of 2 */
+
 /* _threadpool is the internal threadpool structure that is
     cast to type "threadpool" before it given out to callers
  */
 typedef struct work_st{
-    void (*routine) (void*);
-    void * arg;
-    struct work_st* next;
+    _Atomic(dispatch_fn) routine;
+    void * _Atomic       arg;
 } work_t;
 
+/* a deque grows by moving to a twice larger array, the old ones are kept
+   until the pool is destroyed because a thief may still be reading them
+ */
+typedef struct tp_deque_array {
+    sint64                  size;
+    struct tp_deque_array * retired;
+    work_t                  slots[];
+} tp_deque_array;
+
+typedef struct tp_worker {
+    struct _threadpool_st *   pool;
+    uint32                    index;
+    pthread_t                 pt;
+    _Atomic sint64            top;      /* thieves take from here      */
+    _Atomic sint64            bottom;   /* the owner pushes/pops here  */
+    tp_deque_array * _Atomic  array;
+} tp_worker;
+
 /*
-   - queue is for holding jobs need to process by thread pool
+   - the inject queue is for holding jobs dispatched from outside the pool
    - only one instance of the struct,but each thread has its reference(thread input parameter)
  */
 typedef struct _threadpool_st {
-    uint16          num_threads; /* number of threads in the pool     */
-    uint16          qsize;       /* how many jobs in the queue        */
-    pthread_t *     threads;     /* an array,pointer to threads       */
-    work_t *        qhead;       /* queue head pointer                */
-    work_t *        qtail;       /* queue tail pointer                */
-    pthread_mutex_t qlock;       /* lock on the queue list            */
+    uint32          num_threads; /* number of threads in the pool     */
+    tp_worker *     workers;     /* an array, one deque per thread    */
+
+    work_t          inject[TP_INJECT_SIZE]; /* ring of jobs from outside */
+    uint32          inject_head;
+    uint32          inject_nums;
+    pthread_mutex_t qlock;       /* lock on the inject queue          */
+    pthread_cond_t  q_not_full;  /* the inject queue has room again   */
+
+    _Atomic sint64  pending;     /* dispatched but not taken yet      */
+    _Atomic sint64  outstanding; /* dispatched but not finished yet   */
+    _Atomic uint32  idle;        /* threads going to sleep            */
+    pthread_mutex_t idle_lock;
     pthread_cond_t  q_not_empty; /* non empty condidtion vairiables   */
-    pthread_cond_t  q_empty;     /* empty condidtion vairiables       */
-    uint8           shutdown;    /* TODO:Do I really need this to destory pool?  */
-    uint8           dont_accept; /* TODO:Do I really need this to destory pool?  */
+    pthread_cond_t  q_empty;     /* all jobs finished                 */
+
+    uint8           shutdown;
 } _threadpool;
 
-sem_t g_pool_sem; /* after thread pool creation done,then enable all working threads */
+static __thread tp_worker * tp_self = NULL; /* the worker running on this thread, NULL outside the pool */
+
+static tp_deque_array * tp_deque_array_new(sint64 size)
+{
+    tp_deque_array * a = calloc(1,sizeof(tp_deque_array) + size * sizeof(work_t));
+
+    if (a == NULL) {
+        handle_error("Out of memory creating a work deque");
+    }
+
+    a->size = size;
+
+    return a;
+}
+
+static void tp_slot_store(work_t * slot, dispatch_fn routine, void * arg)
+{
+    atomic_store_explicit(&slot->routine,routine,memory_order_relaxed);
+    atomic_store_explicit(&slot->arg,arg,memory_order_relaxed);
+}
+
+static void tp_slot_load(work_t * slot, work_t * out)
+{
+    atomic_store_explicit(&out->routine,atomic_load_explicit(&slot->routine,memory_order_relaxed),memory_order_relaxed);
+    atomic_store_explicit(&out->arg,atomic_load_explicit(&slot->arg,memory_order_relaxed),memory_order_relaxed);
+}
+
+/* owner only */
+static void tp_deque_push(tp_worker * w, dispatch_fn routine, void * arg)
+{
+    sint64 b = atomic_load_explicit(&w->bottom,memory_order_relaxed);
+    sint64 t = atomic_load_explicit(&w->top,memory_order_acquire);
+    sint64 i;
+    tp_deque_array * a = atomic_load_explicit(&w->array,memory_order_relaxed);
+    tp_deque_array * bigger;
+
+    if (b - t > a->size - 1) {
+        bigger = tp_deque_array_new(a->size * 2);
+        for (i = t; i < b; i++) {
+            tp_slot_load(&a->slots[i & (a->size - 1)],&bigger->slots[i & (bigger->size - 1)]);
+        }
+
+        bigger->retired = a;
+        atomic_store_explicit(&w->array,bigger,memory_order_release);
+        a = bigger;
+    }
+
+    tp_slot_store(&a->slots[b & (a->size - 1)],routine,arg);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&w->bottom,b + 1,memory_order_relaxed);
+}
+
+/* owner only, the latest job first */
+static uint8 tp_deque_pop(tp_worker * w, work_t * job)
+{
+    sint64 b = atomic_load_explicit(&w->bottom,memory_order_relaxed) - 1;
+    sint64 t;
+    uint8  found = TRUE;
+    tp_deque_array * a = atomic_load_explicit(&w->array,memory_order_relaxed);
+
+    atomic_store_explicit(&w->bottom,b,memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    t = atomic_load_explicit(&w->top,memory_order_relaxed);
+
+    if (t > b) {
+        /* empty */
+        atomic_store_explicit(&w->bottom,b + 1,memory_order_relaxed);
+        return FALSE;
+    }
+
+    tp_slot_load(&a->slots[b & (a->size - 1)],job);
+
+    if (t == b) {
+        /* the last job, race the thieves for it */
+        if (!atomic_compare_exchange_strong_explicit(&w->top,&t,t + 1,memory_order_seq_cst,memory_order_relaxed)) {
+            found = FALSE;
+        }
+        atomic_store_explicit(&w->bottom,b + 1,memory_order_relaxed);
+    }
+
+    return found;
+}
+
+/* any thread, the oldest job first. Returns FALSE if the deque is empty or another thread won the job */
+static uint8 tp_deque_steal(tp_worker * w, work_t * job)
+{
+    sint64 t = atomic_load_explicit(&w->top,memory_order_acquire);
+    sint64 b;
+    tp_deque_array * a;
+
+    atomic_thread_fence(memory_order_seq_cst);
+    b = atomic_load_explicit(&w->bottom,memory_order_acquire);
+
+    if (t >= b) {
+        return FALSE;
+    }
+
+    a = atomic_load_explicit(&w->array,memory_order_acquire);
+    tp_slot_load(&a->slots[t & (a->size - 1)],job);
+
+    return atomic_compare_exchange_strong_explicit(&w->top,&t,t + 1,memory_order_seq_cst,memory_order_relaxed);
+}
+
+static uint8 tp_inject_take(_threadpool * pool, work_t * job)
+{
+    uint8 found = FALSE;
+
+    pthread_mutex_lock(&(pool->qlock));
+
+    if (pool->inject_nums != 0) {
+        if (pool->inject_nums == TP_INJECT_SIZE) {
+            pthread_cond_signal(&(pool->q_not_full));
+        }
+
+        tp_slot_load(&pool->inject[pool->inject_head],job);
+        pool->inject_head = (pool->inject_head + 1) & (TP_INJECT_SIZE - 1);
+        pool->inject_nums--;
+        found = TRUE;
+    }
+
+    pthread_mutex_unlock(&(pool->qlock));
+
+    return found;
+}
+
+/* backpressure: the caller waits until a thread takes a job if the ring is full */
+static void tp_inject_put(_threadpool * pool, dispatch_fn routine, void * arg)
+{
+    pthread_mutex_lock(&(pool->qlock));
+
+    while (pool->inject_nums == TP_INJECT_SIZE) {
+        pthread_cond_wait(&(pool->q_not_full),&(pool->qlock));
+    }
+
+    tp_slot_store(&pool->inject[(pool->inject_head + pool->inject_nums) & (TP_INJECT_SIZE - 1)],routine,arg);
+    pool->inject_nums++;
+
+    pthread_mutex_unlock(&(pool->qlock));
+}
+
+/* own deque first, then the other deques, then the jobs from outside */
+static uint8 tp_find_work(tp_worker * self, work_t * job)
+{
+    _threadpool * pool = self->pool;
+    uint32 i,victim;
+
+    if (tp_deque_pop(self,job)) {
+        return TRUE;
+    }
+
+    for (i = 1; i < pool->num_threads; i++) {
+        victim = (self->index + i) % pool->num_threads;
+        if (tp_deque_steal(&pool->workers[victim],job)) {
+            return TRUE;
+        }
+    }
+
+    return tp_inject_take(pool,job);
+}
 
 /* This function is the work function of the thread */
-void * tp_working_thread(threadpool p)
+void * tp_working_thread(void * p)
 {
-    _threadpool * pool = (_threadpool *)p;
-    work_t * cur;  /* The queue element */
+    tp_worker *   self = (tp_worker *)p;
+    _threadpool * pool = self->pool;
+    work_t cur;  /* The job to run */
+
+    tp_self = self;
 
-    fprintf(stdout,"%sThread%u is created...%s\n",gray,(uint32)pthread_self(),none);
+#if ENABLE_TRACE_GENERAL == TRUE
+    /* a pool is started for every directory walk, -f would print this for good */
+    fprintf(stderr,"%sThread%u is created...%s\n",gray,(uint32)pthread_self(),none);
+#endif
 
     while (1)  {
-        //pool->qsize = pool->qsize;
-        pthread_mutex_lock(&(pool->qlock));  /* get the q lock.  */
 
-        while (pool->qsize == 0) {  /* if the size is 0 then wait. */
-            if(pool->shutdown) {
-                pthread_mutex_unlock(&(pool->qlock));
-                pthread_exit(NULL);
+        if (tp_find_work(self,&cur)) {
+
+            /* more jobs than running threads, pass the wake up on */
+            if (atomic_fetch_sub(&pool->pending,1) > 1 && atomic_load(&pool->idle) != 0) {
+                pthread_mutex_lock(&(pool->idle_lock));
+                pthread_cond_signal(&(pool->q_not_empty));
+                pthread_mutex_unlock(&(pool->idle_lock));
             }
-            
-            /*  wait until the condition says its no emtpy and give up the lock.  */
-            fprintf(stdout,"%sQueue is empty,waiting...%s\n",gray,none);
-            pthread_cond_wait(&(pool->q_not_empty),&(pool->qlock));
-            pthread_mutex_unlock(&(pool->qlock));  /* get the qlock. */
-
-            /*  check to see if in shutdown mode. */                         
-            if(pool->shutdown) {
-                pthread_mutex_unlock(&(pool->qlock));
-                pthread_exit(NULL);
+
+            (atomic_load_explicit(&cur.routine,memory_order_relaxed)) (atomic_load_explicit(&cur.arg,memory_order_relaxed));  /*  actually do work. */
+
+            if (atomic_fetch_sub(&pool->outstanding,1) == 1) {
+                /* everything dispatched so far is done */
+                pthread_mutex_lock(&(pool->idle_lock));
+                pthread_cond_broadcast(&(pool->q_empty));
+                pthread_mutex_unlock(&(pool->idle_lock));
             }
-       } /* while( pool->qsize == 0) */
+            continue;
+        }
 
-       cur = pool->qhead;  /* set the cur variable. */
+        /* a job may be on its way when pending is not zero, look again instead of sleeping */
+        if (atomic_load(&pool->pending) > 0) {
+            sched_yield();
+            continue;
+        }
 
-       pool->qsize--;    /* decriment the size. */
+        atomic_fetch_add(&pool->idle,1);
 
-       if(pool->qsize == 0) {
-           pool->qhead = NULL;
-           pool->qtail = NULL;
-       } else {
-           pool->qhead = cur->next;
-       }
+        pthread_mutex_lock(&(pool->idle_lock));
+        while (atomic_load(&pool->pending) <= 0 && !pool->shutdown) {
+            pthread_cond_wait(&(pool->q_not_empty),&(pool->idle_lock));
+        }
+        pthread_mutex_unlock(&(pool->idle_lock));
 
-       if(pool->qsize == 0 && ! pool->shutdown) {
-           /* the q is empty again, now signal that its empty. */
-           pthread_cond_signal(&(pool->q_empty));
-       }
-    
-       pthread_mutex_unlock(&(pool->qlock));
-    
-       fprintf(stdout,"%sThread%u is working on %s%s\n",cyan,(uint32)pthread_self(),((THREAD_PARAMETER *)(cur->arg))->filepath,none);
-       (cur->routine) (cur->arg);   /*  actually do work.      */
-       free(cur);                   /*  free the work storage. */
+        atomic_fetch_sub(&pool->idle,1);
+
+        if (pool->shutdown && atomic_load(&pool->pending) <= 0) {
+            pthread_exit(NULL);
+        }
     } /* end-while(1) */
 }
 
 threadpool tp_init_threadpool(uint8 num_threads_in_pool) 
 {
     _threadpool *pool;
+    uint32 i;
+    int s;
 
     /* sanity check the argument */
     if ((num_threads_in_pool <= 0) || (num_threads_in_pool > MAXT_IN_POOL))  {
         return NULL;
     }
 
-    pool = (_threadpool *) malloc(sizeof(_threadpool));
+    pool = (_threadpool *) calloc(1,sizeof(_threadpool));
     if (pool == NULL) {
         fprintf(stderr, "Out of memory creating a new threadpool!\n");
         return NULL;
     }
 
-    pool->threads = (pthread_t*) malloc (sizeof(pthread_t) * num_threads_in_pool);
-    if(!pool->threads) {
+    pool->workers = (tp_worker *) calloc(num_threads_in_pool,sizeof(tp_worker));
+    if (pool->workers == NULL) {
         fprintf(stderr, "Out of memory creating a new threadpool!\n");
         return NULL;  
     }
 
     pool->num_threads = num_threads_in_pool; /*set up structure members */
-    pool->qsize       = 0;
-    pool->qhead       = NULL;
-    pool->qtail       = NULL;
-    pool->shutdown    = 0;
-    pool->dont_accept = 0;
+
+    for (i = 0; i < num_threads_in_pool; i++) {
+        pool->workers[i].pool  = pool;
+        pool->workers[i].index = i;
+        atomic_init(&pool->workers[i].top,0);
+        atomic_init(&pool->workers[i].bottom,0);
+        atomic_init(&pool->workers[i].array,tp_deque_array_new(TP_DEQUE_INIT_SIZE));
+    }
+
+    atomic_init(&pool->pending,0);
+    atomic_init(&pool->outstanding,0);
+    atomic_init(&pool->idle,0);
 
     /* initialize mutex and condition variables. */
-    if(pthread_mutex_init(&pool->qlock,NULL))  {
+    if(pthread_mutex_init(&pool->qlock,NULL) || pthread_mutex_init(&pool->idle_lock,NULL))  {
         fprintf(stderr, "working thread mutex initiation error!\n");
         return NULL;
     }
@@ -154,104 +357,92 @@ threadpool tp_init_threadpool(uint8 num_threads_in_pool)
         return NULL;
     }
 
-    if(pthread_cond_init(&(pool->q_not_empty),NULL)) {
+    if(pthread_cond_init(&(pool->q_not_empty),NULL) || pthread_cond_init(&(pool->q_not_full),NULL)) {
         fprintf(stderr, "CV initiation error!\n");  
         return NULL;
     }
 
-    return (threadpool) pool;
-}
-
-void tp_start_threadpool(threadpool tpool) 
-{
-    uint8 i;
-    int s;
-
-    _threadpool *pool = (_threadpool *) tpool;
-
-    /* make threads */
+    /* make threads, they sleep until the first dispatch */
     for (i = 0;i < pool->num_threads;i++)  {
-        s = pthread_create(&(pool->threads[i]),NULL,tp_working_thread,pool);
+        s = pthread_create(&(pool->workers[i].pt),NULL,tp_working_thread,&pool->workers[i]);
         if (s != 0)  {
             handle_error_en(s, "pthread_create failed");
         }
     }
 
+    return (threadpool) pool;
+}
+
+void tp_start_threadpool(threadpool tpool) 
+{
+    /* threads are created by tp_init_threadpool, nothing to do */
+    (void)tpool;
+
     return;
 }
 
 void tp_dispatch(threadpool tpool, dispatch_fn dispatch_to_here, void *arg) 
 {
     _threadpool *pool = (_threadpool *) tpool;
-    work_t * cur;
-
-    /* make a work queue element.   */
-    cur = (work_t*) malloc(sizeof(work_t));
-    if(cur == NULL) {
-        fprintf(stderr, "Out of memory creating a work struct!\n");
-        return;  
-    }
 
-    cur->routine = dispatch_to_here;
-    cur->arg     = arg;
-    cur->next    = NULL;
+    atomic_fetch_add(&pool->outstanding,1);
+    atomic_fetch_add(&pool->pending,1);
 
-    pthread_mutex_lock(&(pool->qlock));
-
-    /* Just in case someone is trying to queue more */
-    if(pool->dont_accept) {
-        free(cur);
-        return;
+    if (tp_self != NULL && tp_self->pool == pool) {
+        /* dispatched by a job of this pool, keep it close */
+        tp_deque_push(tp_self,dispatch_to_here,arg);
+    } else {
+        tp_inject_put(pool,dispatch_to_here,arg);
     }
-    
-    if(pool->qsize == 0) {
-        pool->qhead = cur;  /* set to only one */
-        pool->qtail = cur;
-        
-        /* I am not empty now */
+
+    /* wake up a sleeping thread, see tp_working_thread */
+    if (atomic_load(&pool->idle) != 0) {
+        pthread_mutex_lock(&(pool->idle_lock));
         pthread_cond_signal(&(pool->q_not_empty));
-    } else {
-        pool->qtail->next = cur;
-        pool->qtail = cur;      
+        pthread_mutex_unlock(&(pool->idle_lock));
     }
-  
-    pool->qsize++;
-    pthread_mutex_unlock(&(pool->qlock));
 }
 
 void tp_destroy_threadpool(threadpool destroyme)
 {
     _threadpool *pool = (_threadpool *) destroyme;
+    tp_deque_array * a;
+    tp_deque_array * retired;
     
     void* nothing;
-    uint8 i;
+    uint32 i;
 
-    pthread_mutex_lock(&(pool->qlock));
-    pool->dont_accept = 1;
-    
-    while(pool->qsize != 0) {
-        pthread_cond_wait(&(pool->q_empty),&(pool->qlock));  /* wait until the q is empty. */
+    /* wait until all jobs are done, including the ones dispatched by jobs */
+    pthread_mutex_lock(&(pool->idle_lock));
+    while (atomic_load(&pool->outstanding) != 0) {
+        pthread_cond_wait(&(pool->q_empty),&(pool->idle_lock));
     }
 
-    pool->shutdown = 1;                            /* allow shutdown */
-    pthread_cond_broadcast(&(pool->q_not_empty));  /* allow code to return NULL; */
-    pthread_mutex_unlock(&(pool->qlock));
+    pool->shutdown    = 1;                         /* allow shutdown */
+    pthread_cond_broadcast(&(pool->q_not_empty));
+    pthread_mutex_unlock(&(pool->idle_lock));
 
     /* kill everything. */
     for(i = 0; i < pool->num_threads; i++) {
-        pthread_cond_broadcast(&(pool->q_not_empty));
-    
-        /* allowcode to return NULL */
-        pthread_join(pool->threads[i],&nothing);
+        pthread_join(pool->workers[i].pt,&nothing);
     }
 
-    free(pool->threads);
+    for(i = 0; i < pool->num_threads; i++) {
+        for (a = atomic_load(&pool->workers[i].array); a != NULL; a = retired) {
+            retired = a->retired;
+            free(a);
+        }
+    }
+
+    free(pool->workers);
 
     pthread_mutex_destroy(&(pool->qlock));
+    pthread_mutex_destroy(&(pool->idle_lock));
     pthread_cond_destroy(&(pool->q_empty));
     pthread_cond_destroy(&(pool->q_not_empty));
+    pthread_cond_destroy(&(pool->q_not_full));
+
+    free(pool);
 
     return;
 }
-
-